@@ -36,6 +36,8 @@
 #include <obexftp/obexftp.h>
 #include <obexftp/client.h>
 #include <obexftp/uuid.h>
+#include <obexftp/log.h>
+#include <multicobex/cobex_capture.h>
 
 #ifdef _WIN32
 #define strcasestr strstr
@@ -448,10 +450,10 @@ static void probe_device()
 
 int main(int argc, char *argv[])
 {
-	int verbose = 0;
 	int most_recent_cmd = 0;
 	char *output_file = NULL;
 	char *move_src = NULL;
+	char *copy_src = NULL;
 	int ret = 0;
 
 	/* preset mode of operation depending on our name */
@@ -503,6 +505,7 @@ int main(int argc, char *argv[])
 			{"noconn",	no_argument, NULL, 'H'},
 			{"nopath",	no_argument, NULL, 'S'},
 			{"timeout",	required_argument, NULL, 'T'},
+			{"capture",	required_argument, NULL, 'w'},
 			{"list",	optional_argument, NULL, 'l'},
 			{"chdir",	required_argument, NULL, 'c'},
 			{"mkdir",	required_argument, NULL, 'C'},
@@ -515,6 +518,7 @@ int main(int argc, char *argv[])
 			{"probe",	no_argument, NULL, 'Y'},
 			{"info",	no_argument, NULL, 'x'},
 			{"move",	required_argument, NULL, 'm'},
+			{"copy",	required_argument, NULL, 'y'},
 			{"verbose",	no_argument, NULL, 'v'},
 			{"version",	no_argument, NULL, 'V'},
 			{"help",	no_argument, NULL, 'h'},
@@ -522,7 +526,7 @@ int main(int argc, char *argv[])
 			{0, 0, 0, 0}
 		};
 		
-		c = getopt_long (argc, argv, "-ib::B:d:u::t:n:U::HST:L::l::c:C:f:o:g:G:p:k:XYxm:VvhN:FP",
+		c = getopt_long (argc, argv, "-ib::B:d:u::t:n:U::HST:w:L::l::c:C:f:o:g:G:p:k:XYxm:y:VvhN:FP",
 				 long_options, &option_index);
 		if (c == -1)
 			break;
@@ -637,6 +641,13 @@ int main(int argc, char *argv[])
 			}
 			break;
 
+		case 'w':
+			/* applies to the tty connections that follow */
+			ret = cobex_capture_open(optarg);
+			if (ret < 0)
+				fprintf(stderr, "failed to open %s: %s\n", optarg, strerror(-ret));
+			break;
+
 		case 'L':
 			/* handle severed optional option argument */
 			if (!optarg && argc > optind && argv[optind][0] != '-') {
@@ -771,8 +782,23 @@ int main(int argc, char *argv[])
 			move_src = NULL;
 			break;
 
+		case 'y':
+			most_recent_cmd = c;
+
+			if (copy_src == NULL) {
+				copy_src = optarg;
+				break;
+			}
+			if (cli_connect() >= 0) {
+				/* Copy a file on the device */
+				ret = obexftp_copy(cli, copy_src, optarg);
+			}
+			copy_src = NULL;
+			break;
+
 		case 'v':
-			verbose++;
+			/* applies to the commands that follow */
+			obexftp_log_set_level(obexftp_log_get_level() + 1);
 			break;
 			
 		case 'V':
@@ -791,7 +817,7 @@ int main(int argc, char *argv[])
 #endif
 			        "| -t <dev> | -N <host> ]\n"
 				"[-c <dir> ...] [-C <dir> ] [-l [<dir>]]\n"
-				"[-g <file> ...] [-p <files> ...] [-k <files> ...] [-x] [-m <src> <dest> ...]\n"
+				"[-g <file> ...] [-p <files> ...] [-k <files> ...] [-x] [-m <src> <dest> ...] [-y <src> <dest> ...]\n"
 				"Transfer files from/to Mobile Equipment.\n"
 				"Copyright (c) 2002-2004 Christian W. Zuckschwerdt\n"
 				"\n"
@@ -809,7 +835,8 @@ int main(int argc, char *argv[])
 				" -U, --uuid                  use given uuid (none, FBS, IRMC, S45, SHARP)\n"
 				" -H, --noconn                suppress connection ids (no conn header)\n"
 				" -S, --nopath                dont use setpaths (use path as filename)\n"
-				" -T, --timeout <seconds>     timeout transfer if no accept/reject received\n\n"
+				" -T, --timeout <seconds>     timeout transfer if no accept/reject received\n"
+				" -w, --capture <file>        write the OBEX packets of tty connections to a pcap file\n\n"
 				" -c, --chdir <DIR>           chdir\n"
 				" -C, --mkdir <DIR>           mkdir and chdir\n"
 				" -l, --list [<FOLDER>]       list current/given folder\n"
@@ -822,7 +849,8 @@ int main(int argc, char *argv[])
 				" -X, --capability            retrieve capability object\n"
 				" -Y, --probe                 probe and report device characteristics\n"
 				" -x, --info                  retrieve infos (Siemens)\n"
-				" -m, --move <SRC> <DEST>     move files (Siemens)\n\n"
+				" -m, --move <SRC> <DEST>     move files\n"
+				" -y, --copy <SRC> <DEST>     copy files on the device\n\n"
 				" -v, --verbose               verbose messages\n"
 				" -V, --version               print version info\n"
 				" -h, --help, --usage         this help text\n"
@@ -850,6 +878,7 @@ int main(int argc, char *argv[])
 	}
 
 	cli_disconnect ();
+	cobex_capture_close ();
 
 	exit (-ret);
 
@@ -0,0 +1,648 @@
+/**
+	\file apps/obexftp_replay.c
+	Replay captured OBEX client sessions against a server.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2003-2006 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+/* Reads a capture of obexftpd -w or obexftp -w and sends the client
+   packets of each session to a server over TCP, again and again from
+   several clients at once. Each packet waits for as many responses as
+   the capture shows, or for the final one. The connection ID the
+   server hands out replaces the captured one. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <pthread.h>
+
+#include <multicobex/cobex_capture.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL	0
+#endif
+
+#define MAX_PACKET	0xffff
+/* seconds to wait for a response */
+#define REPLAY_TIMEOUT	10
+
+#define OBEX_CONNECT	0x80
+#define OBEX_SETPATH	0x05
+#define OBEX_CONTINUE	0x10
+#define HDR_CONNECTION	0xcb
+
+typedef struct packet {
+	double t;		/* seconds since the first packet of the session */
+	const uint8_t *data;
+	int len;
+	int responses;		/* server packets before the next client packet */
+	uint8_t rsp;		/* the last of them */
+} packet_t;
+
+typedef struct stream {
+	uint32_t id;
+	double start;
+	packet_t *pkts;
+	int count;
+	int alloc;
+} stream_t;
+
+typedef struct worker {
+	pthread_t thread;
+	int index;
+	uint64_t sessions;
+	uint64_t requests;	/* client packets sent */
+	uint64_t failed;	/* sessions cut short */
+	uint64_t mismatches;	/* final responses other than captured */
+	uint64_t bytes_out;
+	uint64_t bytes_in;
+	double *latency;	/* us, one per answered packet */
+	size_t nlatency;
+	size_t alatency;
+} worker_t;
+
+static stream_t *streams = NULL;
+static int num_streams = 0;
+static struct addrinfo *server = NULL;
+static int clients = 1;
+static int repeat = 1;
+static double speed = 0; /* 0 for no pauses */
+static int verbose = 0;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t get32(const uint8_t *p, int swap)
+{
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	if (swap)
+		v = v >> 24 | (v >> 8 & 0xff00) | (v << 8 & 0xff0000) | v << 24;
+	return v;
+}
+
+static uint32_t get32be(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/* where the headers of a request, or of the response to it, start */
+static int headers_offset(uint8_t opcode, int response)
+{
+	if (opcode == OBEX_CONNECT)
+		return 7;	/* version, flags and packet size */
+	if (!response && (opcode & 0x7f) == OBEX_SETPATH)
+		return 5;	/* flags and constants */
+	return 3;
+}
+
+static stream_t *find_stream(uint32_t id)
+{
+	stream_t *s;
+	int i;
+
+	for (i = 0; i < num_streams; i++)
+		if (streams[i].id == id)
+			return &streams[i];
+	s = realloc(streams, (num_streams + 1) * sizeof(stream_t));
+	if (!s)
+		return NULL;
+	streams = s;
+	s = &streams[num_streams++];
+	memset(s, 0, sizeof(*s));
+	s->id = id;
+	return s;
+}
+
+/*
+ * Function load_capture()
+ *
+ *    Read a pcap file and sort its packets into sessions. The packet
+ *    data stays in the file buffer.
+ *
+ */
+static int load_capture(const char *path, long only)
+{
+	FILE *f;
+	uint8_t *buf;
+	long size;
+	size_t pos;
+	uint32_t magic, caplen;
+	int swap, nsec, dir, role;
+	double t;
+	stream_t *s;
+	packet_t *p;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	buf = NULL;
+	if (fseek(f, 0, SEEK_END) < 0 || (size = ftell(f)) < 24 || fseek(f, 0, SEEK_SET) < 0 ||
+	    !(buf = malloc(size)) || fread(buf, size, 1, f) != 1) {
+		fprintf(stderr, "%s: can't read the capture\n", path);
+		fclose(f);
+		free(buf);
+		return -1;
+	}
+	fclose(f);
+
+	memcpy(&magic, buf, 4);
+	swap = magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1;
+	nsec = magic == 0xa1b23c4d || magic == 0x4d3cb2a1;
+	if ((!swap && magic != 0xa1b2c3d4 && !nsec) ||
+	    get32(&buf[20], swap) != COBEX_CAPTURE_DLT) {
+		fprintf(stderr, "%s: not an OBEX capture\n", path);
+		free(buf);
+		return -1;
+	}
+
+	for (pos = 24; pos + 16 <= (size_t)size; pos += 16 + caplen) {
+		caplen = get32(&buf[pos + 8], swap);
+		if (pos + 16 + caplen > (size_t)size)
+			break; /* cut off */
+		if (caplen < COBEX_CAPTURE_HDRLEN + 3)
+			continue;
+		t = get32(&buf[pos], swap) + get32(&buf[pos + 4], swap) / (nsec ? 1e9 : 1e6);
+		dir = buf[pos + 16];
+		role = buf[pos + 17];
+		if (only >= 0 && get32be(&buf[pos + 20]) != (uint32_t)only)
+			continue;
+		s = find_stream(get32be(&buf[pos + 20]));
+		if (!s) {
+			perror("realloc");
+			return -1;
+		}
+
+		if ((dir == COBEX_CAPTURE_OUT) != (role == COBEX_CAPTURE_CLIENT)) {
+			/* from the server */
+			if (s->count > 0) {
+				s->pkts[s->count - 1].responses++;
+				s->pkts[s->count - 1].rsp = buf[pos + 16 + COBEX_CAPTURE_HDRLEN];
+			}
+			continue;
+		}
+
+		if (s->count == s->alloc) {
+			s->alloc = s->alloc ? 2 * s->alloc : 64;
+			p = realloc(s->pkts, s->alloc * sizeof(packet_t));
+			if (!p) {
+				perror("realloc");
+				return -1;
+			}
+			s->pkts = p;
+		}
+		if (s->count == 0)
+			s->start = t;
+		p = &s->pkts[s->count++];
+		p->t = t - s->start;
+		p->data = &buf[pos + 16 + COBEX_CAPTURE_HDRLEN];
+		p->len = caplen - COBEX_CAPTURE_HDRLEN;
+		p->responses = 0;
+		p->rsp = 0;
+	}
+	return 0;
+}
+
+static int send_all(int sock, const uint8_t *buf, int len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = send(sock, buf, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int recv_all(int sock, uint8_t *buf, int len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = recv(sock, buf, len, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* one whole packet, returns its length */
+static int recv_packet(int sock, uint8_t *buf)
+{
+	int len;
+
+	if (recv_all(sock, buf, 3) < 0)
+		return -1;
+	len = buf[1] << 8 | buf[2];
+	if (len < 3)
+		return -1;
+	if (recv_all(sock, buf + 3, len - 3) < 0)
+		return -1;
+	return len;
+}
+
+/* the CONNECTION header of a packet, or NULL; headers start at pos */
+static uint8_t *find_connection(uint8_t *buf, int len, int pos)
+{
+	int hlen;
+
+	for (; pos < len; pos += hlen) {
+		switch (buf[pos] & 0xc0) {
+		case 0x00: /* unicode text */
+		case 0x40: /* byte sequence */
+			hlen = pos + 3 > len ? 0 : buf[pos + 1] << 8 | buf[pos + 2];
+			break;
+		case 0x80: /* one byte */
+			hlen = 2;
+			break;
+		default: /* four bytes */
+			hlen = 5;
+			break;
+		}
+		if (hlen < 2 || pos + hlen > len)
+			return NULL;
+		if (buf[pos] == HDR_CONNECTION)
+			return &buf[pos + 1];
+	}
+	return NULL;
+}
+
+static void add_latency(worker_t *w, double us)
+{
+	double *l;
+
+	if (w->nlatency == w->alatency) {
+		w->alatency = w->alatency ? 2 * w->alatency : 1024;
+		l = realloc(w->latency, w->alatency * sizeof(double));
+		if (!l)
+			return;
+		w->latency = l;
+	}
+	w->latency[w->nlatency++] = us;
+}
+
+static void pause_until(double t)
+{
+	struct timespec ts;
+	double d = t - now();
+
+	if (d <= 0)
+		return;
+	ts.tv_sec = (time_t) d;
+	ts.tv_nsec = (long) ((d - ts.tv_sec) * 1e9);
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+		;
+}
+
+/*
+ * Function replay_session()
+ *
+ *    Send the client packets of one captured session on a new
+ *    connection.
+ *
+ */
+static int replay_session(worker_t *w, const stream_t *s, uint8_t *out, uint8_t *in)
+{
+	struct timeval tv = { REPLAY_TIMEOUT, 0 };
+	const packet_t *p;
+	uint8_t conn[4], *h;
+	int have_conn = 0;
+	int sock, one = 1;
+	int i, got, len, final, expect_final;
+	double start, sent;
+
+	sock = socket(server->ai_family, SOCK_STREAM, 0);
+	if (sock < 0)
+		return -1;
+	(void) setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	(void) setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	if (connect(sock, server->ai_addr, server->ai_addrlen) < 0) {
+		close(sock);
+		return -1;
+	}
+
+	start = now();
+	for (i = 0; i < s->count; i++) {
+		p = &s->pkts[i];
+		if (speed > 0)
+			pause_until(start + p->t / speed);
+
+		memcpy(out, p->data, p->len);
+		if (have_conn && (h = find_connection(out, p->len, headers_offset(out[0], 0))))
+			memcpy(h, conn, 4);
+
+		sent = now();
+		if (send_all(sock, out, p->len) < 0)
+			goto fail;
+		w->bytes_out += p->len;
+		w->requests++;
+		/* with SRM a PUT goes on unanswered */
+		if (p->responses == 0)
+			continue;
+
+		/* and a single GET gets many packets */
+		expect_final = (p->rsp & 0x7f) != OBEX_CONTINUE;
+		got = 0;
+		do {
+			len = recv_packet(sock, in);
+			if (len < 0)
+				goto fail;
+			w->bytes_in += len;
+			got++;
+			final = (in[0] & 0x7f) != OBEX_CONTINUE;
+		} while (!final && (expect_final || got < p->responses));
+
+		add_latency(w, (now() - sent) * 1e6);
+		if (in[0] != p->rsp) {
+			w->mismatches++;
+			if (verbose)
+				fprintf(stderr, "session %u packet %d: response %02x, captured %02x\n",
+					s->id, i, in[0], p->rsp);
+		}
+		if (out[0] == OBEX_CONNECT && (h = find_connection(in, len, headers_offset(out[0], 1)))) {
+			memcpy(conn, h, 4);
+			have_conn = 1;
+		}
+	}
+	close(sock);
+	return 0;
+
+ fail:
+	if (verbose)
+		fprintf(stderr, "session %u failed at packet %d: %s\n", s->id, i, strerror(errno));
+	close(sock);
+	return -1;
+}
+
+static void *worker_thread(void *arg)
+{
+	worker_t *w = arg;
+	uint8_t *out, *in;
+	int k;
+
+	out = malloc(MAX_PACKET);
+	in = malloc(MAX_PACKET);
+	if (!out || !in)
+		goto out;
+	for (k = 0; k < repeat; k++) {
+		if (replay_session(w, &streams[(w->index + k * clients) % num_streams], out, in) < 0)
+			w->failed++;
+		w->sessions++;
+	}
+ out:
+	free(out);
+	free(in);
+	return NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double quantile(const double *v, size_t n, double q)
+{
+	return n ? v[(size_t)(q * (n - 1))] : 0;
+}
+
+static void report(worker_t *workers, double elapsed)
+{
+	worker_t sum;
+	double *all;
+	size_t n = 0;
+	int i;
+
+	memset(&sum, 0, sizeof(sum));
+	for (i = 0; i < clients; i++) {
+		sum.sessions += workers[i].sessions;
+		sum.requests += workers[i].requests;
+		sum.failed += workers[i].failed;
+		sum.mismatches += workers[i].mismatches;
+		sum.bytes_out += workers[i].bytes_out;
+		sum.bytes_in += workers[i].bytes_in;
+		sum.nlatency += workers[i].nlatency;
+	}
+	all = malloc((sum.nlatency + 1) * sizeof(double));
+	if (all) {
+		for (i = 0; i < clients; i++) {
+			memcpy(all + n, workers[i].latency, workers[i].nlatency * sizeof(double));
+			n += workers[i].nlatency;
+		}
+		qsort(all, n, sizeof(double), cmp_double);
+	}
+
+	printf("replayed %llu sessions (%llu packets) in %.2f s\n",
+	       (unsigned long long)sum.sessions, (unsigned long long)sum.requests, elapsed);
+	printf("%.1f packets/s, %.2f MiB/s out, %.2f MiB/s in\n",
+	       sum.requests / elapsed, sum.bytes_out / elapsed / 1048576, sum.bytes_in / elapsed / 1048576);
+	if (all)
+		printf("latency us: p50 %.0f  p90 %.0f  p99 %.0f  max %.0f\n",
+		       quantile(all, n, 0.5), quantile(all, n, 0.9), quantile(all, n, 0.99),
+		       n ? all[n - 1] : 0);
+	printf("failed sessions %llu, unexpected responses %llu\n",
+	       (unsigned long long)sum.failed, (unsigned long long)sum.mismatches);
+	free(all);
+}
+
+static int resolve(const char *arg)
+{
+	struct addrinfo hints;
+	char host[256];
+	const char *port = "650";
+	char *colon;
+	int ret;
+
+	snprintf(host, sizeof(host), "%s", arg);
+	/* a port only after a name or an IPv4 address */
+	colon = strchr(host, ':');
+	if (colon && colon == strrchr(host, ':')) {
+		*colon = '\0';
+		port = colon + 1;
+	}
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (server)
+		freeaddrinfo(server);
+	server = NULL;
+	ret = getaddrinfo(host, port, &hints, &server);
+	if (ret != 0) {
+		fprintf(stderr, "%s: %s\n", arg, gai_strerror(ret));
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	worker_t *workers;
+	long only = -1;
+	double start;
+	int c, i;
+
+	while (1) {
+		int option_index = 0;
+		static struct option long_options[] = {
+			{"network",	required_argument, NULL, 'n'},
+			{"clients",	required_argument, NULL, 'c'},
+			{"repeat",	required_argument, NULL, 'r'},
+			{"speed",	required_argument, NULL, 's'},
+			{"stream",	required_argument, NULL, 'S'},
+			{"verbose",	no_argument, NULL, 'v'},
+			{"version",	no_argument, NULL, 'V'},
+			{"help",	no_argument, NULL, 'h'},
+			{"usage",	no_argument, NULL, 'h'},
+			{0, 0, 0, 0}
+		};
+
+		c = getopt_long (argc, argv, "n:c:r:s:S:vVh",
+				 long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'n':
+			if (resolve(optarg) < 0)
+				exit(-1);
+			break;
+
+		case 'c':
+			clients = atoi(optarg);
+			break;
+
+		case 'r':
+			repeat = atoi(optarg);
+			break;
+
+		case 's':
+			speed = atof(optarg);
+			break;
+
+		case 'S':
+			only = atol(optarg);
+			break;
+
+		case 'v':
+			verbose++;
+			break;
+
+		case 'V':
+			printf("ObexFTP replay %s\n", VERSION);
+			exit(0);
+
+		case 'h':
+			printf("ObexFTP replay %s\n", VERSION);
+			printf("Usage: %s  [-n <host>[:<port>]]  [-c <n>]  [-r <n>]  [-s <x>]  [-S <id>]  [-v]  <capture.pcap>\n"
+				"Replay captured OBEX sessions against a server.\n"
+				"\n"
+				" -n, --network <host>[:<port>] the server, default 127.0.0.1:650\n"
+				" -c, --clients <n>             sessions at the same time\n"
+				" -r, --repeat <n>              sessions each client runs in a row\n"
+				" -s, --speed <x>               keep the captured pauses, shortened x times,\n"
+				"                               0 sends at once (default)\n"
+				" -S, --stream <id>             replay only this captured session\n"
+				" -v, --verbose                 report failures and unexpected responses\n"
+				"\n"
+				" -V, --version                 print version info\n"
+				" -h, --help, --usage           this help text\n",
+				argv[0]);
+			exit(0);
+
+		default:
+			printf("Try `%s --help' for more information.\n",
+				 argv[0]);
+			exit(-1);
+		}
+	}
+
+	if (optind + 1 != argc) {
+		fprintf(stderr, "Give one capture file. Use --help for help.\n");
+		exit(-1);
+	}
+	if (clients < 1)
+		clients = 1;
+	if (repeat < 1)
+		repeat = 1;
+	if (!server && resolve("127.0.0.1") < 0)
+		exit(-1);
+
+	if (load_capture(argv[optind], only) < 0)
+		exit(-1);
+	/* sessions without client packets are of no use */
+	for (i = 0; i < num_streams; )
+		if (streams[i].count == 0)
+			streams[i] = streams[--num_streams];
+		else
+			i++;
+	if (num_streams == 0) {
+		fprintf(stderr, "%s: no client sessions\n", argv[optind]);
+		exit(-1);
+	}
+	if (verbose)
+		for (i = 0; i < num_streams; i++)
+			fprintf(stderr, "session %u: %d packets over %.3f s\n", streams[i].id,
+				streams[i].count, streams[i].pkts[streams[i].count - 1].t);
+
+	workers = calloc(clients, sizeof(worker_t));
+	if (!workers) {
+		perror("calloc");
+		exit(-1);
+	}
+	start = now();
+	for (i = 0; i < clients; i++) {
+		workers[i].index = i;
+		if (pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i]) != 0) {
+			perror("pthread_create");
+			clients = i;
+			break;
+		}
+	}
+	for (i = 0; i < clients; i++)
+		(void) pthread_join(workers[i].thread, NULL);
+
+	report(workers, now() - start);
+	exit(0);
+}
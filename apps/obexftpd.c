@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <dirent.h>
@@ -33,6 +34,10 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <signal.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -60,7 +65,16 @@
 #include <obexftp/obexftp.h>
 #include <obexftp/object.h>
 #include <obexftp/unicode.h>
+#include <obexftp/log.h>
+#include <multicobex/cobex_capture.h>
 #include <common.h>
+#include <probes.h>
+#include "obexftpd_loop.h"
+#include "obexftpd_pool.h"
+#include "obexftpd_io.h"
+#include "obexftpd_tcp.h"
+#include "obexftpd_store.h"
+#include "obexftpd_metrics.h"
 
 /* define this to "", "\r\n" or "\n" */
 #define EOLCHARS "\n"
@@ -68,22 +82,160 @@
 /* Application defined headers */
 #define HDR_CREATOR  0xcf	/* so we don't require OpenOBEX 1.3 */
 
-#define WORK_PATH_MAX		128
-#define CUR_DIR				"./"
+/* threads for the stat calls of large folder listings */
+#define STAT_THREADS	4
+
+
+/* default window to batch durable PUTs in, ms */
+#define COMMIT_WINDOW	20
+
+/* default memory for hot file bodies, larger files are not kept */
+#define CONTENT_CACHE_SIZE	(32 * 1024 * 1024)
+#define CONTENT_MAX_SHARE	8	/* of the cache for one file */
+
+/* how much a rate limit lets through at once, in ms of the rate */
+#define BUCKET_BURST	100
+
+/* chunks in flight per transfer, and their size */
+#define IO_DEPTH	4
+#define IO_CHUNK	(16 * 1024)
+
+enum chunk_state {
+	CHUNK_FREE,
+	CHUNK_BUSY,	/* I/O in flight */
+	CHUNK_READY,	/* read, waiting to be sent */
+	CHUNK_SENT	/* handed to OpenOBEX */
+};
+
+struct session;
+
+/* a transfer buffer, read ahead for GET, written behind for PUT */
+typedef struct chunk {
+	struct session *s;	/* NULL once its transfer was given up */
+	struct chunk *next;	/* in the orphans list */
+	uint8_t *buf;
+	int fd;			/* file of the I/O in flight */
+	off_t offset;		/* of buf in the file */
+	int len;		/* bytes in buf or a negative errno */
+	int state;
+} chunk_t;
+
+/* a file body in memory, shared by the sessions sending it */
+typedef struct content {
+	struct content *next;
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	off_t size;
+	uint8_t *data;
+	off_t filled;		/* bytes read so far, size once ready */
+	int refs;		/* sessions sending it, or filling it */
+	int stale;		/* the file changed, free when unused */
+	unsigned long used;	/* for LRU replacement */
+} content_t;
+
+/* a token bucket rate limit */
+typedef struct bucket {
+	long long rate;		/* bytes per second, 0 for no limit */
+	long long tokens;	/* bytes that may pass, negative in debt */
+	long long stamp;	/* ms of the last refill, see now_ms() */
+} bucket_t;
+
+/* per client state */
+typedef struct session {
+	struct session *next;
+	obex_t *handle;
+	obex_ctrans_t *ctrans;	/* our TCP transport or NULL */
+	int fd;			/* the transport fd watched by the loop */
+	int transport;		/* OBEX_TRANS_* it came in on */
+	long long req_start;	/* us when the request began, see metrics_now_us() */
+	int packets;		/* progress events of the request, for tracing */
+	int cwd_fd;		/* the current folder */
+	int depth;		/* levels below root_fd */
+	uint32_t connection_id;
+	char *put_name;		/* name of the PUT in progress */
+	char *put_tmp;		/* its temporary file, NULL if unnamed */
+	int put_fd;		/* its file or -1 */
+	uint32_t put_length;	/* its announced length or 0 */
+	off_t put_written;	/* bytes written so far */
+	int put_body;		/* a body was seen */
+	int put_error;		/* response after a failure or 0 */
+	uint64_t put_charged;	/* its bytes counted in put_inflight */
+	int get_fd;		/* file of the GET in progress or -1 */
+	off_t get_offset;	/* next offset to read */
+	off_t get_size;
+	chunk_t *chunks[IO_DEPTH];
+	content_t *get_content;	/* the body is sent from here, or NULL */
+	content_t *get_fill;	/* the body read also fills this, or NULL */
+	int chunk_head;		/* next chunk to send */
+	int io_pending;		/* chunks with I/O in flight */
+	obex_object_t *io_object; /* request suspended for I/O or NULL */
+	uint8_t *put_held;	/* body data no chunk was free for */
+	int put_held_len;
+	int put_finishing;	/* the PUT is complete, its writes are not */
+	struct session *commit_next;
+	obex_object_t *commit_object; /* PUT waiting for the group commit or NULL */
+	int commit_fd;		/* its file */
+	int commit_rsp;
+	dev_t commit_dev;	/* its folder */
+	ino_t commit_ino;
+	bucket_t bucket;	/* the session rate limit */
+	int throttled;		/* over a rate limit, wait for shape_run() */
+	int refused;		/* over the session limit, refuse requests */
+	int finished;
+} session_t;
+
+#define MAX_LISTENERS	4
+
+/* a transport accepting connections */
+typedef struct listener {
+	int transport;
+	char *device;		/* address to bind to, for TCP */
+	int channel;		/* port or RFCOMM channel */
+	obex_t *handle;		/* NULL for our own TCP listener */
+	int fd;
+	int reset;		/* failed, register it again */
+} listener_t;
 
 
 static char *device = NULL;
 static int channel = 10; /* OBEX_PUSH_HANDLE */
-
-static char init_work_path[WORK_PATH_MAX];
+static int zerocopy = 0; /* serve TCP with our own transport */
+static int commit_window = -1; /* durable PUTs, batch window in ms or -1 */
+static int srm = 1; /* allow Single Response Mode */
+static long long session_rate = 0; /* bytes per second and session, 0 for no limit */
+static long long total_rate = 0; /* bytes per second for all sessions */
+static int max_sessions = 0; /* 0 for no limit */
+static uint64_t max_inflight = 0; /* PUT bytes at a time, 0 for no limit */
+
+/* stands in for GET bodies that the transport sends from the file */
+static const uint8_t zero_body[IO_CHUNK];
+
+static const store_ops_t *store = &store_posix;
+static int root_fd = -1; /* the served folder */
+static session_t *sessions = NULL;
+static int num_sessions = 0; /* not counting refused ones */
+static bucket_t total_bucket; /* the rate limit of all sessions */
+static uint64_t put_inflight = 0; /* PUT bytes announced or received */
+static listener_t listeners[MAX_LISTENERS];
+static int num_listeners = 0;
+static content_t *contents = NULL;
+static size_t content_budget = CONTENT_CACHE_SIZE;
+static size_t content_bytes = 0;
+static unsigned long content_tick = 0;
+static session_t *commit_queue = NULL; /* PUTs waiting for the next group commit */
+static long long commit_deadline; /* ms, see now_ms() */
+static char *status_file = NULL; /* SIGUSR1 dumps the metrics here, stdout if NULL */
+static char *capture_file = NULL; /* pcap of the network sessions */
+#ifdef SIGUSR1
+static int signal_pipe[2] = { -1, -1 };
+#endif
 
 volatile int finished = 0;
 volatile int success = 0;
-volatile int obexftpd_reset = 0;
 
 uint32_t connection_id = 0;
 
-int verbose = 0;
 
 // this whole thing needs a review:
 static int parsehostport(const char *name, char **host, int *port) {
@@ -117,7 +269,6 @@ static int parsehostport(const char *name, char **host, int *port) {
 //BEGIN of compositor the folder listing XML document
 struct rawdata_stream {
 	char		*data;
-	unsigned int	block_size;
 	unsigned int 	size;
 	unsigned int 	max_size;
 };
@@ -137,37 +288,40 @@ static struct rawdata_stream* INIT_RAWDATA_STREAM(unsigned int size)
 		return NULL;
 	}
 
-       	memset(stream->data,0,size);
+       	stream->data[0] = '\0';
        	stream->size = 0;
-       	stream->block_size = size;
        	stream->max_size = size;
 
 	return stream;
 }
 
+/* append at the known end, the buffer doubles when full */
 static int ADD_RAWDATA_STREAM_DATA(struct rawdata_stream *stream, const char *data)
 {
 	char   		*databuf;
 	unsigned int 	size;
+	unsigned int 	max_size;
 
 	if (data == NULL) return 0;
 	size = strlen(data);
 	if (size == 0) return 0;
 	if ((size + stream->size) >= stream->max_size)
 	{
-		while((size + stream->size) >= stream->max_size)
+		max_size = stream->max_size;
+		while((size + stream->size) >= max_size)
 		{
-			stream->max_size += stream->block_size;
+			max_size *= 2;
 		}
-		databuf = realloc(stream->data, stream->max_size);
+		databuf = realloc(stream->data, max_size);
 		if (NULL == databuf)
 		{
-			fprintf(stderr, "realloc() failed\n");
+			OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "realloc() failed\n");
 			return -1; 
 		}
 		stream->data = databuf;
+		stream->max_size = max_size;
 	}
-	strcat(stream->data, data);
+	memcpy(stream->data + stream->size, data, size + 1);
 	stream->size += size;
 	return size;
 }
@@ -254,12 +408,444 @@ inline static void FL_XML_BODY_TIME(struct rawdata_stream *stream,
 
 //END of compositor the folder listing XML document
 
+/* one folder entry while a listing is built */
+struct listing_entry {
+	char		*name;
+	struct stat	st;
+	int		ok;
+};
+
+struct listing_batch {
+	int			dirfd;
+	struct listing_entry	*entries;
+};
+
+/* runs on the worker pool */
+static void stat_entry(int index, void *data)
+{
+	struct listing_batch *batch = data;
+	struct listing_entry *entry = &batch->entries[index];
+
+	entry->ok = store->stat(batch->dirfd, entry->name, &entry->st) == 0;
+}
+
+struct listing_names {
+	struct listing_entry	*entries;
+	int			count;
+	int			max_count;
+};
+
+static int add_listing_name(const char *name, void *data)
+{
+	struct listing_names *names = data;
+	struct listing_entry *tmp;
+
+	if (names->count >= names->max_count) {
+		names->max_count = names->max_count ? names->max_count * 2 : 64;
+		tmp = realloc(names->entries, names->max_count * sizeof(*tmp));
+		if (NULL == tmp)
+			return -1;
+		names->entries = tmp;
+	}
+	names->entries[names->count].name = strdup(name);
+	if (NULL == names->entries[names->count].name)
+		return -1;
+	names->count++;
+	return 0;
+}
+
+/*
+ * Function build_listing()
+ *
+ *    Render the folder listing of a directory. The entries are read
+ *    first, then stat'ed in parallel and rendered in readdir order.
+ *
+ */
+static struct rawdata_stream *build_listing(int cwd_fd, const struct stat *statdir)
+{
+	struct listing_names	names = { NULL, 0, 0 };
+	struct listing_batch	batch;
+	struct listing_entry	*entries;
+	int			count;
+	int			i;
+	struct rawdata_stream	*xmldata;
+
+	(void) store->list(cwd_fd, add_listing_name, &names);
+	entries = names.entries;
+	count = names.count;
+
+	batch.dirfd = cwd_fd;
+	batch.entries = entries;
+	pool_run(count, stat_entry, &batch);
+
+	xmldata = INIT_RAWDATA_STREAM(512);
+	if (NULL == xmldata)
+		goto out;
+
+	FL_XML_VERSION(xmldata);
+	FL_XML_TYPE(xmldata);
+	FL_XML_BODY_BEGIN(xmldata);
+
+	for (i = 0; i < count; i++)
+	{
+		if (!entries[i].ok)
+			continue;
+
+		FL_XML_BODY_ITEM_BEGIN(xmldata);
+
+		if (0 == S_ISDIR(entries[i].st.st_mode)) //it is a file
+			FL_XML_BODY_FILENAME(xmldata, entries[i].name);				
+		else	//it is a directory
+			FL_XML_BODY_FOLDERNAME(xmldata, entries[i].name);
+		
+		FL_XML_BODY_SIZE(xmldata, entries[i].st.st_size);
+		FL_XML_BODY_PERM(xmldata, entries[i].st.st_mode, statdir->st_mode);
+		FL_XML_BODY_MTIME(xmldata, entries[i].st.st_mtime);
+		FL_XML_BODY_CTIME(xmldata, entries[i].st.st_ctime);
+		FL_XML_BODY_ATIME(xmldata, entries[i].st.st_atime);
+
+		FL_XML_BODY_ITEM_END(xmldata);
+	}
+	FL_XML_BODY_END(xmldata);
+
+	OBEXFTP_LOG(OBEXFTP_LOG_VERBOSE, "xml doc:%s\n", xmldata->data);
+
+out:
+	for (i = 0; i < count; i++)
+		free(entries[i].name);
+	free(entries);
+	return xmldata;
+}
+
+/* rendered listings, shared by all sessions */
+#define LISTING_CACHE_SIZE	64
+/* without a watch file changes go unnoticed, don't trust a listing forever */
+#define LISTING_CACHE_TTL	5
+
+struct listing_cache {
+	int			in_use;
+	dev_t			dev;
+	ino_t			ino;
+	struct timespec		mtime;
+	time_t			timestamp;	/* when rendered */
+	unsigned long		used;		/* for LRU replacement */
+	int			wd;		/* inotify watch or -1 */
+	struct rawdata_stream	*xmldata;	/* NULL if invalidated */
+};
+
+static struct listing_cache listing_cache[LISTING_CACHE_SIZE];
+static unsigned long listing_tick = 0;
+static int inotify_fd = -1;
+
+/* forget a rendered listing, the slot and its watch stay */
+static void invalidate_listing(struct listing_cache *entry)
+{
+	if (entry->xmldata)
+		FREE_RAWDATA_STREAM(entry->xmldata);
+	entry->xmldata = NULL;
+}
+
+/* free a slot and stop watching its folder */
+static void drop_listing(struct listing_cache *entry)
+{
+	invalidate_listing(entry);
+#ifdef HAVE_SYS_INOTIFY_H
+	if (entry->in_use && entry->wd >= 0 && inotify_fd >= 0)
+		(void) inotify_rm_watch(inotify_fd, entry->wd);
+#endif
+	entry->wd = -1;
+	entry->in_use = 0;
+}
+
+/* start watching the folder of a slot */
+static void watch_listing(struct listing_cache *entry, int cwd_fd)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+	char path[32];
+
+	if (inotify_fd < 0 || entry->wd >= 0 || !store->fds)
+		return;
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", cwd_fd);
+	entry->wd = inotify_add_watch(inotify_fd, path,
+			IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+			IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF |
+			IN_ONLYDIR);
+	if (entry->wd < 0)
+		OBEXFTP_LOG(OBEXFTP_LOG_INFO, "inotify_add_watch: %s\n", strerror(errno));
+#endif
+}
+
+/*
+ * Function get_listing()
+ *
+ *    Get the folder listing of a directory, from the cache if the
+ *    folder did not change. The stream belongs to the cache.
+ *
+ */
+static struct rawdata_stream *get_listing(int cwd_fd)
+{
+	struct listing_cache	*entry = NULL, *victim = NULL;
+	struct stat		statdir;
+	time_t			now = time(NULL);
+	int			i;
+
+	if (store->fstat(cwd_fd, &statdir) < 0)
+		return NULL;
+
+	for (i = 0; i < LISTING_CACHE_SIZE; i++) {
+		if (listing_cache[i].in_use &&
+		    listing_cache[i].dev == statdir.st_dev &&
+		    listing_cache[i].ino == statdir.st_ino) {
+			entry = &listing_cache[i];
+			break;
+		}
+		/* a free slot or the least recently used one */
+		if (!victim || (victim->in_use &&
+		    (!listing_cache[i].in_use || listing_cache[i].used < victim->used)))
+			victim = &listing_cache[i];
+	}
+
+	if (entry && entry->xmldata &&
+	    entry->mtime.tv_sec == statdir.st_mtim.tv_sec &&
+	    entry->mtime.tv_nsec == statdir.st_mtim.tv_nsec &&
+	    (entry->wd >= 0 || now - entry->timestamp < LISTING_CACHE_TTL)) {
+		OBEXFTP_LOG(OBEXFTP_LOG_VERBOSE, "Listing from cache\n");
+		metrics.listing_hits++;
+		entry->used = ++listing_tick;
+		return entry->xmldata;
+	}
+	metrics.listing_misses++;
+
+	if (!entry) {
+		entry = victim;
+		if (entry->in_use)
+			drop_listing(entry);
+		entry->in_use = 1;
+		entry->wd = -1;
+		entry->dev = statdir.st_dev;
+		entry->ino = statdir.st_ino;
+	}
+	/* watch first, a change while rendering must not get lost */
+	watch_listing(entry, cwd_fd);
+
+	invalidate_listing(entry);
+	entry->xmldata = build_listing(cwd_fd, &statdir);
+	entry->mtime = statdir.st_mtim;
+	entry->timestamp = now;
+	entry->used = ++listing_tick;
+
+	return entry->xmldata;
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+/*
+ * Function listing_watch_input()
+ *
+ *    Drop the listings of folders that changed.
+ *
+ */
+static void listing_watch_input(int fd, void *UNUSED(data))
+{
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	ssize_t len;
+	char *p;
+	int i;
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len) {
+			ev = (const struct inotify_event *) p;
+
+			if (ev->mask & IN_Q_OVERFLOW) {
+				/* events were lost */
+				for (i = 0; i < LISTING_CACHE_SIZE; i++)
+					invalidate_listing(&listing_cache[i]);
+				continue;
+			}
+
+			for (i = 0; i < LISTING_CACHE_SIZE; i++) {
+				if (!listing_cache[i].in_use || listing_cache[i].wd != ev->wd)
+					continue;
+				OBEXFTP_LOG(OBEXFTP_LOG_VERBOSE, "Folder changed (%x %s)\n", ev->mask, ev->len ? ev->name : "");
+				if (ev->mask & IN_IGNORED) {
+					/* the kernel removed the watch */
+					listing_cache[i].wd = -1;
+					drop_listing(&listing_cache[i]);
+				} else
+					invalidate_listing(&listing_cache[i]);
+				break;
+			}
+		}
+	}
+}
+#endif
+
+/* watch the cached folders for local changes */
+static void init_listing_cache(void)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+	if (inotify_fd >= 0)
+		return;
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd < 0) {
+		OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "inotify_init: %s\n", strerror(errno));
+		return;
+	}
+	if (0 > loop_add(inotify_fd, listing_watch_input, NULL)) {
+		close(inotify_fd);
+		inotify_fd = -1;
+	}
+#endif
+}
+
+static void flush_listing_cache(void)
+{
+	int i;
+
+	for (i = 0; i < LISTING_CACHE_SIZE; i++)
+		drop_listing(&listing_cache[i]);
+	if (inotify_fd >= 0) {
+		loop_del(inotify_fd);
+		close(inotify_fd);
+	}
+	inotify_fd = -1;
+}
+
+/* seconds a rendered capability object is reused */
+#define CAPABILITY_TTL	2
+
+static struct rawdata_stream *capability = NULL;
+static time_t capability_timestamp;
+
+/* a Memory section for the file system holding fd */
+static void add_capability_memory(struct rawdata_stream *xmldata, int fd, const char *location)
+{
+	uint64_t avail, total;
+	char str[96];
+
+	if (store->space(fd, &avail, &total) < 0)
+		return;
+	ADD_RAWDATA_STREAM_DATA(xmldata, "  <Memory>" EOLCHARS);
+	ADD_RAWDATA_STREAM_DATA(xmldata, "   <MemType>DEV</MemType>" EOLCHARS);
+	ADD_RAWDATA_STREAM_DATA(xmldata, "   <Location>");
+	ADD_RAWDATA_STREAM_DATA(xmldata, location);
+	ADD_RAWDATA_STREAM_DATA(xmldata, "</Location>" EOLCHARS);
+	snprintf(str, sizeof(str), "   <Free>%llu</Free>" EOLCHARS, (unsigned long long)avail);
+	ADD_RAWDATA_STREAM_DATA(xmldata, str);
+	snprintf(str, sizeof(str), "   <Used>%llu</Used>" EOLCHARS,
+		 (unsigned long long)(total > avail ? total - avail : 0));
+	ADD_RAWDATA_STREAM_DATA(xmldata, str);
+	ADD_RAWDATA_STREAM_DATA(xmldata, "   <FileNLen>255</FileNLen>" EOLCHARS);
+	ADD_RAWDATA_STREAM_DATA(xmldata, "   <CaseSenc/>" EOLCHARS);
+	ADD_RAWDATA_STREAM_DATA(xmldata, "  </Memory>" EOLCHARS);
+}
+
+struct capability_mounts {
+	struct rawdata_stream *xmldata;
+	dev_t dev;		/* of the base folder */
+};
+
+/* folders in the base folder that are on another file system */
+static int add_capability_mount(const char *name, void *data)
+{
+	struct capability_mounts *mounts = data;
+	struct stat st;
+	int fd;
+
+	if (strpbrk(name, "<>&\"'"))
+		return 0; /* no way to put it in the document */
+	if (store->stat(root_fd, name, &st) < 0 || !S_ISDIR(st.st_mode) ||
+	    st.st_dev == mounts->dev)
+		return 0;
+	fd = store->open(root_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW, 0);
+	if (fd < 0)
+		return 0;
+	add_capability_memory(mounts->xmldata, fd, name);
+	store->close(fd);
+	return 0;
+}
+
+/*
+ * Function get_capability()
+ *
+ *    The capability object. Its Memory sections describe the file
+ *    system of the base folder and of any folder in it that is mounted
+ *    from elsewhere. It is rendered again after CAPABILITY_TTL seconds,
+ *    so many clients asking for their statfs() cost next to nothing.
+ *
+ */
+static struct rawdata_stream *get_capability(void)
+{
+	struct capability_mounts mounts;
+	struct rawdata_stream *xmldata;
+	struct stat statroot;
+	time_t now = time(NULL);
+
+	if (capability && now - capability_timestamp < CAPABILITY_TTL) {
+		OBEXFTP_LOG(OBEXFTP_LOG_VERBOSE, "Capability from cache\n");
+		metrics.capability_hits++;
+		return capability;
+	}
+	metrics.capability_misses++;
+
+	if (store->fstat(root_fd, &statroot) < 0)
+		return NULL;
+	xmldata = INIT_RAWDATA_STREAM(1024);
+	if (NULL == xmldata)
+		return NULL;
+
+	ADD_RAWDATA_STREAM_DATA(xmldata, "<?xml version=\"1.0\"?>" EOLCHARS);
+	ADD_RAWDATA_STREAM_DATA(xmldata, "<!DOCTYPE Capability SYSTEM \"obex-capability.dtd\">" EOLCHARS);
+	ADD_RAWDATA_STREAM_DATA(xmldata, "<Capability Version=\"1.0\">" EOLCHARS);
+	ADD_RAWDATA_STREAM_DATA(xmldata, " <General>" EOLCHARS);
+	ADD_RAWDATA_STREAM_DATA(xmldata, "  <Manufacturer>ObexFTP</Manufacturer>" EOLCHARS);
+	ADD_RAWDATA_STREAM_DATA(xmldata, "  <Model>obexftpd</Model>" EOLCHARS);
+	ADD_RAWDATA_STREAM_DATA(xmldata, "  <SW Version=\"" VERSION "\"/>" EOLCHARS);
+	add_capability_memory(xmldata, root_fd, "/");
+	mounts.xmldata = xmldata;
+	mounts.dev = statroot.st_dev;
+	(void) store->list(root_fd, add_capability_mount, &mounts);
+	ADD_RAWDATA_STREAM_DATA(xmldata, " </General>" EOLCHARS);
+	ADD_RAWDATA_STREAM_DATA(xmldata, " <Service>" EOLCHARS);
+	ADD_RAWDATA_STREAM_DATA(xmldata, "  <Name>Folder-Browsing</Name>" EOLCHARS);
+	ADD_RAWDATA_STREAM_DATA(xmldata, "  <UUID>F9EC7BC4-953C-11D2-984E-525400DC9E09</UUID>" EOLCHARS);
+	ADD_RAWDATA_STREAM_DATA(xmldata, "  <Version>1.0</Version>" EOLCHARS);
+	ADD_RAWDATA_STREAM_DATA(xmldata, " </Service>" EOLCHARS);
+	ADD_RAWDATA_STREAM_DATA(xmldata, "</Capability>" EOLCHARS);
+
+	OBEXFTP_LOG(OBEXFTP_LOG_VERBOSE, "xml doc:%s\n", xmldata->data);
+	if (capability)
+		FREE_RAWDATA_STREAM(capability);
+	capability = xmldata;
+	capability_timestamp = now;
+	return capability;
+}
+
+static void flush_capability(void)
+{
+	if (capability)
+		FREE_RAWDATA_STREAM(capability);
+	capability = NULL;
+}
+
 inline static int is_type_fl(const char *type)
 {
 	return (type && strcmp(type, XOBEX_LISTING) == 0);
 }
 
-static void connect_server(obex_t *handle, obex_object_t *object)
+inline static int is_type_cap(const char *type)
+{
+	return (type && strcmp(type, XOBEX_CAPABILITY) == 0);
+}
+
+/* a plain name in the current folder, no way out of it */
+static int is_safe_name(const char *name)
+{
+	return (name && *name && strchr(name, '/') == NULL &&
+		strcmp(name, ".") && strcmp(name, ".."));
+}
+
+static void connect_server(session_t *s, obex_t *handle, obex_object_t *object)
 {
 	obex_headerdata_t hv;
 	uint8_t hi;
@@ -281,37 +867,53 @@ static void connect_server(obex_t *handle, obex_object_t *object)
 			}
 			break;
 		default:	
-			printf("%s() Skipped header %02x\n", __FUNCTION__, hi);
+			OBEXFTP_LOG(OBEXFTP_LOG_DEBUG, "%s() Skipped header %02x\n", __FUNCTION__, hi);
 			break;
 		}
 	}
 
 	OBEX_ObjectSetRsp(object, OBEX_RSP_SUCCESS, OBEX_RSP_SUCCESS);
-	hv.bq4 = connection_id;
+#ifdef HAVE_OBEX_SRM
+	/* GETs and PUTs of this connection may then enable SRM, with an SRM
+	   header in their first request, and run without a CONTINUE per packet.
+	   Clients that do not ask for it are served as before. */
+	if (srm)
+		(void) OBEX_SetReponseMode(handle, OBEX_RSP_MODE_SINGLE);
+#endif
+	hv.bq4 = s->connection_id;
 	if(OBEX_ObjectAddHeader(handle, object, OBEX_HDR_CONNECTION,
               		hv, sizeof(hv.bq4),
                             OBEX_FL_FIT_ONE_PACKET) < 0 )    {
-                fprintf(stderr, "Error adding header CONNECTION\n");
+                OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "Error adding header CONNECTION\n");
                 OBEX_ObjectDelete(handle, object);
+                free(target);
                 return;
         }
 	if (target && target_len) {
 		hv.bs = target;
 		if(OBEX_ObjectAddHeader(handle,object,OBEX_HDR_WHO,
 					hv,target_len,OBEX_FL_FIT_ONE_PACKET) < 0 ) {
-			fprintf(stderr, "Error adding header WHO\n");
+			OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "Error adding header WHO\n");
 			OBEX_ObjectDelete(handle, object);
-			return;
 		}
-		free(target);
 	} 
+	free(target);
 }
 
 
-static void set_server_path(obex_t *handle, obex_object_t *object)
+/* replace the current folder of a session */
+static void set_cwd(session_t *s, int fd, int depth)
+{
+	store->close(s->cwd_fd);
+	s->cwd_fd = fd;
+	s->depth = depth;
+}
+
+static void set_server_path(session_t *s, obex_t *handle, obex_object_t *object)
 {
 	char *name = NULL;
-	char fullname[WORK_PATH_MAX];
+	int to_root = 0;
+	int fd;
 
 	// "Backup Level" and "Don't Create" flag in first byte
 	uint8_t setpath_nohdr_dummy = 0;
@@ -323,209 +925,640 @@ static void set_server_path(obex_t *handle, obex_object_t *object)
 	OBEX_ObjectGetNonHdrData(object, &setpath_nohdr_data);
 	if (NULL == setpath_nohdr_data) {
 		setpath_nohdr_data = &setpath_nohdr_dummy;
-		printf("nohdr data not found\n");
+		OBEXFTP_LOG(OBEXFTP_LOG_DEBUG, "nohdr data not found\n");
 	}
-	printf("nohdr data: %x\n", *setpath_nohdr_data);
+	OBEXFTP_LOG(OBEXFTP_LOG_DEBUG, "nohdr data: %x\n", *setpath_nohdr_data);
 
 	while(OBEX_ObjectGetNextHeader(handle, object, &hi, &hv, &hlen))	{
 		switch(hi)	{
 		case OBEX_HDR_NAME:
-			printf("%s() Found name\n", __FUNCTION__);
+			OBEXFTP_LOG(OBEXFTP_LOG_DEBUG, "%s() Found name\n", __FUNCTION__);
 			if (0 < hlen)
 			{
 				if( (name = malloc(hlen / 2)))	{
 					UnicodeToChar((uint8_t*)name, hv.bs, hlen);
-					printf("name:%s\n", name);
+					OBEXFTP_LOG(OBEXFTP_LOG_DEBUG, "name:%s\n", name);
 				}
 			}
 			else
-			{
-				if (verbose) printf("set path to root\n");
-				chdir(init_work_path);
-			}
+				to_root = 1;
 			break;
 			
 		default:
-			printf("%s() Skipped header %02x\n", __FUNCTION__, hi);
+			OBEXFTP_LOG(OBEXFTP_LOG_DEBUG, "%s() Skipped header %02x\n", __FUNCTION__, hi);
 		}
 	}	
-	
+
+	if (to_root)
+	{
+		OBEXFTP_LOG(OBEXFTP_LOG_INFO, "set path to root\n");
+		fd = store->dup(root_fd);
+		if (fd < 0)
+			OBEX_ObjectSetRsp(object, OBEX_RSP_CONTINUE, OBEX_RSP_INTERNAL_SERVER_ERROR);
+		else
+			set_cwd(s, fd, 0);
+	}
+	else if (*setpath_nohdr_data & 1)
+	{
+		/* never leave the served folder */
+		if (s->depth == 0 ||
+		    (fd = store->open(s->cwd_fd, "..", O_RDONLY | O_DIRECTORY, 0)) < 0)
+		{
+			OBEXFTP_LOG(OBEXFTP_LOG_INFO, "can't go up from here\n");
+			OBEX_ObjectSetRsp(object, OBEX_RSP_CONTINUE, OBEX_RSP_NOT_FOUND);
+			free(name);
+			return;
+		}
+		OBEXFTP_LOG(OBEXFTP_LOG_INFO, "set path to parent\n");
+		set_cwd(s, fd, s->depth - 1);
+	}
+
 	if (name)
 	{
-		if (strstr(name, "/../"))
+		if (!is_safe_name(name))
 		{
 			OBEX_ObjectSetRsp(object, OBEX_RSP_CONTINUE, OBEX_RSP_FORBIDDEN);
 		} else {
-		strcpy(fullname, CUR_DIR);
-		strncat(fullname, name, sizeof(fullname)-1);
 		if ((*setpath_nohdr_data & 2) == 0) {
-			if (verbose) printf("mkdir %s\n", name);
-			if (mkdir(fullname, 0755) < 0) {
-				perror("requested mkdir failed");
+			OBEXFTP_LOG(OBEXFTP_LOG_INFO, "mkdir %s\n", name);
+			if (store->mkdir(s->cwd_fd, name, 0755) < 0 && errno != EEXIST) {
+				OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "requested mkdir failed: %s\n", strerror(errno));
 			}
 		}
-		if (verbose) printf("Set path to %s\n",fullname);
-		if (chdir(fullname) < 0)
+		OBEXFTP_LOG(OBEXFTP_LOG_INFO, "Set path to %s\n",name);
+		fd = store->open(s->cwd_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW, 0);
+		if (fd < 0)
 		{
-			perror("requested chdir failed\n");
+			OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "requested chdir failed: %s\n", strerror(errno));
 			OBEX_ObjectSetRsp(object, OBEX_RSP_CONTINUE, OBEX_RSP_FORBIDDEN);
 		}
+		else
+			set_cwd(s, fd, s->depth + 1);
 		}
 		free(name);
 		name = NULL;
 	}
 }
 
-//
-// Get the filesize in a "portable" way
-//
-static int get_filesize(const char *filename)
+static void content_free(content_t *c)
 {
-	struct stat stats;
-	stat(filename, &stats);
-	if (S_ISDIR(stats.st_mode)) {
-		fprintf(stderr,"GET of directories not implemented !!!!\n");
-		return -1;
-	}
-	return (int) stats.st_size;
+	content_t **link;
+
+	for (link = &contents; *link && *link != c; link = &(*link)->next);
+	if (*link)
+		*link = c->next;
+	content_bytes -= c->size;
+	free(c->data);
+	free(c);
 }
 
-//
-// Read a file and alloc a buffer for it
-//
-static uint8_t* easy_readfile(const char *filename, int *file_size)
+static void content_put(content_t *c)
 {
-	int actual;
-	int fd;
-	uint8_t *buf;
+	if (--c->refs == 0 && c->stale)
+		content_free(c);
+}
 
-	*file_size = get_filesize(filename);
-	printf("name=%s, size=%d\n", filename, *file_size);
+static int content_matches(const content_t *c, const struct stat *st)
+{
+	return c->mtime.tv_sec == st->st_mtim.tv_sec &&
+		c->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+		c->size == st->st_size;
+}
 
-	fd = open(filename, O_RDONLY, 0);
+/*
+ * Function content_lookup()
+ *
+ *    Find the cached body of a file, keyed by device, inode, mtime and
+ *    size. On a miss a new entry may be handed out in fill, for the
+ *    caller to read the file into.
+ *
+ */
+static content_t *content_lookup(const struct stat *st, content_t **fill)
+{
+	content_t *c, *next, *victim;
+
+	*fill = NULL;
+	for (c = contents; c; c = next) {
+		next = c->next;
+		if (c->stale || c->dev != st->st_dev || c->ino != st->st_ino)
+			continue;
+		if (content_matches(c, st)) {
+			if (c->filled < c->size)
+				return NULL; /* another session is still reading it */
+			c->refs++;
+			c->used = ++content_tick;
+			return c;
+		}
+		/* an old version of the file */
+		c->stale = 1;
+		if (c->refs == 0)
+			content_free(c);
+	}
 
-	if (fd == -1)
-	{
+	if (st->st_size == 0 || (size_t) st->st_size > content_budget / CONTENT_MAX_SHARE)
 		return NULL;
+
+	/* make room, bodies in use stay */
+	while (content_bytes + st->st_size > content_budget) {
+		victim = NULL;
+		for (c = contents; c; c = c->next)
+			if (c->refs == 0 && (!victim || c->used < victim->used))
+				victim = c;
+		if (!victim)
+			return NULL;
+		content_free(victim);
 	}
-	
-	buf = malloc(*file_size);
-	if(buf == NULL)
-	{
+
+	c = calloc(1, sizeof(content_t));
+	if (c)
+		c->data = malloc(st->st_size);
+	if (!c || !c->data) {
+		free(c);
 		return NULL;
 	}
+	c->dev = st->st_dev;
+	c->ino = st->st_ino;
+	c->mtime = st->st_mtim;
+	c->size = st->st_size;
+	c->refs = 1;
+	c->used = ++content_tick;
+	c->next = contents;
+	contents = c;
+	content_bytes += c->size;
+	*fill = c;
+	return NULL;
+}
+
+/* copy a chunk read for a GET into the body being cached */
+static void content_fill(session_t *s, const chunk_t *chunk)
+{
+	content_t *c = s->get_fill;
+	struct stat st;
 
-	actual = read(fd, buf, *file_size);
-	close(fd); 
+	if (chunk->len < 0 || chunk->offset + chunk->len > c->size) {
+		c->stale = 1;
+	} else {
+		memcpy(c->data + chunk->offset, chunk->buf, chunk->len);
+		c->filled += chunk->len;
+		if (c->filled < c->size)
+			return;
+		/* only keep it if the file did not change while reading */
+		if (store->fstat(s->get_fd, &st) < 0 || !content_matches(c, &st))
+			c->stale = 1;
+	}
+	s->get_fill = NULL;
+	content_put(c);
+}
 
-	*file_size = actual;
-	return buf;
+static void flush_content_cache(void)
+{
+	while (contents)
+		content_free(contents);
 }
 
-static void get_server(obex_t *handle, obex_object_t *object)
+static long long now_ms(void)
 {
-	uint8_t *buf = NULL;
+	struct timespec ts;
 
-	obex_headerdata_t hv;
-	uint8_t hi;
-	uint32_t hlen;
-	int file_size;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-	char *name = NULL;
-	char *type = NULL;
+static void bucket_init(bucket_t *b, long long rate)
+{
+	b->rate = rate;
+	b->tokens = 0;
+	b->stamp = now_ms();
+}
 
-	printf("%s()\n", __FUNCTION__);
+/* add the tokens earned since the last refill, up to the burst */
+static void bucket_refill(bucket_t *b, long long now)
+{
+	long long burst, add;
 
-	while(OBEX_ObjectGetNextHeader(handle, object, &hi, &hv, &hlen))	{
-		switch(hi)	{
-		case OBEX_HDR_NAME:
-			printf("%s() Found name\n", __FUNCTION__);
-			if( (name = malloc(hlen / 2)))	{
-				UnicodeToChar((uint8_t*)name, hv.bs, hlen);
-				printf("name:%s\n", name);
-			}
-			break;
-			
-		case OBEX_HDR_TYPE:
-			if( (type = malloc(hlen + 1)))	{
-				strcpy(type, (char *)hv.bs);
-			}
-			printf("%s() type:%s\n", __FUNCTION__, type);
-			break;
+	if (b->rate == 0)
+		return;
+	add = (now - b->stamp) * b->rate / 1000;
+	if (add == 0)
+		return; /* keep the fraction for later */
+	burst = b->rate * BUCKET_BURST / 1000;
+	if (burst < IO_CHUNK)
+		burst = IO_CHUNK;
+	b->tokens = b->tokens + add > burst ? burst : b->tokens + add;
+	b->stamp = now;
+}
 
-		case 0xbe: // user-defined inverse push
-			printf("%s() Found inverse push req\n", __FUNCTION__);
-       			printf("data:%02x\n", hv.bq1);
-			break;
-			
+/* ms until a bucket is out of debt */
+static long long bucket_wait(const bucket_t *b)
+{
+	if (b->rate == 0 || b->tokens >= 0)
+		return 0;
+	return (-b->tokens * 1000 + b->rate - 1) / b->rate;
+}
 
-		case OBEX_HDR_APPARAM:
-			printf("%s() Found apparam\n", __FUNCTION__);
-       			printf("name:%d (%02x %02x ...)\n", hlen, *hv.bs, *(hv.bs+1));
-			break;
-			
-		default:
-			printf("%s() Skipped header %02x\n", __FUNCTION__, hi);
+/*
+ * Function shape()
+ *
+ *    Count body bytes a session sent or received against its own and
+ *    the global rate limit. Returns non-zero while the session is over
+ *    either of them and has to wait before it transfers more.
+ *
+ */
+static int shape(session_t *s, int bytes)
+{
+	long long now;
+
+	if (s->bucket.rate == 0 && total_bucket.rate == 0)
+		return 0;
+	now = now_ms();
+	bucket_refill(&s->bucket, now);
+	bucket_refill(&total_bucket, now);
+	if (s->bucket.rate)
+		s->bucket.tokens -= bytes;
+	if (total_bucket.rate)
+		total_bucket.tokens -= bytes;
+	s->throttled = bucket_wait(&s->bucket) > 0 || bucket_wait(&total_bucket) > 0;
+	return s->throttled;
+}
+
+/* allocate the transfer buffers, again for those given up */
+static int alloc_chunks(session_t *s)
+{
+	chunk_t *c;
+	int i;
+
+	for (i = 0; i < IO_DEPTH; i++) {
+		if (s->chunks[i])
+			continue;
+		c = calloc(1, sizeof(chunk_t));
+		if (c)
+			c->buf = malloc(IO_CHUNK);
+		if (!c || !c->buf) {
+			free(c);
+			return -1;
 		}
+		c->s = s;
+		c->fd = -1;
+		s->chunks[i] = c;
 	}
+	return 0;
+}
 
-	//fprintf(stderr, "%s:%d:%s\n", __FILE__, __LINE__, __FUNCTION__);
-	if (is_type_fl(type))
-	{
-		struct dirent		*dirp;
-		DIR			*dp;
-		struct stat		statdir;
-		struct stat		statbuf;
-		char			*filename;
-		struct rawdata_stream	*xmldata;
+/* chunks given up with their I/O still in flight */
+static chunk_t *orphans = NULL;
 
-		xmldata = INIT_RAWDATA_STREAM(512);
-		if (NULL == xmldata)
-			goto out;
+/*
+ * Function release_chunks()
+ *
+ *    Give up the chunks of the transfer that ends. A chunk with I/O in
+ *    flight stays with that I/O and is freed when it completes, its
+ *    session gets a new one by alloc_chunks(). Nothing waits.
+ *
+ */
+static void release_chunks(session_t *s)
+{
+	chunk_t *c;
+	int i;
+
+	for (i = 0; i < IO_DEPTH; i++) {
+		c = s->chunks[i];
+		if (!c)
+			continue;
+		if (c->state != CHUNK_BUSY) {
+			c->state = CHUNK_FREE;
+			continue;
+		}
+		s->io_pending--;
+		c->s = NULL;
+		c->next = orphans;
+		orphans = c;
+		s->chunks[i] = NULL;
+	}
+	s->chunk_head = 0;
+}
 
-		FL_XML_VERSION(xmldata);
-		FL_XML_TYPE(xmldata);
-		FL_XML_BODY_BEGIN(xmldata);
+static int orphan_uses(int fd)
+{
+	chunk_t *c;
 
-		stat(CUR_DIR, &statdir);
-		dp = opendir(CUR_DIR);
-		while(NULL != dp && NULL != (dirp = readdir(dp))) 
-		{
-			if (0 == strcmp(dirp->d_name, ".") || 0 == strcmp(dirp->d_name, ".."))
-				continue;
+	for (c = orphans; c; c = c->next)
+		if (c->fd == fd)
+			return TRUE;
+	return FALSE;
+}
+
+/* close the file of a transfer, unless I/O given up still uses it */
+static void close_transfer(int fd)
+{
+	if (!orphan_uses(fd))
+		store->close(fd);
+}
+
+/* the I/O of a chunk given up is done, the last one closes the file */
+static void orphan_done(chunk_t *c)
+{
+	chunk_t **link;
+
+	for (link = &orphans; *link != c; link = &(*link)->next);
+	*link = c->next;
+	if (!orphan_uses(c->fd))
+		store->close(c->fd);
+	free(c->buf);
+	free(c);
+}
+
+static int fillstream(session_t *s, obex_t *handle, obex_object_t *object);
+static void put_continue(session_t *s, obex_t *handle, obex_object_t *object);
+
+/* continue a request that was suspended for I/O */
+static void resume_request(session_t *s)
+{
+	obex_object_t *object = s->io_object;
+
+	s->io_object = NULL;
+	if (s->get_fd >= 0) {
+		if (fillstream(s, s->handle, object) < 0)
+			return; /* cancelled */
+	} else
+		put_continue(s, s->handle, object);
+	if (s->io_object || s->commit_object)
+		return; /* suspended again, or held for the group commit */
+	(void) OBEX_ResumeRequest(s->handle);
+	(void) OBEX_Work(s->handle);
+}
+
+/* file I/O through the engine, or right here for handles that are no fds */
+static int store_io(int write, int fd, void *buf, size_t len, off_t offset, io_cb_t cb, void *data)
+{
+	ssize_t n;
+
+	if (store->fds)
+		return write ? io_write(fd, buf, len, offset, cb, data) :
+			io_read(fd, buf, len, offset, cb, data);
+	n = write ? store->pwrite(fd, buf, len, offset) : store->pread(fd, buf, len, offset);
+	cb(data, n < 0 ? -errno : (int) n);
+	return 0;
+}
+
+static void read_done(void *data, int result)
+{
+	chunk_t *c = data;
+	session_t *s = c->s;
+
+	if (!s) {
+		orphan_done(c);
+		return;
+	}
+	s->io_pending--;
+	c->len = result;
+	c->state = CHUNK_READY;
+	if (s->get_fill && result != 0)
+		content_fill(s, c);
+	if (s->io_object && !s->throttled && s->get_fd >= 0 && c == s->chunks[s->chunk_head])
+		resume_request(s);
+}
+
+/* read ahead into a chunk, chunks are filled in ring order */
+static void read_chunk(session_t *s, chunk_t *c)
+{
+	off_t offset = s->get_offset;
+	int len, ret;
 
-			FL_XML_BODY_ITEM_BEGIN(xmldata);
+	if (offset >= s->get_size) {
+		c->len = 0;
+		c->state = CHUNK_READY;
+		return;
+	}
+	len = s->get_size - offset < IO_CHUNK ? (int) (s->get_size - offset) : IO_CHUNK;
+	s->get_offset += len;
+	c->offset = offset;
+	c->fd = s->get_fd;
+
+	c->state = CHUNK_BUSY;
+	s->io_pending++;
+	ret = store_io(0, s->get_fd, c->buf, len, offset, read_done, c);
+	if (ret < 0) {
+		s->io_pending--;
+		c->len = ret;
+		c->state = CHUNK_READY;
+		if (s->get_fill)
+			content_fill(s, c);
+	}
+}
 
-			//Adding 1 bytes due to containing '\0' 
-			filename = malloc(strlen(CUR_DIR) + strlen(dirp->d_name) + 1);
-			strcpy(filename, CUR_DIR);
-			strcat(filename, dirp->d_name);
+/* stop the GET in progress */
+static void end_get(session_t *s)
+{
+	s->io_object = NULL;
+	release_chunks(s);
+	if (s->get_content)
+		content_put(s->get_content);
+	s->get_content = NULL;
+	if (s->get_fill) {
+		/* not read to the end */
+		s->get_fill->stale = 1;
+		content_put(s->get_fill);
+	}
+	s->get_fill = NULL;
+	if (s->ctrans)
+		tcp_set_body(s->ctrans, -1, 0);
+	if (s->get_fd >= 0)
+		close_transfer(s->get_fd);
+	s->get_fd = -1;
+}
 
-			lstat(filename, &statbuf);
-			if (0 == S_ISDIR(statbuf.st_mode)) //it is a file
-				FL_XML_BODY_FILENAME(xmldata, dirp->d_name);				
-			else	//it is a directory
-				FL_XML_BODY_FOLDERNAME(xmldata, dirp->d_name);
+//
+// Open a file in the current folder for a streamed GET
+//
+static int open_readfile(int dirfd, const char *filename, struct stat *stats)
+{
+	int fd;
+
+	if (!is_safe_name(filename))
+	{
+		return -1;
+	}
+
+	fd = store->open(dirfd, filename, O_RDONLY | O_NOFOLLOW, 0);
+	if (fd == -1)
+	{
+		return -1;
+	}
+
+	if (store->fstat(fd, stats) < 0 || S_ISDIR(stats->st_mode)) {
+		OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "GET of directories not implemented !!!!\n");
+		store->close(fd);
+		return -1;
+	}
+	OBEXFTP_LOG(OBEXFTP_LOG_VERBOSE, "name=%s, size=%lld\n", filename, (long long)stats->st_size);
+
+#ifdef POSIX_FADV_SEQUENTIAL
+	/* let the kernel read ahead of the stream */
+	if (store->fds)
+		(void) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	return fd;
+}
+
+/*
+ * Function fillstream()
+ *
+ *    Add the next chunk of the GET in progress to the stream. If the
+ *    read is not done yet the request waits for it. A failed read
+ *    cancels the request and returns the negative error.
+ *
+ */
+static int fillstream(session_t *s, obex_t *handle, obex_object_t *object)
+{
+	obex_headerdata_t hv;
+	chunk_t *c;
+	int actual;
+	int i;
+
+	if (s->get_fd < 0) {
+		hv.bs = NULL;
+		(void) OBEX_ObjectAddHeader(handle, object, OBEX_HDR_BODY,
+				hv, 0, OBEX_FL_STREAM_DATAEND);
+		return 0;
+	}
+
+	if (shape(s, 0)) {
+		/* shape_run() continues */
+		s->io_object = object;
+		(void) OBEX_SuspendRequest(handle, object);
+		return 0;
+	}
+
+	if (s->ctrans && zerocopy) {
+		/* the transport sends the file, the stream only counts */
+		actual = s->get_size - s->get_offset < IO_CHUNK ?
+			(int) (s->get_size - s->get_offset) : IO_CHUNK;
+		s->get_offset += actual;
+		hv.bs = zero_body;
+		(void) OBEX_ObjectAddHeader(handle, object, OBEX_HDR_BODY, hv, actual,
+				actual > 0 ? OBEX_FL_STREAM_DATA : OBEX_FL_STREAM_DATAEND);
+		(void) shape(s, actual);
+		metrics.bytes_out += actual;
+		return actual;
+	}
+
+	if (s->get_content) {
+		/* hand over the rest of the pinned body in one go */
+		actual = s->get_size - s->get_offset > INT_MAX ?
+			INT_MAX : (int) (s->get_size - s->get_offset);
+		if (actual > IO_CHUNK && (s->bucket.rate || total_bucket.rate))
+			actual = IO_CHUNK; /* in steps the rate limit can follow */
+		hv.bs = s->get_content->data + s->get_offset;
+		s->get_offset += actual;
+		if (actual == 0)
+			end_get(s);
+		(void) OBEX_ObjectAddHeader(handle, object, OBEX_HDR_BODY, hv, actual,
+				actual > 0 ? OBEX_FL_STREAM_DATA : OBEX_FL_STREAM_DATAEND);
+		(void) shape(s, actual);
+		metrics.bytes_out += actual;
+		return actual;
+	}
+
+	c = s->chunks[s->chunk_head];
+	if (c->state == CHUNK_BUSY) {
+		/* read_done() continues */
+		s->io_object = object;
+		(void) OBEX_SuspendRequest(handle, object);
+		return 0;
+	}
+
+	/* OpenOBEX is done with the chunk sent last, read ahead into it */
+	for (i = 0; i < IO_DEPTH; i++)
+		if (s->chunks[i]->state == CHUNK_SENT)
+			read_chunk(s, s->chunks[i]);
+
+	actual = c->len;
+	if(actual > 0) {
+		/* Read was ok! */
+		hv.bs = c->buf;
+		(void) OBEX_ObjectAddHeader(handle, object, OBEX_HDR_BODY,
+				hv, actual, OBEX_FL_STREAM_DATA);
+		(void) shape(s, actual);
+		metrics.bytes_out += actual;
+		c->state = CHUNK_SENT;
+		s->chunk_head = (s->chunk_head + 1) % IO_DEPTH;
+	}
+	else if(actual == 0) {
+		/* EOF */
+		end_get(s);
+		hv.bs = c->buf;
+		(void) OBEX_ObjectAddHeader(handle, object, OBEX_HDR_BODY,
+				hv, 0, OBEX_FL_STREAM_DATAEND);
+	}
+	else {
+		/* Error, the SUCCESS response has gone out with the first
+		   packet, so abort rather than end the body short */
+		OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "read failed: %s\n", strerror(-actual));
+		end_get(s);
+		(void) OBEX_CancelRequest(handle, 1);
+	}
+
+	return actual;
+}
+
+static void get_server(session_t *s, obex_t *handle, obex_object_t *object)
+{
+	obex_headerdata_t hv;
+	uint8_t hi;
+	uint32_t hlen;
+	struct stat stats;
+	content_t *fill = NULL;
+	int fd, i;
+
+	char *name = NULL;
+	char *type = NULL;
+
+	OBEXFTP_LOG(OBEXFTP_LOG_DEBUG, "%s()\n", __FUNCTION__);
+
+	while(OBEX_ObjectGetNextHeader(handle, object, &hi, &hv, &hlen))	{
+		switch(hi)	{
+		case OBEX_HDR_NAME:
+			OBEXFTP_LOG(OBEXFTP_LOG_DEBUG, "%s() Found name\n", __FUNCTION__);
+			if( (name = malloc(hlen / 2)))	{
+				UnicodeToChar((uint8_t*)name, hv.bs, hlen);
+				OBEXFTP_LOG(OBEXFTP_LOG_DEBUG, "name:%s\n", name);
+			}
+			break;
 			
-			FL_XML_BODY_SIZE(xmldata, statbuf.st_size);
-			FL_XML_BODY_PERM(xmldata, statbuf.st_mode, statdir.st_mode);
-			FL_XML_BODY_MTIME(xmldata, statbuf.st_mtime);
-			FL_XML_BODY_CTIME(xmldata, statbuf.st_ctime);
-			FL_XML_BODY_ATIME(xmldata, statbuf.st_atime);
+		case OBEX_HDR_TYPE:
+			if( (type = malloc(hlen + 1)))	{
+				strcpy(type, (char *)hv.bs);
+			}
+			OBEXFTP_LOG(OBEXFTP_LOG_DEBUG, "%s() type:%s\n", __FUNCTION__, type);
+			break;
 
-			FL_XML_BODY_ITEM_END(xmldata);
+		case 0xbe: // user-defined inverse push
+			OBEXFTP_LOG(OBEXFTP_LOG_DEBUG, "%s() Found inverse push req\n", __FUNCTION__);
+			OBEXFTP_LOG(OBEXFTP_LOG_DEBUG, "data:%02x\n", hv.bq1);
+			break;
 			
-			//printf("---filename:%s\n", filename);
-			//fprintf(stderr, "%s:%d:%s\n", __FILE__, __LINE__, __FUNCTION__);
-			free(filename);
-			filename = NULL;
-			//fprintf(stderr, "%s:%d:%s\n", __FILE__, __LINE__, __FUNCTION__);
+
+		case OBEX_HDR_APPARAM:
+			OBEXFTP_LOG(OBEXFTP_LOG_DEBUG, "%s() Found apparam\n", __FUNCTION__);
+			OBEXFTP_LOG(OBEXFTP_LOG_DEBUG, "name:%d (%02x %02x ...)\n", hlen, *hv.bs, *(hv.bs+1));
+			break;
+			
+		default:
+			OBEXFTP_LOG(OBEXFTP_LOG_DEBUG, "%s() Skipped header %02x\n", __FUNCTION__, hi);
 		}
-		//fprintf(stderr, "%s:%d:%s\n", __FILE__, __LINE__, __FUNCTION__);
-		FL_XML_BODY_END(xmldata);
+	}
 
-		closedir(dp);
-		printf("xml doc:%s\n", xmldata->data);
+	//fprintf(stderr, "%s:%d:%s\n", __FILE__, __LINE__, __FUNCTION__);
+	if (is_type_fl(type))
+	{
+		struct rawdata_stream	*xmldata;
+
+		xmldata = get_listing(s->cwd_fd);
+		if (NULL == xmldata)
+		{
+			OBEX_ObjectSetRsp(object, OBEX_RSP_INTERNAL_SERVER_ERROR, OBEX_RSP_INTERNAL_SERVER_ERROR);
+			goto out;
+		}
 		
 		//composite the obex obejct
 		OBEX_ObjectSetRsp(object, OBEX_RSP_CONTINUE, OBEX_RSP_SUCCESS);
@@ -533,37 +1566,76 @@ static void get_server(obex_t *handle, obex_object_t *object)
 		OBEX_ObjectAddHeader(handle, object, OBEX_HDR_LENGTH, hv, sizeof(uint32_t), 0);
 		hv.bs = (uint8_t *)xmldata->data;
 		OBEX_ObjectAddHeader(handle, object, OBEX_HDR_BODY, hv, xmldata->size, 0);
-		//fprintf(stderr, "%s:%d:%s\n", __FILE__, __LINE__, __FUNCTION__);
-		FREE_RAWDATA_STREAM(xmldata);
-		//fprintf(stderr, "%s:%d:%s\n", __FILE__, __LINE__, __FUNCTION__);
+		metrics.bytes_out += xmldata->size;
+	}
+	else if (is_type_cap(type))
+	{
+		struct rawdata_stream	*xmldata;
+
+		xmldata = get_capability();
+		if (NULL == xmldata)
+		{
+			OBEX_ObjectSetRsp(object, OBEX_RSP_INTERNAL_SERVER_ERROR, OBEX_RSP_INTERNAL_SERVER_ERROR);
+			goto out;
+		}
+
+		OBEX_ObjectSetRsp(object, OBEX_RSP_CONTINUE, OBEX_RSP_SUCCESS);
+		hv.bq4 = xmldata->size;
+		OBEX_ObjectAddHeader(handle, object, OBEX_HDR_LENGTH, hv, sizeof(uint32_t), 0);
+		hv.bs = (uint8_t *)xmldata->data;
+		OBEX_ObjectAddHeader(handle, object, OBEX_HDR_BODY, hv, xmldata->size, 0);
+		metrics.bytes_out += xmldata->size;
 	}
 	else if (name)
 	{
-		printf("%s() Got a request for %s\n", __FUNCTION__, name);
+		OBEXFTP_LOG(OBEXFTP_LOG_VERBOSE, "%s() Got a request for %s\n", __FUNCTION__, name);
 		
-		buf = easy_readfile(name, &file_size);
-		if(buf == NULL) {
-			printf("Can't find file %s\n", name);
+		end_get(s);
+		if (!(s->ctrans && zerocopy) && alloc_chunks(s) < 0) {
+			OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "out of memory for %s\n", name);
+			OBEX_ObjectSetRsp(object, OBEX_RSP_INTERNAL_SERVER_ERROR, OBEX_RSP_INTERNAL_SERVER_ERROR);
+			goto out;
+		}
+		fd = open_readfile(s->cwd_fd, name, &stats);
+		if(fd < 0) {
+			OBEXFTP_LOG(OBEXFTP_LOG_INFO, "Can't find file %s\n", name);
 			OBEX_ObjectSetRsp(object, OBEX_RSP_NOT_FOUND, OBEX_RSP_NOT_FOUND);
-			return;
+			goto out;
+		}
+
+		s->get_fd = fd;
+		s->get_offset = 0;
+		s->get_size = stats.st_size;
+		if (s->ctrans && zerocopy) {
+			/* the file stays open until OBEX_EV_REQDONE */
+			tcp_set_body(s->ctrans, fd, 0);
+		} else if (store->fds && content_budget > 0 &&
+			   (s->get_content = content_lookup(&stats, &fill))) {
+			OBEXFTP_LOG(OBEXFTP_LOG_VERBOSE, "Body from the content cache\n");
+			metrics.content_hits++;
+		} else {
+			/* start reading ahead, into the content cache too on a miss */
+			if (store->fds && content_budget > 0)
+				metrics.content_misses++;
+			s->get_fill = fill;
+			for (i = 0; i < IO_DEPTH; i++)
+				read_chunk(s, s->chunks[i]);
 		}
 
+		/* the body follows chunk by chunk on OBEX_EV_STREAMEMPTY */
 		OBEX_ObjectSetRsp(object, OBEX_RSP_CONTINUE, OBEX_RSP_SUCCESS);
-		hv.bq4 = file_size;
-		OBEX_ObjectAddHeader(handle, object, OBEX_HDR_LENGTH, hv, sizeof(uint32_t), 0);
-		hv.bs = buf;
-		OBEX_ObjectAddHeader(handle, object, OBEX_HDR_BODY, hv, file_size, 0);
+		if (stats.st_size <= UINT32_MAX) {
+			hv.bq4 = stats.st_size;
+			OBEX_ObjectAddHeader(handle, object, OBEX_HDR_LENGTH, hv, sizeof(uint32_t), 0);
+		}
+		hv.bs = NULL;
+		OBEX_ObjectAddHeader(handle, object, OBEX_HDR_BODY, hv, 0, OBEX_FL_STREAM_START);
 	}
 	else
 	{
-		printf("%s() Got a GET without a name-header!\n", __FUNCTION__);
+		OBEXFTP_LOG(OBEXFTP_LOG_VERBOSE, "%s() Got a GET without a name-header!\n", __FUNCTION__);
 		OBEX_ObjectSetRsp(object, OBEX_RSP_NOT_FOUND, OBEX_RSP_NOT_FOUND);
-		return;
-	}
-	//fprintf(stderr, "%s:%d:%s\n", __FILE__, __LINE__, __FUNCTION__);
-	if (NULL != buf)
-	{
-		free(buf);
+		goto out;
 	}
 	//fprintf(stderr, "%s:%d:%s\n", __FILE__, __LINE__, __FUNCTION__);
 out:
@@ -582,127 +1654,782 @@ out:
 }
 
 /*
- * Function safe_save_file ()
+ * Function put_headers()
  *
- *    First remove path and add "/tmp/". Then save.
+ *    Collect the headers of a PUT. Called on OBEX_EV_REQCHECK with the
+ *    first packet and again with the final one.
  *
  */
-static int safe_save_file(char *name, const uint8_t *buf, int len)
+static void put_headers(session_t *s, obex_t *handle, obex_object_t *object)
 {
-	char *s = NULL;
-	char filename[255] = {0,};
-	int fd;
-	int actual;
+	obex_headerdata_t hv;
+	uint8_t hi;
+	uint32_t hlen;
 
+	while(OBEX_ObjectGetNextHeader(handle, object, &hi, &hv, &hlen))	{
+		switch(hi)	{
+		case OBEX_HDR_NAME:
+			if (NULL != s->put_name)
+			{
+				free(s->put_name);
+			}
+			if( (s->put_name = malloc(hlen / 2)))	{
+				UnicodeToChar((uint8_t *)s->put_name, hv.bs, hlen);
+				OBEXFTP_LOG(OBEXFTP_LOG_DEBUG, "put file name: %s\n", s->put_name);
+			}
+			break;
 
-	printf("Filename = %s\n", name);
+		case OBEX_HDR_LENGTH:
+			OBEXFTP_LOG(OBEXFTP_LOG_DEBUG, "HEADER_LENGTH = %d\n", hv.bq4);
+			s->put_length = hv.bq4;
+			break;
 
-	s = strrchr(name, '/');
-	if (s == NULL)
-		s = name;
-	else
-		s++;
+		case HDR_CREATOR:
+			OBEXFTP_LOG(OBEXFTP_LOG_DEBUG, "CREATORID = %#x\n", hv.bq4);
+			break;
+		
+		default:
+			OBEXFTP_LOG(OBEXFTP_LOG_DEBUG, "%s () Skipped header %02x\n", __FUNCTION__ , hi);
+		}
+	}
+}
+
+/* the file name of a PUT, any path is removed */
+static const char *put_filename(session_t *s)
+{
+	const char *name;
+
+	if (!s->put_name)	{
+		s->put_name = strdup("OBEX_PUT_Unknown_object");
+		OBEXFTP_LOG(OBEXFTP_LOG_VERBOSE, "Got a PUT without a name. Setting name to %s\n", s->put_name);
+		if (!s->put_name)
+			return NULL;
+	}
+
+	name = strrchr(s->put_name, '/');
+	return name ? name + 1 : s->put_name;
+}
+
+/* forget the PUT in progress, an unfinished file is removed */
+static void put_reset(session_t *s)
+{
+	s->io_object = NULL;
+	release_chunks(s);
+	s->put_held_len = 0;
+	s->put_finishing = 0;
+	if (s->put_fd >= 0)
+		close_transfer(s->put_fd);
+	if (s->put_tmp) {
+		(void) store->remove(s->cwd_fd, s->put_tmp, 0);
+		free(s->put_tmp);
+	}
+	free(s->put_name);
+	s->put_name = NULL;
+	s->put_tmp = NULL;
+	s->put_fd = -1;
+	s->put_length = 0;
+	put_inflight -= s->put_charged;
+	s->put_charged = 0;
+	s->put_written = 0;
+	s->put_body = 0;
+	s->put_error = 0;
+}
+
+static int put_errno_rsp(int err)
+{
+	switch (err) {
+	case ENOSPC:
+	case EDQUOT:
+	case EFBIG:
+		return OBEX_RSP_DATABASE_FULL;
+	case EACCES:
+	case EPERM:
+	case EROFS:
+		return OBEX_RSP_FORBIDDEN;
+	default:
+		return OBEX_RSP_INTERNAL_SERVER_ERROR;
+	}
+}
+
+/*
+ * Function put_open()
+ *
+ *    Create the file a PUT body is written to. It is an unnamed file
+ *    in the current folder where the store supports those, a hidden
+ *    temporary file otherwise. Space for the announced length is
+ *    reserved up front.
+ *
+ */
+static int put_open(session_t *s)
+{
+	static unsigned int seq = 0;
+	char tmp[40];
+	int fd = -1;
+	int i;
+
+	fd = store->tmpfile(s->cwd_fd, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+	for (i = 0; fd < 0 && i < 100; i++) {
+		snprintf(tmp, sizeof(tmp), ".obexftpd-%ld-%u", (long)getpid(), seq++);
+		fd = store->open(s->cwd_fd, tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+		if (fd >= 0) {
+			s->put_tmp = strdup(tmp);
+			if (!s->put_tmp) {
+				(void) store->remove(s->cwd_fd, tmp, 0);
+				store->close(fd);
+				errno = ENOMEM;
+				return -1;
+			}
+		} else if (errno != EEXIST)
+			break;
+	}
+	if (fd < 0) {
+		OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "can't create file: %s\n", strerror(errno));
+		return -1;
+	}
+	s->put_fd = fd;
+
+	/* space for the announced length, the size follows the writes */
+	if (s->put_length > 0 &&
+	    store->reserve(fd, s->put_length) < 0 &&
+	    errno == ENOSPC)
+		return -1;
+	return fd;
+}
+
+static void write_done(void *data, int result)
+{
+	chunk_t *c = data;
+	session_t *s = c->s;
+
+	if (!s) {
+		orphan_done(c);
+		return;
+	}
+	s->io_pending--;
+	if (result != c->len && !s->put_error) {
+		OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "write failed: %s\n", strerror(result < 0 ? -result : ENOSPC));
+		s->put_error = put_errno_rsp(result < 0 ? -result : ENOSPC);
+	}
+	c->state = CHUNK_FREE;
+	if (s->io_object && !s->throttled && s->get_fd < 0)
+		resume_request(s);
+}
+
+static chunk_t *free_chunk(session_t *s)
+{
+	int i;
+
+	for (i = 0; i < IO_DEPTH; i++)
+		if (s->chunks[i] && s->chunks[i]->state == CHUNK_FREE)
+			return s->chunks[i];
+	return NULL;
+}
+
+/* queue writes of the data while chunks are free, return the bytes queued */
+static int put_queue(session_t *s, const uint8_t *buf, int len)
+{
+	chunk_t *c;
+	int n, ret, done = 0;
+
+	while (done < len && !s->put_error && (c = free_chunk(s))) {
+		n = len - done < IO_CHUNK ? len - done : IO_CHUNK;
+		memcpy(c->buf, buf + done, n);
+		c->len = n;
+		c->fd = s->put_fd;
+		c->state = CHUNK_BUSY;
+		s->io_pending++;
+		ret = store_io(1, s->put_fd, c->buf, n, s->put_written, write_done, c);
+		if (ret < 0) {
+			s->io_pending--;
+			c->state = CHUNK_FREE;
+			s->put_error = put_errno_rsp(-ret);
+		}
+		s->put_written += n;
+		done += n;
+	}
+	return done;
+}
 
-	strncat(filename, s, 250);
-	fd = open(filename, O_RDWR | O_CREAT | O_EXCL, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+/* keep data no chunk was free for, it is only valid during its event */
+static int put_hold(session_t *s, const uint8_t *buf, int len)
+{
+	uint8_t *held;
 
-	if ( fd < 0) {
-		perror( filename);
+	held = realloc(s->put_held, s->put_held_len + len);
+	if (!held)
 		return -1;
+	memcpy(held + s->put_held_len, buf, len);
+	s->put_held = held;
+	s->put_held_len += len;
+	return 0;
+}
+
+/* queue what was held back, as far as chunks are free */
+static void put_unhold(session_t *s)
+{
+	int n;
+
+	if (s->put_error) {
+		s->put_held_len = 0;
+		return;
 	}
-	
-	actual = write(fd, buf, len);
-	close(fd);
+	n = put_queue(s, s->put_held, s->put_held_len);
+	s->put_held_len -= n;
+	memmove(s->put_held, s->put_held + n, s->put_held_len);
+}
 
-	printf( "Wrote %s (%d bytes)\n", filename, actual);
+/*
+ * Function put_stream()
+ *
+ *    Queue the body data that is available for writing. When all
+ *    buffers are in flight the rest is held back and the request
+ *    waits for a write to finish.
+ *
+ */
+static void put_stream(session_t *s, obex_t *handle, obex_object_t *object)
+{
+	const uint8_t *buf = NULL;
+	const char *name;
+	int len, n;
+
+	len = OBEX_ObjectReadStream(handle, object, &buf);
+	PROBE2(obexftpd, stream__avail, s, len);
+	s->put_body = 1;
+	if (len <= 0 || s->put_error)
+		return;
+	(void) shape(s, len);
+	metrics.bytes_in += len;
+
+	/* more than announced counts too */
+	if ((uint64_t) s->put_written + len > s->put_charged) {
+		put_inflight += s->put_written + len - s->put_charged;
+		s->put_charged = s->put_written + len;
+		if (max_inflight && put_inflight > max_inflight) {
+			s->put_error = OBEX_RSP_SERVICE_UNAVAILABLE;
+			OBEX_ObjectSetRsp(object, s->put_error, s->put_error);
+			return;
+		}
+	}
 
-	return actual;
+	if (s->put_fd < 0) {
+		name = put_filename(s);
+		if (!is_safe_name(name)) {
+			s->put_error = OBEX_RSP_FORBIDDEN;
+		} else if (alloc_chunks(s) < 0) {
+			s->put_error = OBEX_RSP_INTERNAL_SERVER_ERROR;
+		} else if (put_open(s) < 0) {
+			s->put_error = put_errno_rsp(errno);
+		}
+		if (s->put_error) {
+			OBEX_ObjectSetRsp(object, s->put_error, s->put_error);
+			return;
+		}
+	}
+
+	/* after what is held back already */
+	n = s->put_held_len > 0 ? 0 : put_queue(s, buf, len);
+	if (n < len && !s->put_error && put_hold(s, buf + n, len - n) < 0)
+		s->put_error = OBEX_RSP_INTERNAL_SERVER_ERROR;
+
+	if (s->put_error) {
+		OBEX_ObjectSetRsp(object, s->put_error, s->put_error);
+	} else if (s->throttled || s->put_held_len > 0 || !free_chunk(s)) {
+		/* write_done() or shape_run() continues */
+		s->io_object = object;
+		(void) OBEX_SuspendRequest(handle, object);
+	}
 }
 
+static void put_done(session_t *s, obex_t *handle, obex_object_t *object);
+
+/* go on with a PUT that waited for a free chunk or for its writes */
+static void put_continue(session_t *s, obex_t *handle, obex_object_t *object)
+{
+	if (s->put_finishing) {
+		put_done(s, handle, object);
+		return;
+	}
+	put_unhold(s);
+	if (s->put_error)
+		OBEX_ObjectSetRsp(object, s->put_error, s->put_error);
+	else if (s->put_held_len > 0)
+		s->io_object = object; /* write_done() continues */
+}
+
+/*
+ * Function put_admit()
+ *
+ *    Decide on a PUT from its headers, before any of the body is
+ *    received. The announced length has to fit the PUT bytes allowed
+ *    at a time and the free space of the store.
+ *
+ */
+static int put_admit(session_t *s)
+{
+	uint64_t avail;
+
+	if (max_inflight && s->put_length > max_inflight)
+		return OBEX_RSP_REQ_ENTITY_TOO_LARGE;
+	if (max_inflight && put_inflight + s->put_length > max_inflight)
+		return OBEX_RSP_SERVICE_UNAVAILABLE;
+	if (s->put_length > 0 && store->space(s->cwd_fd, &avail, NULL) == 0 &&
+	    s->put_length > avail)
+		return OBEX_RSP_DATABASE_FULL;
+
+	put_inflight += s->put_length;
+	s->put_charged = s->put_length;
+	return OBEX_RSP_SUCCESS;
+}
+
+/* ms until a throttled session may continue, -1 if none waits */
+static int shape_timeout(void)
+{
+	long long now = now_ms();
+	long long left, wait = -1;
+	session_t *s;
+
+	bucket_refill(&total_bucket, now);
+	for (s = sessions; s; s = s->next) {
+		if (!s->throttled)
+			continue;
+		bucket_refill(&s->bucket, now);
+		left = bucket_wait(&s->bucket);
+		if (left < bucket_wait(&total_bucket))
+			left = bucket_wait(&total_bucket);
+		if (wait < 0 || left < wait)
+			wait = left;
+	}
+	return (int) wait;
+}
+
+/*
+ * Function shape_run()
+ *
+ *    Continue the throttled sessions that are within their rate limits
+ *    again. Requests still waiting for I/O continue when it is done.
+ *
+ */
+static void shape_run(void)
+{
+	session_t *s;
+
+	for (s = sessions; s; s = s->next) {
+		if (!s->throttled || shape(s, 0))
+			continue;
+		if (s->io_object == NULL)
+			continue;
+		if (s->get_fd >= 0 ? (s->ctrans && zerocopy) || s->get_content ||
+				s->chunks[s->chunk_head]->state != CHUNK_BUSY :
+				free_chunk(s) != NULL)
+			resume_request(s);
+	}
+}
+
+/*
+ * Function commit_add()
+ *
+ *    Hold back the response to a finished PUT until the next group
+ *    commit made the file and its folder entry durable.
+ *
+ */
+static void commit_add(session_t *s, obex_t *handle, obex_object_t *object)
+{
+	struct stat statdir;
+
+	if (store->fstat(s->cwd_fd, &statdir) < 0) {
+		OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "stat failed: %s\n", strerror(errno));
+		OBEX_ObjectSetRsp(object, OBEX_RSP_INTERNAL_SERVER_ERROR, OBEX_RSP_INTERNAL_SERVER_ERROR);
+		return;
+	}
+	s->commit_dev = statdir.st_dev;
+	s->commit_ino = statdir.st_ino;
+	s->commit_fd = s->put_fd;
+	s->put_fd = -1;
+	s->commit_object = object;
+	s->commit_rsp = OBEX_RSP_SUCCESS;
+
+	if (commit_queue == NULL)
+		commit_deadline = now_ms() + commit_window;
+	s->commit_next = commit_queue;
+	commit_queue = s;
+	(void) OBEX_SuspendRequest(handle, object);
+}
+
+/* drop a session from the group commit, it will not be answered */
+static void commit_forget(session_t *s)
+{
+	session_t **link;
+
+	if (s->commit_object == NULL)
+		return;
+	for (link = &commit_queue; *link; link = &(*link)->commit_next)
+		if (*link == s) {
+			*link = s->commit_next;
+			break;
+		}
+	store->close(s->commit_fd);
+	s->commit_object = NULL;
+}
+
+static void commit_file(int index, void *data)
+{
+	session_t *s = ((session_t **)data)[index];
+
+	if (store->sync(s->commit_fd, 1) < 0) {
+		/* logging may clobber errno */
+		s->commit_rsp = put_errno_rsp(errno);
+		OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "fdatasync failed: %s\n", strerror(errno));
+	}
+}
+
+/* ms until the group commit is due, -1 if nothing waits */
+static int commit_timeout(void)
+{
+	long long left;
+
+	if (commit_queue == NULL)
+		return -1;
+	left = commit_deadline - now_ms();
+	return left > 0 ? (int)left : 0;
+}
+
+/*
+ * Function commit_run()
+ *
+ *    The group commit. Sync the data of all waiting files, then each
+ *    of their folders once, and send the held back responses.
+ *
+ */
+static void commit_run(void)
+{
+	session_t **batch, *s;
+	int count, i, j;
+	int rsp;
+
+	if (commit_timeout() != 0)
+		return;
+
+	for (count = 0, s = commit_queue; s; s = s->commit_next)
+		count++;
+	batch = malloc(count * sizeof(session_t *));
+	if (batch == NULL)
+		return; /* try again with the next loop turn */
+	for (i = 0, s = commit_queue; s; s = s->commit_next)
+		batch[i++] = s;
+	commit_queue = NULL;
+
+	pool_run(count, commit_file, batch);
+
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < i; j++)
+			if (batch[j]->commit_dev == batch[i]->commit_dev &&
+			    batch[j]->commit_ino == batch[i]->commit_ino)
+				break;
+		if (j < i)
+			continue; /* synced already */
+		rsp = store->sync(batch[i]->cwd_fd, 0) < 0 ? put_errno_rsp(errno) : OBEX_RSP_SUCCESS;
+		if (rsp == OBEX_RSP_SUCCESS)
+			continue;
+		OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "fsync failed: %s\n", strerror(errno));
+		for (j = i; j < count; j++)
+			if (batch[j]->commit_dev == batch[i]->commit_dev &&
+			    batch[j]->commit_ino == batch[i]->commit_ino)
+				batch[j]->commit_rsp = rsp;
+	}
+	OBEXFTP_LOG(OBEXFTP_LOG_INFO, "Committed %d files\n", count);
+
+	for (i = 0; i < count; i++) {
+		s = batch[i];
+		store->close(s->commit_fd);
+		if (s->commit_rsp != OBEX_RSP_SUCCESS)
+			OBEX_ObjectSetRsp(s->commit_object, s->commit_rsp, s->commit_rsp);
+		s->commit_object = NULL;
+		(void) OBEX_ResumeRequest(s->handle);
+		(void) OBEX_Work(s->handle);
+	}
+	free(batch);
+}
 
 /*
  * Function put_done()
  *
- *    Parse what we got from a PUT
+ *    Finish a PUT. The written file is linked into place. A PUT without
+ *    a body deletes the named file or folder.
+ *
+ */
+static void put_done(session_t *s, obex_t *handle, obex_object_t *object)
+{
+	struct stat statbuf;
+	const char *name;
+	int ret;
+
+	/* the data held back and the writes in flight go first */
+	put_unhold(s);
+	if (s->put_held_len > 0 || s->io_pending > 0) {
+		/* write_done() continues */
+		s->put_finishing = 1;
+		s->io_object = object;
+		(void) OBEX_SuspendRequest(handle, object);
+		return;
+	}
+	s->put_finishing = 0;
+
+	OBEXFTP_LOG(OBEXFTP_LOG_DEBUG, "put_done>>>\n");
+	put_headers(s, handle, object);
+	name = put_filename(s);
+
+	if (s->put_error) {
+		OBEX_ObjectSetRsp(object, s->put_error, s->put_error);
+	} else if (!is_safe_name(name)) {
+		OBEX_ObjectSetRsp(object, OBEX_RSP_FORBIDDEN, OBEX_RSP_FORBIDDEN);
+	} else if (!s->put_body) {
+		OBEXFTP_LOG(OBEXFTP_LOG_VERBOSE, "Got a PUT without a body\n");
+		if (store->stat(s->cwd_fd, name, &statbuf) < 0) {
+			OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "stat failed: %s\n", strerror(errno));
+			OBEX_ObjectSetRsp(object, OBEX_RSP_NOT_FOUND, OBEX_RSP_NOT_FOUND);
+		} else {
+			OBEXFTP_LOG(OBEXFTP_LOG_VERBOSE, "%s %s\n", S_ISDIR(statbuf.st_mode) ? "Removing dir" : "Deleting file", name);
+			if (store->remove(s->cwd_fd, name, S_ISDIR(statbuf.st_mode)) < 0) {
+				OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "delete failed: %s\n", strerror(errno));
+				OBEX_ObjectSetRsp(object, OBEX_RSP_FORBIDDEN, OBEX_RSP_FORBIDDEN);
+			}
+		}
+	} else if (s->put_fd < 0 && put_open(s) < 0) {
+		/* an empty body */
+		ret = put_errno_rsp(errno);
+		OBEX_ObjectSetRsp(object, ret, ret);
+	} else {
+		/* never replace an existing file */
+		if (s->put_tmp)
+			ret = store->link(s->cwd_fd, s->put_tmp, s->cwd_fd, name);
+		else
+			ret = store->publish(s->put_fd, s->cwd_fd, name);
+		if (ret < 0) {
+			/* logging may clobber errno */
+			ret = errno == EEXIST ? OBEX_RSP_FORBIDDEN : put_errno_rsp(errno);
+			OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "%s: %s\n", name, strerror(errno));
+			OBEX_ObjectSetRsp(object, ret, ret);
+		} else {
+			OBEXFTP_LOG(OBEXFTP_LOG_VERBOSE, "Wrote %s (%lld bytes)\n", name, (long long)s->put_written);
+			if (commit_window >= 0)
+				commit_add(s, handle, object);
+		}
+	}
+
+	put_reset(s);
+	OBEXFTP_LOG(OBEXFTP_LOG_DEBUG, "<<<put_done\n");
+}
+
+
+/*
+ * Function open_parent()
+ *
+ *    Open the folder holding the last component of a path, relative to
+ *    the current folder of a session or to the base folder if absolute.
+ *    The path can not leave the base folder. The last component is
+ *    returned in leaf, pointing into path.
  *
  */
-static void put_done(obex_t *handle, obex_object_t *object, int final)
+static int open_parent(session_t *s, char *path, char **leaf)
+{
+	char *p, *next;
+	int dirfd, fd, depth;
+
+	depth = *path == '/' ? 0 : s->depth;
+	dirfd = store->dup(*path == '/' ? root_fd : s->cwd_fd);
+	if (dirfd < 0)
+		return -1;
+
+	for (p = path; ; p = next) {
+		while (*p == '/')
+			p++;
+		next = strchr(p, '/');
+		if (next == NULL)
+			break;
+		*next++ = '\0';
+		if (!strcmp(p, "."))
+			continue;
+		depth += strcmp(p, "..") ? 1 : -1;
+		if (depth < 0) {
+			errno = EACCES;
+			store->close(dirfd);
+			return -1;
+		}
+		fd = store->open(dirfd, p, O_RDONLY | O_DIRECTORY | O_NOFOLLOW, 0);
+		store->close(dirfd);
+		if (fd < 0)
+			return -1;
+		dirfd = fd;
+	}
+
+	if (!is_safe_name(p)) {
+		errno = EACCES;
+		store->close(dirfd);
+		return -1;
+	}
+	*leaf = p;
+	return dirfd;
+}
+
+static int action_errno_rsp(int err)
+{
+	switch (err) {
+	case ENOENT:
+	case ENOTDIR:
+		return OBEX_RSP_NOT_FOUND;
+	case EEXIST:
+	case ENOTEMPTY:
+		return OBEX_RSP_FORBIDDEN;
+	default:
+		return put_errno_rsp(err);
+	}
+}
+
+/* copy a file within the store, the copy appears complete or not at all */
+static int copy_file(int dirfd, const char *name, const struct stat *st,
+		     int destdirfd, const char *destname)
+{
+	struct stat dest;
+	uint64_t avail;
+	int in, out, named = 0;
+	int ret;
+
+	if (S_ISDIR(st->st_mode))
+		return OBEX_RSP_FORBIDDEN;
+	/* never replace an existing file */
+	if (store->stat(destdirfd, destname, &dest) == 0)
+		return OBEX_RSP_FORBIDDEN;
+	if (store->space(destdirfd, &avail, NULL) == 0 && (uint64_t) st->st_size > avail)
+		return OBEX_RSP_DATABASE_FULL;
+
+	in = store->open(dirfd, name, O_RDONLY | O_NOFOLLOW, 0);
+	if (in < 0)
+		return action_errno_rsp(errno);
+	out = store->tmpfile(destdirfd, st->st_mode & 0777);
+	if (out < 0) {
+		out = store->open(destdirfd, destname, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, st->st_mode & 0777);
+		named = 1;
+	}
+	if (out < 0) {
+		ret = errno;
+		store->close(in);
+		return action_errno_rsp(ret);
+	}
+
+	(void) store->reserve(out, st->st_size);
+	ret = store->copy(in, out, st->st_size);
+	if (ret == 0 && !named)
+		ret = store->publish(out, destdirfd, destname);
+	ret = ret < 0 ? action_errno_rsp(errno) : OBEX_RSP_SUCCESS;
+	if (ret != OBEX_RSP_SUCCESS && named)
+		(void) store->remove(destdirfd, destname, 0);
+	store->close(out);
+	store->close(in);
+	return ret;
+}
+
+/* OBEX permission bits to a file mode, the execute bits are kept */
+static mode_t perms_mode(uint32_t perms, mode_t mode)
+{
+	static const int shift[] = { OBEXFTP_PERM_USER, OBEXFTP_PERM_GROUP, OBEXFTP_PERM_OTHER };
+	int i;
+
+	mode &= S_IXUSR | S_IXGRP | S_IXOTH | S_ISUID | S_ISGID | S_ISVTX;
+	for (i = 0; i < 3; i++) {
+		if ((perms >> shift[i]) & OBEXFTP_PERM_READ)
+			mode |= S_IRUSR >> (3 * i);
+		if ((perms >> shift[i]) & OBEXFTP_PERM_WRITE)
+			mode |= S_IWUSR >> (3 * i);
+	}
+	return mode;
+}
+
+/*
+ * Function action_server()
+ *
+ *    Copy, move or set the permissions of a file. NAME and DESTNAME may
+ *    be paths, the data never leaves the server.
+ *
+ */
+static void action_server(session_t *s, obex_t *handle, obex_object_t *object)
 {
 	obex_headerdata_t hv;
 	uint8_t hi;
 	uint32_t hlen;
+	char *name = NULL, *destname = NULL;
+	char *leaf, *destleaf;
+	int action = -1;
+	uint32_t perms = 0;
+	int dirfd = -1, destdirfd = -1;
+	struct stat st;
+	int rsp = OBEX_RSP_SUCCESS;
 
-	const uint8_t *body = NULL;
-	int body_len = 0;
-	static char *name = NULL;
-	char fullname[WORK_PATH_MAX];
-	struct stat statbuf;
-	//char *namebuf = NULL;
-
-	fprintf(stderr, "put_done>>>\n");
 	while(OBEX_ObjectGetNextHeader(handle, object, &hi, &hv, &hlen))	{
 		switch(hi)	{
-		case OBEX_HDR_BODY:
-			body = hv.bs;
-			body_len = hlen;
-			fprintf(stderr, "hv.bs=%p, hlen=%d\n", hv.bs, hlen);
-			break;
 		case OBEX_HDR_NAME:
-			if (NULL != name)
-			{
-				free(name);
-			}
-			if( (name = malloc(hlen / 2)))	{
+			free(name);
+			if ((name = malloc(hlen / 2 + 1)))
 				UnicodeToChar((uint8_t *)name, hv.bs, hlen);
-				fprintf(stderr, "put file name: %s\n", name);
-			}
 			break;
 
-		case OBEX_HDR_LENGTH:
-			printf("HEADER_LENGTH = %d\n", hv.bq4);
+		case OBEX_HDR_DESTNAME:
+			free(destname);
+			if ((destname = malloc(hlen / 2 + 1)))
+				UnicodeToChar((uint8_t *)destname, hv.bs, hlen);
 			break;
 
-		case HDR_CREATOR:
-			printf("CREATORID = %#x\n", hv.bq4);
+		case OBEX_HDR_ACTION_ID:
+			action = hv.bq1;
 			break;
-		
+
+		case OBEX_HDR_PERMISSIONS:
+			perms = hv.bq4;
+			break;
+
 		default:
-			printf("%s () Skipped header %02x\n", __FUNCTION__ , hi);
+			OBEXFTP_LOG(OBEXFTP_LOG_DEBUG, "%s () Skipped header %02x\n", __FUNCTION__ , hi);
 		}
 	}
-	if(!body)	{
-		printf("Got a PUT without a body\n");
-		OBEX_ObjectSetRsp(object, OBEX_RSP_CONTINUE, OBEX_RSP_SUCCESS);
-	}
-	if(!name)	{
-		name = strdup("OBEX_PUT_Unknown_object");
-		printf("Got a PUT without a name. Setting name to %s\n", name);
+	OBEXFTP_LOG(OBEXFTP_LOG_VERBOSE, "Action %d on %s -> %s\n", action, name ? name : "(none)", destname ? destname : "(none)");
+
+	if (!name || !*name || (action != OBEXFTP_ACTION_SETPERM && (!destname || !*destname))) {
+		rsp = OBEX_RSP_BAD_REQUEST;
+	} else if ((dirfd = open_parent(s, name, &leaf)) < 0 ||
+		   store->stat(dirfd, leaf, &st) < 0) {
+		rsp = errno == EACCES ? OBEX_RSP_FORBIDDEN : OBEX_RSP_NOT_FOUND;
+	} else if (action != OBEXFTP_ACTION_SETPERM &&
+		   (destdirfd = open_parent(s, destname, &destleaf)) < 0) {
+		rsp = errno == EACCES ? OBEX_RSP_FORBIDDEN : OBEX_RSP_NOT_FOUND;
+	} else switch (action) {
+	case OBEXFTP_ACTION_COPY:
+		rsp = copy_file(dirfd, leaf, &st, destdirfd, destleaf);
+		break;
 
+	case OBEXFTP_ACTION_MOVE:
+		/* never replace an existing file */
+		if (store->rename(dirfd, leaf, destdirfd, destleaf, 1) < 0)
+			rsp = action_errno_rsp(errno);
+		break;
+
+	case OBEXFTP_ACTION_SETPERM:
+		if (store->chmod(dirfd, leaf, perms_mode(perms, st.st_mode)) < 0)
+			rsp = action_errno_rsp(errno);
+		break;
+
+	default:
+		rsp = OBEX_RSP_NOT_IMPLEMENTED;
+		break;
 	}
-	if (body)
-	{
-		safe_save_file(name, body, body_len);
-	}
-	if(final && !body) {
-		strcpy(fullname, CUR_DIR);
-		strcat(fullname, name);
-		if (!stat(fullname, &statbuf)) {
-			perror("stat failed");
-		}
-		if (S_ISDIR(statbuf.st_mode)) {
-			printf("Removing dir %s\n", name);
-			rmdir(fullname);
-		} else {
-			printf("Deleting file %s\n", name);
-			unlink(fullname);
-		}
-	}
-	if (final)
-	{
-		free(name);
-		name = NULL;
-		fprintf(stderr, "<<<put_done\n");
-	}
+
+	if (rsp != OBEX_RSP_SUCCESS)
+		OBEXFTP_LOG(OBEXFTP_LOG_INFO, "Action failed: %02x\n", rsp);
+	OBEX_ObjectSetRsp(object, rsp == OBEX_RSP_SUCCESS ? OBEX_RSP_CONTINUE : rsp, rsp);
+	if (destdirfd >= 0)
+		store->close(destdirfd);
+	if (dirfd >= 0)
+		store->close(dirfd);
+	free(destname);
+	free(name);
 }
 
 
@@ -712,33 +2439,37 @@ static void put_done(obex_t *handle, obex_object_t *object, int final)
  * Called when a request is about to come or has come.
  *
  */
-static void server_request(obex_t *handle, obex_object_t *object, int UNUSED(event), int cmd)
+static void server_request(session_t *s, obex_t *handle, obex_object_t *object, int UNUSED(event), int cmd)
 {
 	switch(cmd)	{
 	case OBEX_CMD_SETPATH:
-		printf("Received SETPATH command\n");
+		OBEXFTP_LOG(OBEXFTP_LOG_VERBOSE, "Received SETPATH command\n");
 		OBEX_ObjectSetRsp(object, OBEX_RSP_CONTINUE, OBEX_RSP_SUCCESS);
-		set_server_path(handle, object);
+		set_server_path(s, handle, object);
 		break;
 	case OBEX_CMD_GET:
 		/* A Get always fits one package */
-		get_server(handle, object);
+		get_server(s, handle, object);
 		break;
 	case OBEX_CMD_PUT:
-		printf("Received PUT command\n");
+		OBEXFTP_LOG(OBEXFTP_LOG_VERBOSE, "Received PUT command\n");
 		OBEX_ObjectSetRsp(object, OBEX_RSP_CONTINUE, OBEX_RSP_SUCCESS);
-		put_done(handle, object, 1);
+		put_done(s, handle, object);
+		break;
+	case OBEX_CMD_ACTION:
+		OBEXFTP_LOG(OBEXFTP_LOG_VERBOSE, "Received ACTION command\n");
+		action_server(s, handle, object);
 		break;
 	case OBEX_CMD_CONNECT:
 //		OBEX_ObjectSetRsp(object, OBEX_RSP_SUCCESS, OBEX_RSP_SUCCESS);
-		connect_server(handle, object);
-		connection_id++;
+		s->connection_id = connection_id++;
+		connect_server(s, handle, object);
 		break;
 	case OBEX_CMD_DISCONNECT:
 		OBEX_ObjectSetRsp(object, OBEX_RSP_SUCCESS, OBEX_RSP_SUCCESS);
 		break;
 	default:
-		printf("%s () Denied %02x request\n", __FUNCTION__, cmd);
+		OBEXFTP_LOG(OBEXFTP_LOG_INFO, "%s () Denied %02x request\n", __FUNCTION__, cmd);
 		OBEX_ObjectSetRsp(object, OBEX_RSP_NOT_IMPLEMENTED, OBEX_RSP_NOT_IMPLEMENTED);
 		break;
 	}
@@ -746,34 +2477,258 @@ static void server_request(obex_t *handle, obex_object_t *object, int UNUSED(eve
 }
 
 
+static void obex_event(obex_t *handle, obex_object_t *obj, int mode, int event, int obex_cmd, int obex_rsp);
+
+/* mark the listener of a handle for registering again */
+static int listener_transport(obex_t *handle)
+{
+	int i;
+
+	for (i = 0; i < num_listeners; i++)
+		if (listeners[i].handle == handle)
+			return listeners[i].transport;
+	return 0;
+}
+
+static void listener_failed(obex_t *handle)
+{
+	int i;
+
+	for (i = 0; i < num_listeners; i++)
+		if (listeners[i].handle == handle)
+			listeners[i].reset = 1;
+}
+
+static void handle_input(int UNUSED(fd), void *data)
+{
+	obex_t *handle = data;
+	session_t *s = OBEX_GetUserData(handle);
+
+	if (OBEX_HandleInput(handle, 0) < 0) {
+		if (s) {
+			metrics_link_error(s->transport);
+			s->finished = 1;
+		} else {
+			metrics_link_error(listener_transport(handle));
+			listener_failed(handle);
+		}
+	}
+}
+
+/* a new session in the base folder or NULL */
+static session_t *new_session(void)
+{
+	session_t *s;
+
+	s = calloc(1, sizeof(session_t));
+	if (s == NULL)
+		return NULL;
+
+	s->fd = -1;
+	s->get_fd = -1;
+	s->put_fd = -1;
+	bucket_init(&s->bucket, session_rate);
+	s->cwd_fd = store->dup(root_fd);
+	if (s->cwd_fd < 0) {
+		OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "failed to open the base folder: %s\n", strerror(errno));
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+static void free_session(session_t *s)
+{
+	int i;
+
+	if (s->fd >= 0)
+		loop_del(s->fd);
+	/* no I/O may complete on a freed session */
+	commit_forget(s);
+	put_reset(s);
+	end_get(s);
+	if (s->handle)
+		OBEX_Cleanup(s->handle);
+	tcp_free(s->ctrans);
+	store->close(s->cwd_fd);
+	for (i = 0; i < IO_DEPTH; i++)
+		if (s->chunks[i]) {
+			free(s->chunks[i]->buf);
+			free(s->chunks[i]);
+		}
+	free(s->put_held);
+	free(s);
+}
+
+/* watch the connection of a new session */
+static void add_session(session_t *s, int fd)
+{
+	if (loop_add(fd, handle_input, s->handle) < 0) {
+		OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "failed to watch connection\n");
+		free_session(s);
+		return;
+	}
+	s->fd = fd;
+
+	/* over the limit it only stays to answer the client */
+	if (max_sessions && num_sessions >= max_sessions) {
+		s->refused = 1;
+		metrics.sessions_refused++;
+	} else {
+		num_sessions++;
+		metrics.sessions++;
+	}
+
+	s->next = sessions;
+	sessions = s;
+	OBEXFTP_LOG(OBEXFTP_LOG_INFO, "Accepted connection (fd %d)\n", s->fd);
+}
+
+/*
+ * Function accept_client()
+ *
+ *    Give an incoming connection its own handle and session.
+ *
+ */
+static void accept_client(obex_t *server)
+{
+	session_t *s;
+
+	s = new_session();
+	if (s == NULL)
+		return;
+
+	s->handle = OBEX_ServerAccept(server, obex_event, s);
+	if (s->handle == NULL) {
+		OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "failed to accept connection\n");
+		free_session(s);
+		return;
+	}
+
+	s->transport = listener_transport(server);
+	add_session(s, OBEX_GetFD(s->handle));
+}
+
+/*
+ * Function accept_tcp_client()
+ *
+ *    Accept a connection on our own TCP listener. GET bodies on it are
+ *    sent from the file by the transport, see obexftpd_tcp.c.
+ *
+ */
+static void accept_tcp_client(int listen_fd, void *UNUSED(data))
+{
+	session_t *s;
+
+	s = new_session();
+	if (s == NULL)
+		return;
+
+	s->ctrans = tcp_ctrans(listen_fd);
+	if (s->ctrans == NULL) {
+		OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "failed to accept connection: %s\n", strerror(errno));
+		free_session(s);
+		return;
+	}
+
+	s->handle = OBEX_Init(OBEX_TRANS_CUSTOM, obex_event, 0);
+	if (s->handle == NULL || 0 > OBEX_RegisterCTransport(s->handle, s->ctrans)) {
+		OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "failed to init obex\n");
+		free_session(s);
+		return;
+	}
+	OBEX_SetUserData(s->handle, s);
+	/* fewer, larger packets for the sendfile() calls */
+	(void) OBEX_SetTransportMTU(s->handle, OBEX_MAXIMUM_MTU, OBEX_MAXIMUM_MTU);
+
+	s->transport = OBEX_TRANS_INET;
+	add_session(s, ((tcp_conn_t *)s->ctrans->customdata)->sock);
+}
+
+/*
+ * Function reap_sessions()
+ *
+ *    Free the sessions that are done. With all set free every session.
+ *
+ */
+static void reap_sessions(int all)
+{
+	session_t **link, *s;
+
+	for (link = &sessions; (s = *link); ) {
+		if (!s->finished && !all) {
+			link = &s->next;
+			continue;
+		}
+		*link = s->next;
+		if (!s->refused)
+			num_sessions--;
+		OBEXFTP_LOG(OBEXFTP_LOG_INFO, "Closing connection (fd %d)\n", s->fd);
+		free_session(s);
+	}
+}
+
+
 static void obex_event(obex_t *handle, obex_object_t *obj, int mode, int event, int obex_cmd, int obex_rsp)
 {
-	char progress[] = "\\|/-";
-	static unsigned int i = 0;
+	session_t *s = OBEX_GetUserData(handle); /* NULL on the listener */
+	int rsp;
 
 	switch (event) {
+	case OBEX_EV_ACCEPTHINT:
+		accept_client(handle);
+		break;
+
 	case OBEX_EV_STREAMAVAIL:
-       	printf("Time to read some data from stream\n");
+		if (s)
+			put_stream(s, handle, obj);
         break;
 
 	case OBEX_EV_LINKERR:
-        finished = 1;
-        obexftpd_reset = 1;
+		if (s) {
+			metrics_link_error(s->transport);
+			s->finished = 1;
+		} else {
+			metrics_link_error(listener_transport(handle));
+			listener_failed(handle);
+		}
         success = FALSE;
-		fprintf(stderr, "failed: %d\n", obex_cmd);
+		OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "failed: %d\n", obex_cmd);
 		break;
 
     	case OBEX_EV_REQ:
-        printf("Incoming request %02x\n", obex_cmd);
+		OBEXFTP_LOG(OBEXFTP_LOG_VERBOSE, "Incoming request %02x\n", obex_cmd);
+		if (s == NULL) {
+			OBEX_ObjectSetRsp(obj, OBEX_RSP_SERVICE_UNAVAILABLE, OBEX_RSP_SERVICE_UNAVAILABLE);
+			break;
+		}
 		/* Comes when a server-request has been received. */
-		server_request(handle, obj, event, obex_cmd);
+		server_request(s, handle, obj, event, obex_cmd);
 		break;
 		
 	case OBEX_EV_REQHINT:
         /* An incoming request is about to come. Accept it! */
+		PROBE2(obexftpd, request__start, s, obex_cmd);
+		metrics_request(obex_cmd);
+		if (s) {
+			s->req_start = metrics_now_us();
+			s->packets = 0;
+		}
+		if (s && s->refused) {
+			OBEX_ObjectSetRsp(obj, OBEX_RSP_SERVICE_UNAVAILABLE, OBEX_RSP_SERVICE_UNAVAILABLE);
+			break;
+		}
 		switch(obex_cmd) {
-		case OBEX_CMD_GET:
 		case OBEX_CMD_PUT:
+			/* receive the body chunk by chunk */
+			if (s) {
+				put_reset(s);
+				(void) OBEX_ObjectReadStream(handle, obj, NULL);
+			}
+			OBEX_ObjectSetRsp(obj, OBEX_RSP_CONTINUE, OBEX_RSP_SUCCESS);
+			break;
+		case OBEX_CMD_GET:
+		case OBEX_CMD_ACTION:
 		case OBEX_CMD_CONNECT:
 		case OBEX_CMD_DISCONNECT:
 			OBEX_ObjectSetRsp(obj, OBEX_RSP_CONTINUE, OBEX_RSP_SUCCESS);
@@ -786,147 +2741,402 @@ static void obex_event(obex_t *handle, obex_object_t *obj, int mode, int event,
 
 	case OBEX_EV_REQCHECK:
 		/* e.g. mode=01, obex_cmd=03, obex_rsp=00 */
-            	printf("%s() OBEX_EV_REQCHECK: mode=%02x, obex_cmd=%02x, obex_rsp=%02x\n", __func__, 
-				mode, obex_cmd, obex_rsp);
+		OBEXFTP_LOG(OBEXFTP_LOG_DEBUG, "%s() OBEX_EV_REQCHECK: mode=%02x, obex_cmd=%02x, obex_rsp=%02x\n",
+			__func__, mode, obex_cmd, obex_rsp);
 		OBEX_ObjectSetRsp(obj, OBEX_RSP_CONTINUE, OBEX_RSP_SUCCESS);
+		if (s && obex_cmd == OBEX_CMD_PUT) {
+			/* NAME and LENGTH come before the body */
+			put_headers(s, handle, obj);
+			if (s->put_name && !is_safe_name(put_filename(s)))
+				OBEX_ObjectSetRsp(obj, OBEX_RSP_FORBIDDEN, OBEX_RSP_FORBIDDEN);
+			else if ((rsp = put_admit(s)) != OBEX_RSP_SUCCESS) {
+				OBEXFTP_LOG(OBEXFTP_LOG_INFO, "PUT of %u bytes refused\n", s->put_length);
+				OBEX_ObjectSetRsp(obj, rsp, rsp);
+			}
+		}
 		break;
 	case OBEX_EV_REQDONE:
-	        //finished = TRUE;
+		PROBE3(obexftpd, request__done, s, obex_cmd, obex_rsp);
         	if(obex_rsp == OBEX_RSP_SUCCESS)
 	        	success = TRUE;
         	else {
 	            success = FALSE;
-        	    printf("%s() OBEX_EV_REQDONE: obex_rsp=%02x\n", __func__, obex_rsp);
+		    OBEXFTP_LOG(OBEXFTP_LOG_VERBOSE, "%s() OBEX_EV_REQDONE: obex_rsp=%02x\n", __func__, obex_rsp);
 	        }
+		if (s) {
+			metrics_response(obex_cmd, obex_rsp, s->req_start);
+			s->req_start = 0;
+		}
+		if (s && s->get_fd >= 0) {
+			/* the peer stopped reading early */
+			end_get(s);
+		}
+		if (s && (obex_cmd == OBEX_CMD_DISCONNECT || s->refused))
+			s->finished = 1;
 		break;
 
 	case OBEX_EV_PROGRESS:
-		fprintf(stderr, "%c%c", 0x08, progress[i++]);
-		fflush(stdout);
-		if (i >= strlen(progress))
-			i = 0;
+		PROBE1(obexftpd, progress, s);
+		if (s)
+			s->packets++;
+		OBEXFTP_LOG(OBEXFTP_LOG_TRACE, "%s() OBEX_EV_PROGRESS: packet %d\n",
+			__func__, s ? s->packets : 0);
 			
-		switch(obex_cmd) {
-		case OBEX_CMD_PUT:
-			fprintf(stderr, "obex_ev_progress: obex_cmd_put\n");
-			put_done(handle, obj, 0);
-			break;
-		default:
-			break;
-		}
 		break;
 	case OBEX_EV_ABORT:
 		/* Request was aborted */
-            	printf("%s() OBEX_EV_ABORT: mode=%02x, obex_cmd=%02x, obex_rsp=%02x\n", __func__, 
-				mode, obex_cmd, obex_rsp);
+		OBEXFTP_LOG(OBEXFTP_LOG_VERBOSE, "%s() OBEX_EV_ABORT: mode=%02x, obex_cmd=%02x, obex_rsp=%02x\n",
+			__func__, mode, obex_cmd, obex_rsp);
+		PROBE2(obexftpd, abort, s, obex_cmd);
+		metrics.aborts++;
+		if (s) {
+			s->req_start = 0;
+			put_reset(s);
+			end_get(s);
+		}
 		break;
 
 	case OBEX_EV_STREAMEMPTY:
-		//(void) cli_fillstream(cli, object);
+		PROBE1(obexftpd, stream__empty, s);
+		if (s)
+			(void) fillstream(s, handle, obj);
 		break;
 
 	case OBEX_EV_UNEXPECTED:
 		/* Unexpected data, not fatal */
 		break;
     default:
-         printf("%s() Unhandled event %d\n", __func__, event);
+         OBEXFTP_LOG(OBEXFTP_LOG_DEBUG, "%s() Unhandled event %d\n", __func__, event);
          break;
 
 	}
 }
 
 
-static void start_server(int transport)
+/*
+ * Function add_listener()
+ *
+ *    Remember a transport to serve, with the current device and channel.
+ *
+ */
+static int add_listener(int transport)
 {
-	int use_sdp = 0;
-	obex_t *handle = NULL;
-	struct sockaddr_in saddr;
+	listener_t *l;
 
-	if (NULL == getcwd(init_work_path, WORK_PATH_MAX) && ERANGE == errno)
-	{
-		fprintf(stderr, "Wah, work path is too long, exceed %d.\n", WORK_PATH_MAX);
-		exit(0);
-	}
-
-       	if (transport==OBEX_TRANS_BLUETOOTH &&
-	    (0 > obexftp_sdp_register_push(channel) ||
-	     0 > obexftp_sdp_register_ftp(channel)))
-       	{
-       		//OBEX_Cleanup(handle);
-       		fprintf(stderr, "register to SDP Server failed.\n");
-       	}
-       	else
-       	{
-       		use_sdp = 1;
-       	}
-	
-reset:
-	handle = OBEX_Init(transport, obex_event, 0);
-	if (NULL == handle) {
-       		perror("failed to init obex.");
-       		exit(-1);
+	if (num_listeners >= MAX_LISTENERS) {
+		OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "too many transports\n");
+		return -1;
 	}
+	l = &listeners[num_listeners++];
+	l->transport = transport;
+	l->device = device;
+	l->channel = channel;
+	l->handle = NULL;
+	l->fd = -1;
+	return 0;
+}
 
-	switch (transport) {
-       	case OBEX_TRANS_INET:
+/*
+ * Function open_listener()
+ *
+ *    Register a transport and watch it in the loop.
+ *
+ */
+static void open_listener(listener_t *l)
+{
+	struct sockaddr_in saddr;
+
+	l->reset = 0;
+	if (l->transport == OBEX_TRANS_INET) {
+		memset(&saddr, 0, sizeof(saddr));
 	        saddr.sin_family = AF_INET;
-	        saddr.sin_port = htons(channel);
+	        saddr.sin_port = htons(l->channel);
 #ifdef _WIN32
-                saddr.sin_addr.s_addr = inet_addr(device);
+                saddr.sin_addr.s_addr = inet_addr(l->device);
 #else
-                (void) inet_aton(device, &saddr.sin_addr);
+                (void) inet_aton(l->device, &saddr.sin_addr);
 #endif
-		if (0 > TcpOBEX_ServerRegister(handle, (struct sockaddr *)&saddr, sizeof(saddr))) {
-       			perror("failed to register inet server");
+	}
+
+	/* only our own transport sees the packets to capture */
+	if (l->transport == OBEX_TRANS_INET && (zerocopy || capture_file)) {
+		l->handle = NULL;
+		l->fd = tcp_listen((struct sockaddr *)&saddr, sizeof(saddr));
+		if (0 > l->fd) {
+			OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "failed to register inet server: %s\n", strerror(errno));
+			exit(-1);
+		}
+		if (0 > loop_add(l->fd, accept_tcp_client, NULL)) {
+			OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "failed to watch the listener\n");
+			exit(-1);
+		}
+		return;
+	}
+
+	l->handle = OBEX_Init(l->transport, obex_event, 0);
+	if (NULL == l->handle) {
+       		OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "failed to init obex: %s\n", strerror(errno));
+       		exit(-1);
+	}
+
+	switch (l->transport) {
+       	case OBEX_TRANS_INET:
+		if (0 > TcpOBEX_ServerRegister(l->handle, (struct sockaddr *)&saddr, sizeof(saddr))) {
+       			OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "failed to register inet server: %s\n", strerror(errno));
 	       		exit(-1);
 		}
 	       	break;
 #ifdef HAVE_BLUETOOTH
        	case OBEX_TRANS_BLUETOOTH:
-		if (0 > BtOBEX_ServerRegister(handle, /*bdaddr_t *bt_src*/NULL, channel)) {
-       			perror("failed to register bluetooth server");
+		if (0 > BtOBEX_ServerRegister(l->handle, /*bdaddr_t *bt_src*/NULL, l->channel)) {
+       			OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "failed to register bluetooth server: %s\n", strerror(errno));
 	       		exit(-1);
 		}
        		break;
 #endif
        	case OBEX_TRANS_IRDA:
-		if (0 > IrOBEX_ServerRegister(handle, "")) {
-       			perror("failed to register IrDA server");
+		if (0 > IrOBEX_ServerRegister(l->handle, "")) {
+       			OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "failed to register IrDA server: %s\n", strerror(errno));
 	       		exit(-1);
 		}
 	       	break;
        	case OBEX_TRANS_CUSTOM:
 		/* A simple Ericsson protocol session perhaps? */
        	default:
-       		fprintf(stderr, "Transport type unknown\n");
+       		OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "Transport type unknown\n");
 	       		exit(-1);
 	}
-	printf("Waiting for connection...\n");
 
-	while (!finished) {
-		//printf("Handling connection...\n");
-		OBEX_HandleInput(handle, -1);
+	l->fd = OBEX_GetFD(l->handle);
+	if (0 > loop_add(l->fd, handle_input, l->handle)) {
+		OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "failed to watch the listener\n");
+		exit(-1);
+	}
+}
+
+static void close_listener(listener_t *l)
+{
+	loop_del(l->fd);
+	if (l->handle)
+		OBEX_Cleanup(l->handle);
+	else
+		close(l->fd);
+	l->handle = NULL;
+	l->fd = -1;
+}
+
+/*
+ * Function dump_metrics()
+ *
+ *    Write the counters to the status file or to stdout.
+ *
+ */
+static void dump_metrics(void)
+{
+	int ret;
+
+	if (!status_file) {
+		metrics_dump(stdout, num_sessions);
+		fflush(stdout);
+		return;
+	}
+	ret = metrics_write(status_file, num_sessions);
+	if (ret < 0)
+		OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "failed to write %s: %s\n", status_file, strerror(-ret));
+}
+
+#ifdef SIGUSR1
+/* only wakes the loop, handle_signal() does the work */
+static void on_signal(int sig)
+{
+	unsigned char c = sig;
+	int saved = errno;
+
+	(void) write(signal_pipe[1], &c, 1);
+	errno = saved;
+}
+
+/*
+ * Function handle_signal()
+ *
+ *    SIGUSR1 dumps the metrics, SIGUSR2 steps through the log levels
+ *    0 to 3 without a restart.
+ *
+ */
+static void handle_signal(int fd, void *UNUSED(data))
+{
+	unsigned char c;
+
+	while (read(fd, &c, 1) == 1) {
+		if (c == SIGUSR1) {
+			dump_metrics();
+		} else if (c == SIGUSR2) {
+			obexftp_log_set_level((obexftp_log_get_level() + 1) % (OBEXFTP_LOG_DEBUG + 1));
+			OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "Log level %d\n", obexftp_log_get_level());
+		}
+	}
+}
+
+static void init_signals(void)
+{
+	struct sigaction sa;
+	int i;
+
+	if (pipe(signal_pipe) < 0) {
+		OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "failed to create the signal pipe: %s\n", strerror(errno));
+		return;
+	}
+	for (i = 0; i < 2; i++) {
+		(void) fcntl(signal_pipe[i], F_SETFL, O_NONBLOCK);
+		(void) fcntl(signal_pipe[i], F_SETFD, FD_CLOEXEC);
+	}
+	if (0 > loop_add(signal_pipe[0], handle_signal, NULL)) {
+		OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "failed to watch the signal pipe\n");
+		return;
 	}
 
-	OBEX_Cleanup(handle);
-	sleep(1); /* throttle */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	(void) sigaction(SIGUSR1, &sa, NULL);
+	(void) sigaction(SIGUSR2, &sa, NULL);
+}
+
+static void cleanup_signals(void)
+{
+	(void) signal(SIGUSR1, SIG_DFL);
+	(void) signal(SIGUSR2, SIG_DFL);
+	if (signal_pipe[0] < 0)
+		return;
+	loop_del(signal_pipe[0]);
+	close(signal_pipe[0]);
+	close(signal_pipe[1]);
+	signal_pipe[0] = signal_pipe[1] = -1;
+}
+#endif /* SIGUSR1 */
+
+/*
+ * Function start_server()
+ *
+ *    Serve all the transports given on the command line from one loop.
+ *    Sessions of every transport share the listing cache.
+ *
+ */
+static void start_server(void)
+{
+	int use_sdp = 0;
+	int timeout, wait, ret;
+	int i;
+
+	/* the loop never waits for stderr */
+	(void) obexftp_log_start(STDERR_FILENO);
+
+	/* every session starts here, see --chdir */
+	if (root_fd < 0)
+		root_fd = store->root(".");
+	if (root_fd < 0)
+	{
+		OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "failed to open the base folder: %s\n", strerror(errno));
+		exit(-1);
+	}
 
-	if (obexftpd_reset)
+	if (0 > loop_init())
 	{
-		fprintf(stderr, "obexftpd reset\n");
-		obexftpd_reset = 0;
-		finished = 0;
-		success = 0;
-		goto reset;
+		OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "failed to init event loop: %s\n", strerror(errno));
+		exit(-1);
+	}
+	init_listing_cache();
+	metrics_init();
+#ifdef SIGUSR1
+	init_signals();
+#endif
+	(void) pool_init(STAT_THREADS);
+#ifdef HAVE_LIBURING
+	(void) io_init(IO_URING);
+#else
+	(void) io_init(IO_THREADS);
+#endif
+	OBEXFTP_LOG(OBEXFTP_LOG_INFO, "Using %s file I/O\n", io_backend_name());
+	OBEXFTP_LOG(OBEXFTP_LOG_INFO, "Serving from %s\n", store->name);
+	if (!store->fds && zerocopy) {
+		OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "zerocopy needs a file system store, ignored\n");
+		zerocopy = 0;
+	}
+
+	for (i = 0; i < num_listeners; i++) {
+		if (listeners[i].transport != OBEX_TRANS_BLUETOOTH || use_sdp)
+			continue;
+	       	if (0 > obexftp_sdp_register_push(listeners[i].channel) ||
+		    0 > obexftp_sdp_register_ftp(listeners[i].channel))
+       		{
+       			OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "register to SDP Server failed.\n");
+       		}
+       		else
+       		{
+       			use_sdp = 1;
+       		}
+	}
+
+	if (capture_file && 0 > (ret = cobex_capture_open(capture_file))) {
+		OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "failed to open %s: %s\n", capture_file, strerror(-ret));
+		exit(-1);
+	}
+	for (i = 0; i < num_listeners; i++)
+		open_listener(&listeners[i]);
+	OBEXFTP_LOG(OBEXFTP_LOG_INFO, "Waiting for connection...\n");
+
+	/* each connection is served as its input arrives */
+	bucket_init(&total_bucket, total_rate);
+	while (!finished) {
+		timeout = commit_timeout();
+		wait = shape_timeout();
+		if (wait >= 0 && (timeout < 0 || wait < timeout))
+			timeout = wait;
+		if (0 > loop_run(timeout)) {
+			OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "event loop failed: %s\n", strerror(errno));
+			break;
+		}
+		commit_run();
+		shape_run();
+		reap_sessions(0);
+
+		for (i = 0; i < num_listeners; i++) {
+			if (!listeners[i].reset)
+				continue;
+			OBEXFTP_LOG(OBEXFTP_LOG_INFO, "obexftpd reset\n");
+			close_listener(&listeners[i]);
+			sleep(1); /* throttle */
+			open_listener(&listeners[i]);
+		}
 	}
+
+	for (i = 0; i < num_listeners; i++)
+		close_listener(&listeners[i]);
+	commit_deadline = now_ms();
+	commit_run();
+	reap_sessions(1);
+	cobex_capture_close();
+	flush_listing_cache();
+	flush_capability();
+	flush_content_cache();
+	if (status_file)
+		dump_metrics();
+#ifdef SIGUSR1
+	cleanup_signals();
+#endif
+	io_cleanup();
+	loop_cleanup();
+	pool_cleanup();
+	obexftp_log_stop();
 	
 	if (use_sdp)
 	{
-		fprintf(stderr, "sdp unregister\n");
+		OBEXFTP_LOG(OBEXFTP_LOG_INFO, "sdp unregister\n");
 		if (0 > obexftp_sdp_unregister_push() ||
 		    0 > obexftp_sdp_unregister_ftp())
 		{
-       			fprintf(stderr, "unregister from SDP Server failed.\n");
+       			OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "unregister from SDP Server failed.\n");
 		}
 	}
 
@@ -944,6 +3154,17 @@ int main(int argc, char *argv[])
 			{"tty",		required_argument, NULL, 't'},
 			{"network",	required_argument, NULL, 'n'},
 			{"chdir",	required_argument, NULL, 'c'},
+			{"zerocopy",	no_argument, NULL, 'z'},
+			{"memory",	no_argument, NULL, 'm'},
+			{"cache",	required_argument, NULL, 'C'},
+			{"no-srm",	no_argument, NULL, 'S'},
+			{"rate",	required_argument, NULL, 'r'},
+			{"total-rate",	required_argument, NULL, 'R'},
+			{"sessions",	required_argument, NULL, 's'},
+			{"quota",	required_argument, NULL, 'q'},
+			{"durable",	optional_argument, NULL, 'd'},
+			{"status",	required_argument, NULL, 'P'},
+			{"capture",	required_argument, NULL, 'w'},
 			{"verbose",	no_argument, NULL, 'v'},
 			{"version",	no_argument, NULL, 'V'},
 			{"help",	no_argument, NULL, 'h'},
@@ -951,7 +3172,7 @@ int main(int argc, char *argv[])
 			{0, 0, 0, 0}
 		};
 		
-		c = getopt_long (argc, argv, "-ib::t:n:c:vVh",
+		c = getopt_long (argc, argv, "-ib::t:n:c:zmC:Sr:R:s:q:d::P:w:vVh",
 				 long_options, &option_index);
 		if (c == -1)
 			break;
@@ -959,26 +3180,25 @@ int main(int argc, char *argv[])
 		switch (c) {
 		
 		case 'i':
-			start_server(OBEX_TRANS_IRDA);
+			if (0 > add_listener(OBEX_TRANS_IRDA))
+				exit(-1);
 			break;
 		
 		case 'b':
-			if (optarg) {
-				channel = atoi(optarg);
-			}
-			start_server(OBEX_TRANS_BLUETOOTH);
-			fprintf(stderr, "server end\n");
+			channel = optarg ? atoi(optarg) : 10; /* OBEX_PUSH_HANDLE */
+			if (0 > add_listener(OBEX_TRANS_BLUETOOTH))
+				exit(-1);
 			break;
 
 		case 'n':
 			parsehostport(optarg, &device, &channel);
 			//channel = atoi(optarg);
-			start_server(OBEX_TRANS_INET);
-			fprintf(stderr, "server end\n");
+			if (0 > add_listener(OBEX_TRANS_INET))
+				exit(-1);
 			break;
 
 		case 't':
-			printf("accepting on tty not implemented yet.");
+			OBEXFTP_LOG(OBEXFTP_LOG_ERROR, "accepting on tty not implemented yet.\n");
 			/* start_server(OBEX_TRANS_CUSTOM); optarg */
 			break;
 
@@ -986,8 +3206,52 @@ int main(int argc, char *argv[])
 			chdir(optarg);
 			break;
 
+		case 'z':
+			zerocopy = 1;
+			break;
+
+		case 'm':
+			store = &store_memory;
+			break;
+
+		case 'C':
+			content_budget = (size_t) atoi(optarg) * 1024 * 1024;
+			break;
+
+		case 'S':
+			srm = 0;
+			break;
+
+		case 'r':
+			session_rate = atoll(optarg) * 1024;
+			break;
+
+		case 'R':
+			total_rate = atoll(optarg) * 1024;
+			break;
+
+		case 's':
+			max_sessions = atoi(optarg);
+			break;
+
+		case 'q':
+			max_inflight = (uint64_t) atoll(optarg) * 1024 * 1024;
+			break;
+
+		case 'd':
+			commit_window = optarg ? atoi(optarg) : COMMIT_WINDOW;
+			break;
+
+		case 'P':
+			status_file = optarg;
+			break;
+
+		case 'w':
+			capture_file = optarg;
+			break;
+
 		case 'v':
-			verbose++;
+			obexftp_log_set_level(obexftp_log_get_level() + 1);
 			break;
 
 		case 'V':
@@ -996,7 +3260,7 @@ int main(int argc, char *argv[])
 
 		case 'h':
 			printf("ObexFTPd %s\n", VERSION);
-			printf("Usage: %s  [-c <path>]  [-v]  [-i | -b | -t <dev> | -n <port>]\n"
+			printf("Usage: %s  [-c <path>]  [-z]  [-m]  [-C <MiB>]  [-S]  [-r <KiB/s>]  [-R <KiB/s>]  [-s <n>]  [-q <MiB>]  [-d [<ms>]]  [-P <file>]  [-w <file>]  [-v]  [-i] [-b] [-t <dev>] [-n <port>]\n"
 				"Recieve files from/to Mobile Equipment.\n"
 				"Copyright (c) 2003-2006 Christian W. Zuckschwerdt, Alan Zhang,\n"
 				"                        Hendrik Sattler, Frode Isaksen\n"
@@ -1007,7 +3271,18 @@ int main(int argc, char *argv[])
 				" -n, --network <port>        accept network connections\n"
 				"\n"
 				" -c, --chdir <path>          set a default basedir\n"
-				" -v, --verbose               verbose messages\n"
+				" -z, --zerocopy              send files to network clients with sendfile\n"
+				" -m, --memory                serve a copy of the basedir from memory\n"
+				" -C, --cache <MiB>           memory for hot file bodies, 0 disables\n"
+				" -S, --no-srm                answer every packet, no Single Response Mode\n"
+				" -r, --rate <KiB/s>          limit the transfer rate of each session\n"
+				" -R, --total-rate <KiB/s>    limit the transfer rate of all sessions\n"
+				" -s, --sessions <n>          serve at most this many clients at a time\n"
+				" -q, --quota <MiB>           limit the bytes of all PUTs in progress\n"
+				" -d, --durable [<ms>]        sync received files, batched in this window\n"
+				" -P, --status <file>         write the metrics here on SIGUSR1\n"
+				" -w, --capture <file>        write the packets of network sessions to a pcap file\n"
+				" -v, --verbose               verbose messages, SIGUSR2 steps the level\n"
 				"\n"
 				" -V, --version               print version info\n"
 				" -h, --help, --usage         this help text\n",
@@ -1028,6 +3303,12 @@ int main(int argc, char *argv[])
 		exit (-1);
 	}
 
+	/* all transports are served together */
+	if (num_listeners > 0) {
+		start_server();
+		OBEXFTP_LOG(OBEXFTP_LOG_INFO, "server end\n");
+	}
+
 	exit (0);
 
 }
@@ -0,0 +1,467 @@
+/**
+	\file apps/obexftpd_io.c
+	Asynchronous file I/O for the OBEX file server.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2003-2006 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_LIBURING
+#include <sys/eventfd.h>
+#include <liburing.h>
+#endif
+
+#include "obexftpd_loop.h"
+#include "obexftpd_io.h"
+
+#define IO_WORKERS	4
+#define IO_URING_DEPTH	64
+
+/* one request in flight */
+typedef struct io_req {
+	struct io_req *next;
+	int write;
+	int fd;
+	void *buf;
+	size_t len;
+	off_t offset;
+	int result;
+	io_cb_t cb;
+	void *data;
+} io_req_t;
+
+static enum io_backend backend = IO_SYNC;
+
+/* readable when completions are waiting */
+static int notify_fd = -1;
+/* requests submitted and not completed */
+static int in_flight = 0;
+
+#ifdef HAVE_PTHREAD
+static pthread_t io_threads[IO_WORKERS];
+static int thread_count = 0;
+static int shutdown_io = 0;
+static int notify_wr = -1;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static io_req_t *queue_head = NULL, *queue_tail = NULL;
+static io_req_t *done_head = NULL, *done_tail = NULL;
+#endif
+
+#ifdef HAVE_LIBURING
+static struct io_uring ring;
+#endif
+
+
+/* run a request with blocking calls */
+static int do_io(io_req_t *req)
+{
+	ssize_t ret;
+
+	do {
+		if (req->write)
+			ret = pwrite(req->fd, req->buf, req->len, req->offset);
+		else
+			ret = pread(req->fd, req->buf, req->len, req->offset);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret < 0 ? -errno : (int) ret;
+}
+
+static void complete(io_req_t *req)
+{
+	in_flight--;
+	req->cb(req->data, req->result);
+	free(req);
+}
+
+#ifdef HAVE_PTHREAD
+static void *io_worker(void *arg)
+{
+	io_req_t *req;
+	char c = 0;
+
+	(void) arg;
+
+	pthread_mutex_lock(&lock);
+	while (!shutdown_io) {
+		req = queue_head;
+		if (!req) {
+			pthread_cond_wait(&work_cond, &lock);
+			continue;
+		}
+		queue_head = req->next;
+		if (!queue_head)
+			queue_tail = NULL;
+		pthread_mutex_unlock(&lock);
+
+		req->result = do_io(req);
+		req->next = NULL;
+
+		pthread_mutex_lock(&lock);
+		if (done_tail)
+			done_tail->next = req;
+		else
+			done_head = req;
+		done_tail = req;
+		(void) write(notify_wr, &c, 1);
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+/* run the callbacks of finished requests */
+static int thread_complete(void)
+{
+	io_req_t *req, *next;
+	char buf[64];
+	int n = 0;
+
+	while (read(notify_fd, buf, sizeof(buf)) > 0);
+
+	pthread_mutex_lock(&lock);
+	req = done_head;
+	done_head = done_tail = NULL;
+	pthread_mutex_unlock(&lock);
+
+	for (; req; req = next) {
+		next = req->next;
+		complete(req);
+		n++;
+	}
+	return n;
+}
+
+static int thread_init(void)
+{
+	int fds[2];
+
+	if (pipe(fds) < 0)
+		return -errno;
+	(void) fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	(void) fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	(void) fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	notify_fd = fds[0];
+	notify_wr = fds[1];
+
+	shutdown_io = 0;
+	while (thread_count < IO_WORKERS) {
+		if (pthread_create(&io_threads[thread_count], NULL, io_worker, NULL))
+			break;
+		thread_count++;
+	}
+	if (thread_count == 0) {
+		close(notify_fd);
+		close(notify_wr);
+		notify_fd = notify_wr = -1;
+		return -EAGAIN;
+	}
+	return 0;
+}
+
+static void thread_cleanup(void)
+{
+	int i;
+
+	pthread_mutex_lock(&lock);
+	shutdown_io = 1;
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&lock);
+	for (i = 0; i < thread_count; i++)
+		pthread_join(io_threads[i], NULL);
+	thread_count = 0;
+
+	/* drop what never ran, the sessions are gone by now */
+	while (queue_head) {
+		done_head = queue_head->next;
+		free(queue_head);
+		queue_head = done_head;
+	}
+	while (done_head) {
+		queue_head = done_head->next;
+		free(done_head);
+		done_head = queue_head;
+	}
+	queue_tail = done_tail = NULL;
+	in_flight = 0;
+	close(notify_wr);
+	notify_wr = -1;
+}
+#endif
+
+#ifdef HAVE_LIBURING
+static int uring_complete(void)
+{
+	struct io_uring_cqe *cqe;
+	io_req_t *req;
+	eventfd_t v;
+	int n = 0;
+
+	(void) eventfd_read(notify_fd, &v);
+	while (io_uring_peek_cqe(&ring, &cqe) == 0) {
+		req = io_uring_cqe_get_data(cqe);
+		req->result = cqe->res;
+		io_uring_cqe_seen(&ring, cqe);
+		complete(req);
+		n++;
+	}
+	return n;
+}
+
+static int uring_init(void)
+{
+	int ret;
+
+	ret = io_uring_queue_init(IO_URING_DEPTH, &ring, 0);
+	if (ret < 0)
+		return ret;
+	notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (notify_fd < 0 || io_uring_register_eventfd(&ring, notify_fd) < 0) {
+		if (notify_fd >= 0)
+			close(notify_fd);
+		notify_fd = -1;
+		io_uring_queue_exit(&ring);
+		return -ENOSYS;
+	}
+	return 0;
+}
+
+static int uring_submit(io_req_t *req)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = io_uring_get_sqe(&ring);
+	if (!sqe) {
+		/* the ring is full, push it out and try again */
+		(void) io_uring_submit(&ring);
+		sqe = io_uring_get_sqe(&ring);
+		if (!sqe)
+			return -EBUSY;
+	}
+	if (req->write)
+		io_uring_prep_write(sqe, req->fd, req->buf, req->len, req->offset);
+	else
+		io_uring_prep_read(sqe, req->fd, req->buf, req->len, req->offset);
+	io_uring_sqe_set_data(sqe, req);
+	/* on failure the entry stays queued for the next submit */
+	(void) io_uring_submit(&ring);
+	return 0;
+}
+#endif
+
+/* run finished callbacks, called from the loop */
+static int io_complete(void)
+{
+	switch (backend) {
+#ifdef HAVE_LIBURING
+	case IO_URING:
+		return uring_complete();
+#endif
+#ifdef HAVE_PTHREAD
+	case IO_THREADS:
+		return thread_complete();
+#endif
+	default:
+		return 0;
+	}
+}
+
+static void io_input(int fd, void *data)
+{
+	(void) fd;
+	(void) data;
+	(void) io_complete();
+}
+
+/**
+	Start the I/O backend. Falls back to worker threads if io_uring is
+	not available and to blocking calls if there are no threads.
+	Call loop_init() first, completions are delivered by the loop.
+
+	\return 0 on success, a negative errno otherwise
+ */
+int io_init(enum io_backend want)
+{
+	backend = IO_SYNC;
+
+#ifdef HAVE_LIBURING
+	if (want == IO_URING && uring_init() == 0)
+		backend = IO_URING;
+#endif
+#ifdef HAVE_PTHREAD
+	if (want != IO_SYNC && backend == IO_SYNC && thread_init() == 0)
+		backend = IO_THREADS;
+#endif
+	(void) want;
+
+	if (backend != IO_SYNC && loop_add(notify_fd, io_input, NULL) < 0) {
+		io_cleanup();
+		return -EIO;
+	}
+	return 0;
+}
+
+/**
+	Stop the I/O backend. Requests still queued are dropped
+	without a callback, drain the sessions first.
+ */
+void io_cleanup(void)
+{
+	if (notify_fd >= 0)
+		(void) loop_del(notify_fd);
+
+	switch (backend) {
+#ifdef HAVE_LIBURING
+	case IO_URING:
+		io_uring_queue_exit(&ring);
+		break;
+#endif
+#ifdef HAVE_PTHREAD
+	case IO_THREADS:
+		thread_cleanup();
+		break;
+#endif
+	default:
+		break;
+	}
+
+	if (notify_fd >= 0)
+		close(notify_fd);
+	notify_fd = -1;
+	backend = IO_SYNC;
+}
+
+/**
+	Name of the backend in use.
+ */
+const char *io_backend_name(void)
+{
+	switch (backend) {
+	case IO_URING:
+		return "io_uring";
+	case IO_THREADS:
+		return "threads";
+	default:
+		return "sync";
+	}
+}
+
+static int submit(int write, int fd, void *buf, size_t len, off_t offset, io_cb_t cb, void *data)
+{
+	io_req_t *req;
+
+	req = calloc(1, sizeof(io_req_t));
+	if (!req)
+		return -ENOMEM;
+	req->write = write;
+	req->fd = fd;
+	req->buf = buf;
+	req->len = len;
+	req->offset = offset;
+	req->cb = cb;
+	req->data = data;
+	in_flight++;
+
+	switch (backend) {
+#ifdef HAVE_LIBURING
+	case IO_URING:
+		if (uring_submit(req) == 0)
+			return 0;
+		break; /* run it here */
+#endif
+#ifdef HAVE_PTHREAD
+	case IO_THREADS:
+		pthread_mutex_lock(&lock);
+		if (queue_tail)
+			queue_tail->next = req;
+		else
+			queue_head = req;
+		queue_tail = req;
+		pthread_cond_signal(&work_cond);
+		pthread_mutex_unlock(&lock);
+		return 0;
+#endif
+	default:
+		break;
+	}
+
+	req->result = do_io(req);
+	complete(req);
+	return 0;
+}
+
+/**
+	Read from a file at an offset.
+	\a cb may run before this returns.
+
+	\return 0 if the request was taken, a negative errno otherwise
+ */
+int io_read(int fd, void *buf, size_t len, off_t offset, io_cb_t cb, void *data)
+{
+	return submit(0, fd, buf, len, offset, cb, data);
+}
+
+/**
+	Write to a file at an offset.
+	\a cb may run before this returns.
+
+	\return 0 if the request was taken, a negative errno otherwise
+ */
+int io_write(int fd, const void *buf, size_t len, off_t offset, io_cb_t cb, void *data)
+{
+	return submit(1, fd, (void *) buf, len, offset, cb, data);
+}
+
+/**
+	Wait for requests to finish and run their callbacks.
+
+	\return the number of callbacks run, 0 if nothing is in flight
+ */
+int io_wait(void)
+{
+	struct pollfd pfd;
+	int n;
+
+	if (backend == IO_SYNC || in_flight == 0)
+		return 0;
+
+	n = io_complete();
+	if (n > 0)
+		return n;
+#ifdef HAVE_LIBURING
+	if (backend == IO_URING)
+		(void) io_uring_submit(&ring);
+#endif
+
+	pfd.fd = notify_fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+		return -errno;
+	return io_complete();
+}
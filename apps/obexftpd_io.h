@@ -0,0 +1,57 @@
+/**
+	\file apps/obexftpd_io.h
+	Asynchronous file I/O for the OBEX file server.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2003-2006 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+#ifndef OBEXFTPD_IO_H
+#define OBEXFTPD_IO_H
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* I/O backends */
+enum io_backend {
+	IO_SYNC,	/* blocking calls, completions run at once */
+	IO_THREADS,	/* blocking calls on worker threads */
+	IO_URING	/* io_uring */
+};
+
+/* called on the loop thread with the byte count or a negative errno */
+typedef void (*io_cb_t) (void *data, int result);
+
+int io_init(enum io_backend backend);
+
+void io_cleanup(void);
+
+const char *io_backend_name(void);
+
+int io_read(int fd, void *buf, size_t len, off_t offset, io_cb_t cb, void *data);
+
+int io_write(int fd, const void *buf, size_t len, off_t offset, io_cb_t cb, void *data);
+
+int io_wait(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OBEXFTPD_IO_H */
@@ -0,0 +1,198 @@
+/**
+	\file apps/obexftpd_iobench.c
+	Compare the file I/O backends of the OBEX file server.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2003-2006 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "obexftpd_loop.h"
+#include "obexftpd_io.h"
+
+/* the same as a obexftpd transfer */
+#define BENCH_DEPTH	4
+#define BENCH_CHUNK	(16 * 1024)
+
+struct bench {
+	int fd;
+	int write;
+	off_t size;
+	off_t offset;		/* next to submit */
+	int pending;
+	int error;
+	char *buf[BENCH_DEPTH];
+};
+
+struct bench_chunk {
+	struct bench *b;
+	int index;
+	int busy;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void done(void *data, int result)
+{
+	struct bench_chunk *c = data;
+
+	c->busy = 0;
+	c->b->pending--;
+	if (result <= 0 && !c->b->error)
+		c->b->error = result < 0 ? -result : EIO;
+}
+
+static void submit(struct bench_chunk *c)
+{
+	struct bench *b = c->b;
+	off_t offset = b->offset;
+	int len, ret;
+
+	if (b->error || offset >= b->size)
+		return;
+	len = b->size - offset < BENCH_CHUNK ? (int) (b->size - offset) : BENCH_CHUNK;
+	b->offset += len;
+	b->pending++;
+	c->busy = 1;
+	if (b->write)
+		ret = io_write(b->fd, b->buf[c->index], len, offset, done, c);
+	else
+		ret = io_read(b->fd, b->buf[c->index], len, offset, done, c);
+	if (ret < 0) {
+		c->busy = 0;
+		b->pending--;
+		b->error = -ret;
+	}
+}
+
+/* run one pass with BENCH_DEPTH chunks in flight, return MB/s */
+static double run(struct bench *b, int depth)
+{
+	struct bench_chunk chunks[BENCH_DEPTH];
+	double start;
+	int i;
+
+	b->offset = 0;
+	b->error = 0;
+	start = now();
+	for (i = 0; i < depth; i++) {
+		chunks[i].b = b;
+		chunks[i].index = i;
+		chunks[i].busy = 0;
+	}
+	/* keep every buffer busy until the whole file is done */
+	do {
+		for (i = 0; i < depth; i++)
+			if (!chunks[i].busy)
+				submit(&chunks[i]);
+	} while ((b->pending > 0 || (!b->error && b->offset < b->size)) &&
+		 io_wait() >= 0);
+	if (b->write)
+		(void) fdatasync(b->fd);
+	if (b->error) {
+		fprintf(stderr, "%s failed: %s\n", b->write ? "write" : "read", strerror(b->error));
+		return 0;
+	}
+	return b->size / (now() - start) / (1024 * 1024);
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct {
+		enum io_backend backend;
+		int depth;
+	} passes[] = {
+		{ IO_SYNC, 1 },
+		{ IO_THREADS, BENCH_DEPTH },
+		{ IO_URING, BENCH_DEPTH },
+	};
+	struct bench b;
+	int i, mb = 64;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <file> [<size in MB>]\n"
+			"Time chunked reads and writes of a scratch file with each\n"
+			"file I/O backend of obexftpd. The file is overwritten.\n",
+			argv[0]);
+		exit(1);
+	}
+	if (argc > 2)
+		mb = atoi(argv[2]);
+
+	memset(&b, 0, sizeof(b));
+	b.size = (off_t) mb * 1024 * 1024;
+	for (i = 0; i < BENCH_DEPTH; i++) {
+		b.buf[i] = malloc(BENCH_CHUNK);
+		if (!b.buf[i])
+			exit(1);
+		memset(b.buf[i], 'x', BENCH_CHUNK);
+	}
+
+	b.fd = open(argv[1], O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (b.fd < 0) {
+		perror(argv[1]);
+		exit(1);
+	}
+	if (loop_init() < 0) {
+		perror("loop_init");
+		exit(1);
+	}
+
+	printf("%d MB in %d KB chunks\n", mb, BENCH_CHUNK / 1024);
+	printf("%-10s %6s %12s %12s\n", "backend", "depth", "write MB/s", "read MB/s");
+	for (i = 0; i < (int) (sizeof(passes) / sizeof(passes[0])); i++) {
+		double w, r;
+
+		if (io_init(passes[i].backend) < 0)
+			continue;
+		if (passes[i].backend != IO_SYNC &&
+		    !strcmp(io_backend_name(), "sync")) {
+			io_cleanup();
+			continue;
+		}
+		if (passes[i].backend == IO_URING &&
+		    strcmp(io_backend_name(), "io_uring")) {
+			io_cleanup(); /* not built or not supported */
+			continue;
+		}
+		b.write = 1;
+		w = run(&b, passes[i].depth);
+		b.write = 0;
+		r = run(&b, passes[i].depth);
+		printf("%-10s %6d %12.1f %12.1f\n", io_backend_name(), passes[i].depth, w, r);
+		io_cleanup();
+	}
+
+	loop_cleanup();
+	close(b.fd);
+	for (i = 0; i < BENCH_DEPTH; i++)
+		free(b.buf[i]);
+	return 0;
+}
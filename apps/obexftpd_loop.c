@@ -0,0 +1,200 @@
+/**
+	\file apps/obexftpd_loop.c
+	Event loop for the OBEX file server.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2003-2006 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+#include "obexftpd_loop.h"
+
+#define LOOP_MAX_EVENTS	32
+
+/* one watched fd */
+typedef struct {
+	int fd;
+	loop_cb_t cb;
+	void *data;
+} watch_t;
+
+static watch_t *watches = NULL;
+static int watch_count = 0;
+static int watch_alloc = 0;
+
+#ifdef HAVE_SYS_EPOLL_H
+static int epfd = -1;
+#endif
+
+
+static watch_t *find_watch(int fd)
+{
+	int i;
+
+	for (i = 0; i < watch_count; i++)
+		if (watches[i].fd == fd)
+			return &watches[i];
+	return NULL;
+}
+
+/**
+	Prepare the event loop. Uses epoll where available, poll otherwise.
+ */
+int loop_init(void)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	if (epfd < 0)
+		epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0)
+		return -errno;
+#endif
+	return 0;
+}
+
+/**
+	Forget all watches.
+ */
+void loop_cleanup(void)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	if (epfd >= 0)
+		close(epfd);
+	epfd = -1;
+#endif
+	free(watches);
+	watches = NULL;
+	watch_count = watch_alloc = 0;
+}
+
+/**
+	Watch an fd for input.
+	\return 0 on success, a negative errno otherwise
+ */
+int loop_add(int fd, loop_cb_t cb, void *data)
+{
+	watch_t *w;
+#ifdef HAVE_SYS_EPOLL_H
+	struct epoll_event ev;
+#endif
+
+	if (fd < 0 || !cb)
+		return -EINVAL;
+	if (find_watch(fd))
+		return -EEXIST;
+
+	if (watch_count >= watch_alloc) {
+		w = realloc(watches, (watch_alloc + 16) * sizeof(watch_t));
+		if (!w)
+			return -ENOMEM;
+		watches = w;
+		watch_alloc += 16;
+	}
+
+#ifdef HAVE_SYS_EPOLL_H
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		return -errno;
+#endif
+
+	w = &watches[watch_count++];
+	w->fd = fd;
+	w->cb = cb;
+	w->data = data;
+	return 0;
+}
+
+/**
+	Stop watching an fd.
+	Safe to call from a callback, pending events for the fd are dropped.
+ */
+int loop_del(int fd)
+{
+	watch_t *w;
+
+	w = find_watch(fd);
+	if (!w)
+		return -ENOENT;
+#ifdef HAVE_SYS_EPOLL_H
+	(void) epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+	*w = watches[--watch_count];
+	return 0;
+}
+
+/**
+	Wait for input and run the callbacks once.
+
+	\param timeout in milliseconds, -1 to wait forever
+
+	\return the number of callbacks run, a negative errno on error
+ */
+int loop_run(int timeout)
+{
+	watch_t *w;
+	int fds[LOOP_MAX_EVENTS];
+	int i, n;
+#ifdef HAVE_SYS_EPOLL_H
+	struct epoll_event events[LOOP_MAX_EVENTS];
+
+	n = epoll_wait(epfd, events, LOOP_MAX_EVENTS, timeout);
+	if (n < 0)
+		return errno == EINTR ? 0 : -errno;
+	for (i = 0; i < n; i++)
+		fds[i] = events[i].data.fd;
+#else
+	struct pollfd *pfds;
+	int count;
+
+	count = watch_count;
+	pfds = calloc(count ? count : 1, sizeof(struct pollfd));
+	if (!pfds)
+		return -ENOMEM;
+	for (i = 0; i < count; i++) {
+		pfds[i].fd = watches[i].fd;
+		pfds[i].events = POLLIN;
+	}
+	n = poll(pfds, count, timeout);
+	if (n < 0) {
+		free(pfds);
+		return errno == EINTR ? 0 : -errno;
+	}
+	for (i = 0, n = 0; i < count && n < LOOP_MAX_EVENTS; i++)
+		if (pfds[i].revents)
+			fds[n++] = pfds[i].fd;
+	free(pfds);
+#endif
+
+	/* look each one up again, a callback may have removed it */
+	for (i = 0; i < n; i++) {
+		w = find_watch(fds[i]);
+		if (w)
+			w->cb(w->fd, w->data);
+	}
+	return n;
+}
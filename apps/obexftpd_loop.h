@@ -0,0 +1,46 @@
+/**
+	\file apps/obexftpd_loop.h
+	Event loop for the OBEX file server.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2003-2006 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+#ifndef OBEXFTPD_LOOP_H
+#define OBEXFTPD_LOOP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* called when the fd is readable */
+typedef void (*loop_cb_t) (int fd, void *data);
+
+int loop_init(void);
+
+void loop_cleanup(void);
+
+int loop_add(int fd, loop_cb_t cb, void *data);
+
+int loop_del(int fd);
+
+int loop_run(int timeout);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OBEXFTPD_LOOP_H */
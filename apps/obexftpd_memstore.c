@@ -0,0 +1,746 @@
+/**
+	\file apps/obexftpd_memstore.c
+	In-memory storage backend for the OBEX file server.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2003-2006 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+/* The tree is loaded from a folder once and lives in memory from then
+   on. Lookups are read-only and may run on several threads at once,
+   everything else runs on the loop thread. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <stdint.h>
+
+#include "obexftpd_store.h"
+
+struct mem_node;
+
+/* a name in a folder */
+typedef struct mem_entry {
+	struct mem_entry *next;
+	char *name;
+	struct mem_node *node;
+} mem_entry_t;
+
+typedef struct mem_node {
+	mode_t mode;
+	ino_t ino;
+	int nlink;		/* names of the node */
+	int refs;		/* open handles */
+	struct timespec mtime;
+	uint8_t *data;		/* file contents */
+	size_t size;
+	size_t alloc;
+	mem_entry_t *entries;	/* folder contents */
+	struct mem_node *parent; /* folders only, the root is its own */
+} mem_node_t;
+
+static mem_node_t **handles = NULL;
+static int handle_max = 0;
+static ino_t next_ino = 1;
+
+/* a new modification time, always later than the one before */
+static void touch(mem_node_t *node)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	if (now.tv_sec < node->mtime.tv_sec ||
+	    (now.tv_sec == node->mtime.tv_sec && now.tv_nsec <= node->mtime.tv_nsec)) {
+		now = node->mtime;
+		if (++now.tv_nsec >= 1000000000) {
+			now.tv_sec++;
+			now.tv_nsec = 0;
+		}
+	}
+	node->mtime = now;
+}
+
+static mem_node_t *node_new(mode_t mode)
+{
+	mem_node_t *node;
+
+	node = calloc(1, sizeof(mem_node_t));
+	if (!node) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	node->mode = mode;
+	node->ino = next_ino++;
+	touch(node);
+	return node;
+}
+
+/* free a node without names and handles, folders are empty by then */
+static void node_put(mem_node_t *node)
+{
+	if (node->nlink > 0 || node->refs > 0)
+		return;
+	free(node->data);
+	free(node);
+}
+
+static int handle_new(mem_node_t *node)
+{
+	mem_node_t **tmp;
+	int fd, max;
+
+	for (fd = 0; fd < handle_max && handles[fd]; fd++);
+	if (fd == handle_max) {
+		max = handle_max ? handle_max * 2 : 64;
+		tmp = realloc(handles, max * sizeof(mem_node_t *));
+		if (!tmp) {
+			errno = EMFILE;
+			return -1;
+		}
+		memset(tmp + handle_max, 0, (max - handle_max) * sizeof(mem_node_t *));
+		handles = tmp;
+		handle_max = max;
+	}
+	handles[fd] = node;
+	node->refs++;
+	return fd;
+}
+
+static mem_node_t *get(int fd)
+{
+	if (fd < 0 || fd >= handle_max || !handles[fd]) {
+		errno = EBADF;
+		return NULL;
+	}
+	return handles[fd];
+}
+
+static mem_node_t *get_dir(int fd)
+{
+	mem_node_t *dir = get(fd);
+
+	if (dir && !S_ISDIR(dir->mode)) {
+		errno = ENOTDIR;
+		return NULL;
+	}
+	return dir;
+}
+
+static mem_entry_t *lookup(mem_node_t *dir, const char *name)
+{
+	mem_entry_t *e;
+
+	for (e = dir->entries; e; e = e->next)
+		if (!strcmp(e->name, name))
+			return e;
+	return NULL;
+}
+
+/* the node for a name, . and .. included */
+static mem_node_t *resolve(mem_node_t *dir, const char *name)
+{
+	mem_entry_t *e;
+
+	if (!strcmp(name, "."))
+		return dir;
+	if (!strcmp(name, ".."))
+		return dir->parent;
+	e = lookup(dir, name);
+	if (!e) {
+		errno = ENOENT;
+		return NULL;
+	}
+	return e->node;
+}
+
+static int entry_add(mem_node_t *dir, const char *name, mem_node_t *node)
+{
+	mem_entry_t *e;
+
+	if (!*name || strchr(name, '/')) {
+		errno = EINVAL;
+		return -1;
+	}
+	e = calloc(1, sizeof(mem_entry_t));
+	if (e)
+		e->name = strdup(name);
+	if (!e || !e->name) {
+		free(e);
+		errno = ENOMEM;
+		return -1;
+	}
+	e->node = node;
+	e->next = dir->entries;
+	dir->entries = e;
+	node->nlink++;
+	if (S_ISDIR(node->mode))
+		node->parent = dir;
+	touch(dir);
+	return 0;
+}
+
+static void entry_del(mem_node_t *dir, mem_entry_t *entry)
+{
+	mem_entry_t **link;
+
+	for (link = &dir->entries; *link && *link != entry; link = &(*link)->next);
+	if (!*link)
+		return;
+	*link = entry->next;
+	entry->node->nlink--;
+	node_put(entry->node);
+	free(entry->name);
+	free(entry);
+	touch(dir);
+}
+
+/* remove everything below a folder */
+static void clear(mem_node_t *dir)
+{
+	mem_entry_t *e;
+
+	while ((e = dir->entries) != NULL) {
+		if (S_ISDIR(e->node->mode))
+			clear(e->node);
+		entry_del(dir, e);
+	}
+}
+
+static void fill_stat(const mem_node_t *node, struct stat *st)
+{
+	memset(st, 0, sizeof(struct stat));
+	st->st_ino = node->ino;
+	st->st_mode = node->mode;
+	st->st_nlink = node->nlink;
+	st->st_uid = getuid();
+	st->st_gid = getgid();
+	st->st_size = node->size;
+	st->st_blksize = 4096;
+	st->st_blocks = (node->alloc + 511) / 512;
+	st->st_atim = node->mtime;
+	st->st_mtim = node->mtime;
+	st->st_ctim = node->mtime;
+}
+
+/* copy a folder of the file system into a folder node */
+static void load(mem_node_t *dir, const char *path)
+{
+	struct dirent *dirp;
+	struct stat st;
+	mem_node_t *node;
+	char *sub;
+	DIR *dp;
+	ssize_t n;
+	int fd;
+
+	dp = opendir(path);
+	if (!dp) {
+		perror(path);
+		return;
+	}
+	while ((dirp = readdir(dp)) != NULL) {
+		if (!strcmp(dirp->d_name, ".") || !strcmp(dirp->d_name, ".."))
+			continue;
+		sub = malloc(strlen(path) + strlen(dirp->d_name) + 2);
+		if (!sub)
+			break;
+		sprintf(sub, "%s/%s", path, dirp->d_name);
+
+		node = NULL;
+		if (lstat(sub, &st) < 0) {
+			perror(sub);
+		} else if (S_ISDIR(st.st_mode)) {
+			node = node_new(S_IFDIR | (st.st_mode & 07777));
+			if (node && entry_add(dir, dirp->d_name, node) == 0)
+				load(node, sub);
+		} else if (S_ISREG(st.st_mode)) {
+			node = node_new(S_IFREG | (st.st_mode & 07777));
+			fd = open(sub, O_RDONLY);
+			if (node && fd >= 0) {
+				node->alloc = st.st_size;
+				node->data = malloc(node->alloc ? node->alloc : 1);
+				while (node->data && node->size < node->alloc &&
+				       (n = read(fd, node->data + node->size, node->alloc - node->size)) > 0)
+					node->size += n;
+			}
+			if (fd < 0 || !node || !node->data) {
+				perror(sub);
+			} else if (entry_add(dir, dirp->d_name, node) < 0) {
+				perror(sub);
+			}
+			if (fd >= 0)
+				close(fd);
+		}
+		/* symbolic links and special files are left out */
+
+		if (node && node->nlink == 0)
+			node_put(node);
+		else if (node)
+			node->mtime = st.st_mtim;
+		free(sub);
+	}
+	closedir(dp);
+	if (stat(path, &st) == 0)
+		dir->mtime = st.st_mtim;
+}
+
+static int mem_root(const char *path)
+{
+	mem_node_t *root;
+	struct stat st;
+
+	if (stat(path, &st) < 0)
+		return -1;
+	if (!S_ISDIR(st.st_mode)) {
+		errno = ENOTDIR;
+		return -1;
+	}
+	root = node_new(S_IFDIR | (st.st_mode & 07777));
+	if (!root)
+		return -1;
+	root->parent = root;
+	root->nlink = 1; /* never freed */
+	load(root, path);
+	return handle_new(root);
+}
+
+static int mem_dup(int fd)
+{
+	mem_node_t *node = get(fd);
+
+	return node ? handle_new(node) : -1;
+}
+
+static int mem_close(int fd)
+{
+	mem_node_t *node = get(fd);
+
+	if (!node)
+		return -1;
+	handles[fd] = NULL;
+	node->refs--;
+	if (node->parent == node && node->refs == 0) {
+		/* the last handle on the root, files still open stay */
+		clear(node);
+		node->nlink = 0;
+	}
+	node_put(node);
+	return 0;
+}
+
+static int mem_open(int dirfd, const char *name, int flags, mode_t mode)
+{
+	mem_node_t *dir, *node;
+
+	dir = get_dir(dirfd);
+	if (!dir)
+		return -1;
+	node = resolve(dir, name);
+	if (node && (flags & O_CREAT) && (flags & O_EXCL)) {
+		errno = EEXIST;
+		return -1;
+	}
+	if (!node) {
+		if (!(flags & O_CREAT))
+			return -1;
+		node = node_new(S_IFREG | (mode & 07777));
+		if (!node)
+			return -1;
+		if (entry_add(dir, name, node) < 0) {
+			node_put(node);
+			return -1;
+		}
+	}
+	if ((flags & O_DIRECTORY) && !S_ISDIR(node->mode)) {
+		errno = ENOTDIR;
+		return -1;
+	}
+	if (S_ISDIR(node->mode) && (flags & O_ACCMODE) != O_RDONLY) {
+		errno = EISDIR;
+		return -1;
+	}
+	return handle_new(node);
+}
+
+static int mem_tmpfile(int dirfd, mode_t mode)
+{
+	mem_node_t *node;
+	int fd;
+
+	if (!get_dir(dirfd))
+		return -1;
+	node = node_new(S_IFREG | (mode & 07777));
+	if (!node)
+		return -1;
+	fd = handle_new(node);
+	if (fd < 0)
+		node_put(node);
+	return fd;
+}
+
+static int mem_publish(int fd, int dirfd, const char *name)
+{
+	mem_node_t *node, *dir;
+
+	node = get(fd);
+	dir = get_dir(dirfd);
+	if (!node || !dir)
+		return -1;
+	if (S_ISDIR(node->mode)) {
+		errno = EISDIR;
+		return -1;
+	}
+	if (lookup(dir, name) || !strcmp(name, ".") || !strcmp(name, "..")) {
+		errno = EEXIST;
+		return -1;
+	}
+	return entry_add(dir, name, node);
+}
+
+static int mem_link(int olddirfd, const char *oldname, int newdirfd, const char *newname)
+{
+	mem_node_t *olddir, *newdir;
+	mem_entry_t *e;
+
+	olddir = get_dir(olddirfd);
+	newdir = get_dir(newdirfd);
+	if (!olddir || !newdir)
+		return -1;
+	e = lookup(olddir, oldname);
+	if (!e) {
+		errno = ENOENT;
+		return -1;
+	}
+	if (S_ISDIR(e->node->mode)) {
+		errno = EPERM;
+		return -1;
+	}
+	if (lookup(newdir, newname) || !strcmp(newname, ".") || !strcmp(newname, "..")) {
+		errno = EEXIST;
+		return -1;
+	}
+	return entry_add(newdir, newname, e->node);
+}
+
+static int mem_rename(int olddirfd, const char *oldname, int newdirfd, const char *newname, int noreplace)
+{
+	mem_node_t *olddir, *newdir, *node, *p;
+	mem_entry_t *e, *target;
+
+	olddir = get_dir(olddirfd);
+	newdir = get_dir(newdirfd);
+	if (!olddir || !newdir)
+		return -1;
+	e = lookup(olddir, oldname);
+	if (!e) {
+		errno = ENOENT;
+		return -1;
+	}
+	node = e->node;
+	target = lookup(newdir, newname);
+	if (target && noreplace) {
+		errno = EEXIST;
+		return -1;
+	}
+	if (target && target->node == node)
+		return 0;
+	if (target && S_ISDIR(node->mode) && !S_ISDIR(target->node->mode)) {
+		errno = ENOTDIR;
+		return -1;
+	}
+	if (target && !S_ISDIR(node->mode) && S_ISDIR(target->node->mode)) {
+		errno = EISDIR;
+		return -1;
+	}
+	if (target && target->node->entries) {
+		errno = ENOTEMPTY;
+		return -1;
+	}
+	if (S_ISDIR(node->mode)) {
+		/* not into itself */
+		for (p = newdir; ; p = p->parent) {
+			if (p == node) {
+				errno = EINVAL;
+				return -1;
+			}
+			if (p->parent == p)
+				break;
+		}
+	}
+
+	if (target)
+		entry_del(newdir, target);
+	if (entry_add(newdir, newname, node) < 0)
+		return -1;
+	entry_del(olddir, e);
+	return 0;
+}
+
+static int mem_remove(int dirfd, const char *name, int isdir)
+{
+	mem_node_t *dir;
+	mem_entry_t *e;
+
+	dir = get_dir(dirfd);
+	if (!dir)
+		return -1;
+	e = lookup(dir, name);
+	if (!e) {
+		errno = ENOENT;
+		return -1;
+	}
+	if (isdir && !S_ISDIR(e->node->mode)) {
+		errno = ENOTDIR;
+		return -1;
+	}
+	if (!isdir && S_ISDIR(e->node->mode)) {
+		errno = EISDIR;
+		return -1;
+	}
+	if (e->node->entries) {
+		errno = ENOTEMPTY;
+		return -1;
+	}
+	entry_del(dir, e);
+	return 0;
+}
+
+static int mem_mkdir(int dirfd, const char *name, mode_t mode)
+{
+	mem_node_t *dir, *node;
+
+	dir = get_dir(dirfd);
+	if (!dir)
+		return -1;
+	if (lookup(dir, name) || !strcmp(name, ".") || !strcmp(name, "..")) {
+		errno = EEXIST;
+		return -1;
+	}
+	node = node_new(S_IFDIR | (mode & 07777));
+	if (!node)
+		return -1;
+	if (entry_add(dir, name, node) < 0) {
+		node_put(node);
+		return -1;
+	}
+	return 0;
+}
+
+static int mem_chmod(int dirfd, const char *name, mode_t mode)
+{
+	mem_node_t *dir, *node;
+
+	dir = get_dir(dirfd);
+	if (!dir)
+		return -1;
+	node = resolve(dir, name);
+	if (!node)
+		return -1;
+	node->mode = (node->mode & S_IFMT) | (mode & ~S_IFMT);
+	return 0;
+}
+
+static int mem_stat(int dirfd, const char *name, struct stat *st)
+{
+	mem_node_t *dir, *node;
+
+	dir = get_dir(dirfd);
+	if (!dir)
+		return -1;
+	node = resolve(dir, name);
+	if (!node)
+		return -1;
+	fill_stat(node, st);
+	return 0;
+}
+
+static int mem_fstat(int fd, struct stat *st)
+{
+	mem_node_t *node = get(fd);
+
+	if (!node)
+		return -1;
+	fill_stat(node, st);
+	return 0;
+}
+
+static int mem_list(int dirfd, store_list_cb_t cb, void *data)
+{
+	mem_node_t *dir;
+	mem_entry_t *e;
+
+	dir = get_dir(dirfd);
+	if (!dir)
+		return -1;
+	for (e = dir->entries; e; e = e->next)
+		if (cb(e->name, data))
+			break;
+	return 0;
+}
+
+static ssize_t mem_pread(int fd, void *buf, size_t len, off_t offset)
+{
+	mem_node_t *node = get(fd);
+
+	if (!node)
+		return -1;
+	if (S_ISDIR(node->mode)) {
+		errno = EISDIR;
+		return -1;
+	}
+	if (offset < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ((size_t) offset >= node->size)
+		return 0;
+	if (len > node->size - offset)
+		len = node->size - offset;
+	memcpy(buf, node->data + offset, len);
+	return len;
+}
+
+/* make room for len bytes, the size stays */
+static int grow(mem_node_t *node, size_t len)
+{
+	uint8_t *tmp;
+	size_t alloc;
+
+	if (len <= node->alloc)
+		return 0;
+	alloc = node->alloc * 2 > len ? node->alloc * 2 : len;
+	tmp = realloc(node->data, alloc);
+	if (!tmp) {
+		errno = ENOSPC;
+		return -1;
+	}
+	node->data = tmp;
+	node->alloc = alloc;
+	return 0;
+}
+
+static ssize_t mem_pwrite(int fd, const void *buf, size_t len, off_t offset)
+{
+	mem_node_t *node = get(fd);
+
+	if (!node)
+		return -1;
+	if (S_ISDIR(node->mode)) {
+		errno = EISDIR;
+		return -1;
+	}
+	if (offset < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (grow(node, offset + len) < 0)
+		return -1;
+	if ((size_t) offset > node->size)
+		memset(node->data + node->size, 0, offset - node->size);
+	memcpy(node->data + offset, buf, len);
+	if ((size_t) offset + len > node->size)
+		node->size = offset + len;
+	touch(node);
+	return len;
+}
+
+static int mem_reserve(int fd, off_t len)
+{
+	mem_node_t *node = get(fd);
+
+	if (!node)
+		return -1;
+	if (S_ISDIR(node->mode)) {
+		errno = EISDIR;
+		return -1;
+	}
+	/* exactly what was announced, not the doubling of grow() */
+	if ((size_t) len > node->alloc) {
+		uint8_t *tmp = realloc(node->data, len);
+		if (!tmp) {
+			errno = ENOSPC;
+			return -1;
+		}
+		node->data = tmp;
+		node->alloc = len;
+	}
+	return 0;
+}
+
+static int mem_copy(int infd, int outfd, off_t len)
+{
+	mem_node_t *node = get(infd);
+
+	if (!node)
+		return -1;
+	if (S_ISDIR(node->mode)) {
+		errno = EISDIR;
+		return -1;
+	}
+	if ((size_t) len > node->size)
+		len = node->size;
+	return mem_pwrite(outfd, node->data, len, 0) < 0 ? -1 : 0;
+}
+
+static int mem_sync(int fd, int data_only)
+{
+	(void) data_only;
+	return get(fd) ? 0 : -1;
+}
+
+/* the files live in RAM, so that is the space */
+static int mem_space(int fd, uint64_t *avail, uint64_t *total)
+{
+	long page = sysconf(_SC_PAGESIZE);
+
+	if (!get(fd))
+		return -1;
+	if (avail)
+		*avail = (uint64_t) sysconf(_SC_AVPHYS_PAGES) * page;
+	if (total)
+		*total = (uint64_t) sysconf(_SC_PHYS_PAGES) * page;
+	return 0;
+}
+
+const store_ops_t store_memory = {
+	"memory",
+	0,
+	mem_root,
+	mem_dup,
+	mem_close,
+	mem_open,
+	mem_tmpfile,
+	mem_publish,
+	mem_link,
+	mem_rename,
+	mem_remove,
+	mem_mkdir,
+	mem_chmod,
+	mem_stat,
+	mem_fstat,
+	mem_list,
+	mem_pread,
+	mem_pwrite,
+	mem_reserve,
+	mem_copy,
+	mem_sync,
+	mem_space,
+};
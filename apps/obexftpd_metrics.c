@@ -0,0 +1,224 @@
+/**
+	\file apps/obexftpd_metrics.c
+	Counters and histograms of the OBEX file server.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2003-2006 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "obexftpd_metrics.h"
+
+/* see OBEX_RSP_SUCCESS */
+#define RSP_SUCCESS	0x20
+
+metrics_t metrics;
+
+static long long since_us = 0; /* see metrics_init() */
+
+/* by opcode, unused ones are not shown */
+static const char *opcode_names[METRICS_OPCODES] = {
+	"connect", "disconnect", "put", "get", NULL, "setpath", "action", "session",
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, "abort"
+};
+
+/* by OBEX_TRANS_* */
+static const char *transport_names[METRICS_TRANSPORTS] = {
+	NULL, "irda", "inet", "custom", "bluetooth", "fd", "usb", NULL
+};
+
+
+long long metrics_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void hist_add(hist_t *h, uint64_t value)
+{
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS - 1 && value >> (i + 1); i++);
+	h->bucket[i]++;
+	h->count++;
+	h->sum += value;
+	if (value > h->max)
+		h->max = value;
+}
+
+/* upper bound of the bucket holding the q-th part of all values, at most the max */
+static uint64_t hist_quantile(const hist_t *h, double q)
+{
+	uint64_t seen = 0, want;
+	int i;
+
+	want = (uint64_t)(h->count * q);
+	if (want == 0)
+		want = 1;
+	for (i = 0; i < HIST_BUCKETS - 1; i++) {
+		seen += h->bucket[i];
+		if (seen >= want)
+			break;
+	}
+	if (i == HIST_BUCKETS - 1 || ((uint64_t)1 << (i + 1)) - 1 > h->max)
+		return h->max;
+	return ((uint64_t)1 << (i + 1)) - 1;
+}
+
+static int opcode_index(int opcode)
+{
+	opcode &= 0x7f; /* without the final bit */
+	return opcode < METRICS_OPCODES ? opcode : METRICS_OPCODES - 1;
+}
+
+/* start counting, for the uptime */
+void metrics_init(void)
+{
+	memset(&metrics, 0, sizeof(metrics));
+	since_us = metrics_now_us();
+}
+
+void metrics_request(int opcode)
+{
+	metrics.requests[opcode_index(opcode)]++;
+}
+
+/*
+ * Function metrics_response()
+ *
+ *    Count the outcome of a request and how long it took since
+ *    start_us, 0 if the start was never seen.
+ *
+ */
+void metrics_response(int opcode, int rsp, long long start_us)
+{
+	int i = opcode_index(opcode);
+
+	if ((rsp & 0x7f) != RSP_SUCCESS)
+		metrics.failures[i]++;
+	if (start_us > 0)
+		hist_add(&metrics.latency[i], metrics_now_us() - start_us);
+}
+
+void metrics_link_error(int transport)
+{
+	if (transport < 0 || transport >= METRICS_TRANSPORTS)
+		transport = 0;
+	metrics.link_errors[transport]++;
+}
+
+static void dump_ratio(FILE *f, const char *name, uint64_t hits, uint64_t misses)
+{
+	fprintf(f, "%s.hits %llu\n", name, (unsigned long long)hits);
+	fprintf(f, "%s.misses %llu\n", name, (unsigned long long)misses);
+	if (hits + misses)
+		fprintf(f, "%s.hit_rate %.3f\n", name, (double)hits / (hits + misses));
+}
+
+/*
+ * Function metrics_dump()
+ *
+ *    Print all counters as "name value" lines, easy to grep and diff.
+ *    Rows that never counted anything are left out.
+ *
+ */
+void metrics_dump(FILE *f, int sessions)
+{
+	const hist_t *h;
+	int i, j;
+
+	fprintf(f, "uptime_s %lld\n", since_us ? (metrics_now_us() - since_us) / 1000000 : 0);
+	fprintf(f, "sessions.active %d\n", sessions);
+	fprintf(f, "sessions.total %llu\n", (unsigned long long)metrics.sessions);
+	fprintf(f, "sessions.refused %llu\n", (unsigned long long)metrics.sessions_refused);
+	fprintf(f, "bytes.in %llu\n", (unsigned long long)metrics.bytes_in);
+	fprintf(f, "bytes.out %llu\n", (unsigned long long)metrics.bytes_out);
+	fprintf(f, "aborts %llu\n", (unsigned long long)metrics.aborts);
+
+	for (i = 0; i < METRICS_OPCODES; i++) {
+		if (!opcode_names[i] || !metrics.requests[i])
+			continue;
+		fprintf(f, "requests.%s %llu\n", opcode_names[i], (unsigned long long)metrics.requests[i]);
+		fprintf(f, "failures.%s %llu\n", opcode_names[i], (unsigned long long)metrics.failures[i]);
+		h = &metrics.latency[i];
+		if (!h->count)
+			continue;
+		fprintf(f, "latency_us.%s count=%llu mean=%llu p50=%llu p90=%llu p99=%llu max=%llu\n",
+			opcode_names[i], (unsigned long long)h->count,
+			(unsigned long long)(h->sum / h->count),
+			(unsigned long long)hist_quantile(h, 0.5),
+			(unsigned long long)hist_quantile(h, 0.9),
+			(unsigned long long)hist_quantile(h, 0.99),
+			(unsigned long long)h->max);
+		fprintf(f, "latency_us.%s.buckets", opcode_names[i]);
+		for (j = 0; j < HIST_BUCKETS; j++)
+			fprintf(f, " %llu", (unsigned long long)h->bucket[j]);
+		fprintf(f, "\n");
+	}
+
+	dump_ratio(f, "listing_cache", metrics.listing_hits, metrics.listing_misses);
+	dump_ratio(f, "content_cache", metrics.content_hits, metrics.content_misses);
+	dump_ratio(f, "capability_cache", metrics.capability_hits, metrics.capability_misses);
+
+	for (i = 0; i < METRICS_TRANSPORTS; i++) {
+		if (!metrics.link_errors[i])
+			continue;
+		fprintf(f, "link_errors.%s %llu\n", transport_names[i] ? transport_names[i] : "other",
+			(unsigned long long)metrics.link_errors[i]);
+	}
+}
+
+/*
+ * Function metrics_write()
+ *
+ *    Replace a status file with a fresh dump. Readers never see
+ *    a half written file.
+ *
+ */
+int metrics_write(const char *path, int sessions)
+{
+	char *tmp;
+	FILE *f;
+	int ret = 0;
+
+	tmp = malloc(strlen(path) + 5);
+	if (!tmp)
+		return -ENOMEM;
+	strcpy(tmp, path);
+	strcat(tmp, ".tmp");
+
+	f = fopen(tmp, "w");
+	if (!f) {
+		ret = -errno;
+		free(tmp);
+		return ret;
+	}
+	metrics_dump(f, sessions);
+	if (fclose(f) != 0 || rename(tmp, path) < 0) {
+		ret = -errno;
+		(void) unlink(tmp);
+	}
+	free(tmp);
+	return ret;
+}
@@ -0,0 +1,88 @@
+/**
+	\file apps/obexftpd_metrics.h
+	Counters and histograms of the OBEX file server.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2003-2006 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+#ifndef OBEXFTPD_METRICS_H
+#define OBEXFTPD_METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* power of two buckets, the last one takes everything above */
+#define HIST_BUCKETS	24
+
+/* request opcodes without the final bit, ABORT shares the last slot */
+#define METRICS_OPCODES	16
+/* OBEX_TRANS_* */
+#define METRICS_TRANSPORTS	8
+
+typedef struct hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t bucket[HIST_BUCKETS];	/* values below 2^(i+1) */
+} hist_t;
+
+/* all counters are updated on the loop thread only */
+typedef struct metrics {
+	uint64_t sessions;		/* accepted */
+	uint64_t sessions_refused;	/* over the session limit */
+	uint64_t requests[METRICS_OPCODES];
+	uint64_t failures[METRICS_OPCODES];	/* not answered with SUCCESS */
+	uint64_t aborts;
+	hist_t latency[METRICS_OPCODES];	/* us from the first packet to the last */
+	uint64_t bytes_in;		/* body bytes */
+	uint64_t bytes_out;
+	uint64_t listing_hits;
+	uint64_t listing_misses;
+	uint64_t content_hits;
+	uint64_t content_misses;
+	uint64_t capability_hits;
+	uint64_t capability_misses;
+	uint64_t link_errors[METRICS_TRANSPORTS];
+} metrics_t;
+
+extern metrics_t metrics;
+
+long long metrics_now_us(void);
+
+void metrics_init(void);
+
+void hist_add(hist_t *h, uint64_t value);
+
+void metrics_request(int opcode);
+
+void metrics_response(int opcode, int rsp, long long start_us);
+
+void metrics_link_error(int transport);
+
+void metrics_dump(FILE *f, int sessions);
+
+int metrics_write(const char *path, int sessions);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OBEXFTPD_METRICS_H */
@@ -0,0 +1,175 @@
+/**
+	\file apps/obexftpd_pool.c
+	Worker threads for the OBEX file server.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2003-2006 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "obexftpd_pool.h"
+
+#define POOL_MAX_THREADS	16
+/* indices taken at once, keeps the lock out of the way */
+#define POOL_CHUNK		16
+
+#ifdef HAVE_PTHREAD
+static pthread_t pool_threads[POOL_MAX_THREADS];
+static int thread_count = 0;
+static int shutdown_pool = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+/* the running batch */
+static pool_fn_t batch_fn = NULL;
+static void *batch_data = NULL;
+static int batch_count = 0;
+static int batch_next = 0;
+static int batch_done = 0;
+
+
+/* run a chunk of the batch, called and returns with the lock held */
+static void run_chunk(void)
+{
+	pool_fn_t fn = batch_fn;
+	void *data = batch_data;
+	int first, last, i;
+
+	first = batch_next;
+	last = first + POOL_CHUNK;
+	if (last > batch_count)
+		last = batch_count;
+	batch_next = last;
+
+	pthread_mutex_unlock(&lock);
+	for (i = first; i < last; i++)
+		fn(i, data);
+	pthread_mutex_lock(&lock);
+
+	batch_done += last - first;
+	if (batch_done == batch_count)
+		pthread_cond_broadcast(&done_cond);
+}
+
+static void *worker(void *arg)
+{
+	(void) arg;
+
+	pthread_mutex_lock(&lock);
+	while (!shutdown_pool) {
+		if (batch_next < batch_count)
+			run_chunk();
+		else
+			pthread_cond_wait(&work_cond, &lock);
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+#endif
+
+/**
+	Start the worker threads.
+
+	\param threads number of threads, 0 to run every batch serially
+
+	\return the number of threads running
+ */
+int pool_init(int threads)
+{
+#ifdef HAVE_PTHREAD
+	if (threads > POOL_MAX_THREADS)
+		threads = POOL_MAX_THREADS;
+	shutdown_pool = 0;
+	while (thread_count < threads) {
+		if (pthread_create(&pool_threads[thread_count], NULL, worker, NULL))
+			break;
+		thread_count++;
+	}
+	return thread_count;
+#else
+	(void) threads;
+	return 0;
+#endif
+}
+
+/**
+	Stop the worker threads.
+ */
+void pool_cleanup(void)
+{
+#ifdef HAVE_PTHREAD
+	int i;
+
+	pthread_mutex_lock(&lock);
+	shutdown_pool = 1;
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&lock);
+
+	for (i = 0; i < thread_count; i++)
+		pthread_join(pool_threads[i], NULL);
+	thread_count = 0;
+#endif
+}
+
+/**
+	Call a function for each index of a batch and wait for all calls.
+	The calls run in parallel on the workers and the calling thread.
+	\a fn must be safe to run in parallel and must not call pool_run().
+
+	\param count the indices run from 0 to \a count - 1
+	\param fn called for each index
+	\param data passed to \a fn
+ */
+void pool_run(int count, pool_fn_t fn, void *data)
+{
+	int i;
+
+#ifdef HAVE_PTHREAD
+	if (thread_count > 0 && count > POOL_CHUNK) {
+		pthread_mutex_lock(&lock);
+		batch_fn = fn;
+		batch_data = data;
+		batch_count = count;
+		batch_next = 0;
+		batch_done = 0;
+		pthread_cond_broadcast(&work_cond);
+
+		/* help out, then wait for the chunks still running */
+		while (batch_next < batch_count)
+			run_chunk();
+		while (batch_done < batch_count)
+			pthread_cond_wait(&done_cond, &lock);
+
+		batch_count = batch_next = batch_done = 0;
+		batch_fn = NULL;
+		batch_data = NULL;
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+#endif
+
+	for (i = 0; i < count; i++)
+		fn(i, data);
+}
@@ -0,0 +1,42 @@
+/**
+	\file apps/obexftpd_pool.h
+	Worker threads for the OBEX file server.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2003-2006 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+#ifndef OBEXFTPD_POOL_H
+#define OBEXFTPD_POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* called once for each index of a batch */
+typedef void (*pool_fn_t) (int index, void *data);
+
+int pool_init(int threads);
+
+void pool_cleanup(void);
+
+void pool_run(int count, pool_fn_t fn, void *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OBEXFTPD_POOL_H */
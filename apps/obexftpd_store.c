@@ -0,0 +1,232 @@
+/**
+	\file apps/obexftpd_store.c
+	File system storage backend for the OBEX file server.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2003-2006 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+/* for
+ * - O_TMPFILE, fallocate(), copy_file_range(), renameat2()
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/statvfs.h>
+
+#include "obexftpd_store.h"
+
+static int posix_root(const char *path)
+{
+	return open(path, O_RDONLY | O_DIRECTORY);
+}
+
+static int posix_open(int dirfd, const char *name, int flags, mode_t mode)
+{
+	return openat(dirfd, name, flags | O_NOFOLLOW, mode);
+}
+
+static int posix_tmpfile(int dirfd, mode_t mode)
+{
+#ifdef O_TMPFILE
+	return openat(dirfd, ".", O_TMPFILE | O_WRONLY, mode);
+#else
+	errno = EOPNOTSUPP;
+	return -1;
+#endif
+}
+
+static int posix_publish(int fd, int dirfd, const char *name)
+{
+	char proc[32];
+
+	/* an O_TMPFILE file only has a name in /proc */
+	snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+	return linkat(AT_FDCWD, proc, dirfd, name, AT_SYMLINK_FOLLOW);
+}
+
+static int posix_link(int olddirfd, const char *oldname, int newdirfd, const char *newname)
+{
+	return linkat(olddirfd, oldname, newdirfd, newname, 0);
+}
+
+static int posix_rename(int olddirfd, const char *oldname, int newdirfd, const char *newname, int noreplace)
+{
+	struct stat st;
+
+	if (!noreplace)
+		return renameat(olddirfd, oldname, newdirfd, newname);
+#ifdef RENAME_NOREPLACE
+	if (renameat2(olddirfd, oldname, newdirfd, newname, RENAME_NOREPLACE) == 0)
+		return 0;
+	if (errno != ENOSYS && errno != EINVAL)
+		return -1;
+	/* an old kernel or a file system without the flag */
+#endif
+	if (fstatat(olddirfd, oldname, &st, AT_SYMLINK_NOFOLLOW) < 0)
+		return -1;
+	if (!S_ISDIR(st.st_mode)) {
+		/* the link takes the new name only if it is free */
+		if (linkat(olddirfd, oldname, newdirfd, newname, 0) < 0)
+			return -1;
+		if (unlinkat(olddirfd, oldname, 0) < 0) {
+			(void) unlinkat(newdirfd, newname, 0);
+			return -1;
+		}
+		return 0;
+	}
+	/* folders can't be linked, an empty one holds the name instead */
+	if (mkdirat(newdirfd, newname, 0700) < 0)
+		return -1;
+	if (renameat(olddirfd, oldname, newdirfd, newname) < 0) {
+		(void) unlinkat(newdirfd, newname, AT_REMOVEDIR);
+		return -1;
+	}
+	return 0;
+}
+
+static int posix_remove(int dirfd, const char *name, int dir)
+{
+	return unlinkat(dirfd, name, dir ? AT_REMOVEDIR : 0);
+}
+
+static int posix_chmod(int dirfd, const char *name, mode_t mode)
+{
+	return fchmodat(dirfd, name, mode, 0);
+}
+
+static int posix_stat(int dirfd, const char *name, struct stat *st)
+{
+	return fstatat(dirfd, name, st, AT_SYMLINK_NOFOLLOW);
+}
+
+static int posix_list(int dirfd, store_list_cb_t cb, void *data)
+{
+	struct dirent *dirp;
+	DIR *dp;
+	int fd;
+
+	/* the stream owns its own fd, keep the callers one */
+	fd = dup(dirfd);
+	if (fd < 0)
+		return -1;
+	dp = fdopendir(fd);
+	if (dp == NULL) {
+		close(fd);
+		return -1;
+	}
+	rewinddir(dp); /* the offset is shared with dirfd */
+	while ((dirp = readdir(dp)) != NULL) {
+		if (!strcmp(dirp->d_name, ".") || !strcmp(dirp->d_name, ".."))
+			continue;
+		if (cb(dirp->d_name, data))
+			break;
+	}
+	closedir(dp);
+	return 0;
+}
+
+static int posix_reserve(int fd, off_t len)
+{
+#ifdef FALLOC_FL_KEEP_SIZE
+	/* a short body leaves no holes, the size follows the writes */
+	return fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, len);
+#else
+	errno = EOPNOTSUPP;
+	return -1;
+#endif
+}
+
+static int posix_copy(int infd, int outfd, off_t len)
+{
+	char buf[64 * 1024];
+	off_t offset = 0;
+	ssize_t n = 0;
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+	/* within the kernel, a reflink on file systems that share extents */
+	loff_t inoff = 0, outoff = 0;
+
+	while (inoff < len) {
+		n = copy_file_range(infd, &inoff, outfd, &outoff, len - inoff, 0);
+		if (n <= 0)
+			break;
+	}
+	if (n < 0 && errno != ENOSYS && errno != EXDEV && errno != EINVAL)
+		return -1;
+	offset = inoff;
+	if (n == 0 || offset == len)
+		return 0;
+#endif
+	while (offset < len) {
+		n = pread(infd, buf, len - offset < (off_t) sizeof(buf) ? (size_t) (len - offset) : sizeof(buf), offset);
+		if (n <= 0)
+			return n;
+		if (pwrite(outfd, buf, n, offset) != n)
+			return -1;
+		offset += n;
+	}
+	return 0;
+}
+
+static int posix_sync(int fd, int data_only)
+{
+	return data_only ? fdatasync(fd) : fsync(fd);
+}
+
+static int posix_space(int fd, uint64_t *avail, uint64_t *total)
+{
+	struct statvfs st;
+
+	if (fstatvfs(fd, &st) < 0)
+		return -1;
+	if (avail)
+		*avail = (uint64_t) st.f_bavail * st.f_frsize;
+	if (total)
+		*total = (uint64_t) st.f_blocks * st.f_frsize;
+	return 0;
+}
+
+const store_ops_t store_posix = {
+	"file system",
+	1,
+	posix_root,
+	dup,
+	close,
+	posix_open,
+	posix_tmpfile,
+	posix_publish,
+	posix_link,
+	posix_rename,
+	posix_remove,
+	mkdirat,
+	posix_chmod,
+	posix_stat,
+	fstat,
+	posix_list,
+	pread,
+	pwrite,
+	posix_reserve,
+	posix_copy,
+	posix_sync,
+	posix_space,
+};
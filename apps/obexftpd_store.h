@@ -0,0 +1,79 @@
+/**
+	\file apps/obexftpd_store.h
+	Storage backends for the OBEX file server.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2003-2006 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+#ifndef OBEXFTPD_STORE_H
+#define OBEXFTPD_STORE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* called for each entry of a folder except . and .., non-zero stops */
+typedef int (*store_list_cb_t) (const char *name, void *data);
+
+/* Files and folders are int handles, names are relative to a folder
+   handle. Like the system calls the functions return -1 and set errno
+   on failure. Open flags are O_RDONLY, O_WRONLY, O_CREAT, O_EXCL,
+   O_DIRECTORY and O_NOFOLLOW, symbolic links are never followed. */
+typedef struct store_ops {
+	const char *name;
+	int fds;	/* handles are file descriptors */
+
+	int (*root) (const char *path);
+	int (*dup) (int fd);
+	int (*close) (int fd);
+	int (*open) (int dirfd, const char *name, int flags, mode_t mode);
+	int (*tmpfile) (int dirfd, mode_t mode);
+	int (*publish) (int fd, int dirfd, const char *name);
+	int (*link) (int olddirfd, const char *oldname, int newdirfd, const char *newname);
+	/* with noreplace set an existing newname fails with EEXIST, atomically */
+	int (*rename) (int olddirfd, const char *oldname, int newdirfd, const char *newname, int noreplace);
+	int (*remove) (int dirfd, const char *name, int dir);
+	int (*mkdir) (int dirfd, const char *name, mode_t mode);
+	int (*chmod) (int dirfd, const char *name, mode_t mode);
+	int (*stat) (int dirfd, const char *name, struct stat *st);
+	int (*fstat) (int fd, struct stat *st);
+	int (*list) (int dirfd, store_list_cb_t cb, void *data);
+	ssize_t (*pread) (int fd, void *buf, size_t len, off_t offset);
+	ssize_t (*pwrite) (int fd, const void *buf, size_t len, off_t offset);
+	int (*reserve) (int fd, off_t len);
+	/* the first len bytes of infd to the start of outfd */
+	int (*copy) (int infd, int outfd, off_t len);
+	int (*sync) (int fd, int data_only);
+	/* bytes free for new files and the size of the store holding fd */
+	int (*space) (int fd, uint64_t *avail, uint64_t *total);
+} store_ops_t;
+
+/* the file system below a folder */
+extern const store_ops_t store_posix;
+
+/* a copy of a folder in memory, changes are not written back */
+extern const store_ops_t store_memory;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OBEXFTPD_STORE_H */
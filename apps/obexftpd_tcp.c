@@ -0,0 +1,298 @@
+/**
+	\file apps/obexftpd_tcp.c
+	TCP transport with zero-copy bodies for the OBEX file server.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2003-2006 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+/* The packets OpenOBEX hands to tcp_write() carry the body bytes of
+   a file GET, but the server only gave it placeholders for them. The
+   packet header goes out with send() and the real body bytes follow
+   with sendfile() straight from the page cache. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
+#include <openobex/obex.h>
+
+#include "obexftpd_tcp.h"
+
+#include <common.h>
+
+#ifndef MSG_MORE
+#define MSG_MORE	0
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL	0
+#endif
+
+#define HDR_BODY	0x48
+#define HDR_BODY_END	0x49
+
+/**
+	Open a listening socket.
+
+	\return the socket or -1 on error
+ */
+int tcp_listen(const struct sockaddr *addr, socklen_t addrlen)
+{
+	int fd, one = 1;
+
+	fd = socket(addr->sa_family, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	(void) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(fd, addr, addrlen) < 0 || listen(fd, 8) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* send all of a buffer */
+static int send_all(int sock, const uint8_t *buf, size_t len, int flags)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = send(sock, buf, len, flags | MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* send body bytes from the file, the placeholders in buf if it fails */
+static int send_body(tcp_conn_t *c, const uint8_t *buf, size_t len, int more)
+{
+	uint8_t tmp[4096];
+	ssize_t n;
+
+	while (len > 0) {
+#ifdef HAVE_SYS_SENDFILE_H
+		n = sendfile(c->sock, c->body_fd, &c->body_offset, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n > 0) {
+			buf += n;
+			len -= n;
+			continue;
+		}
+		if (n < 0 && errno != EINVAL && errno != ENOSYS)
+			return -1;
+#endif
+		/* no sendfile() for this file, copy it */
+		n = pread(c->body_fd, tmp, len < sizeof(tmp) ? len : sizeof(tmp), c->body_offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			/* the file shrank, the packet still needs its bytes */
+			fprintf(stderr, "body file ended early at %lld\n", (long long)c->body_offset);
+			return send_all(c->sock, buf, len, more ? MSG_MORE : 0);
+		}
+		if (send_all(c->sock, tmp, n, (more || (size_t)n < len) ? MSG_MORE : 0) < 0)
+			return -1;
+		c->body_offset += n;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+ * Function tcp_write()
+ *
+ *    Called from OBEX-lib with a whole packet. Without a body file it
+ *    is sent as it is. Otherwise BODY and END-OF-BODY header data is
+ *    taken from the file instead.
+ *
+ */
+static int tcp_write(obex_t *UNUSED(handle), void *data, uint8_t *buf, int buflen)
+{
+	tcp_conn_t *c = data;
+	int pos, start = 0, hlen;
+	uint8_t hi;
+
+	/* zero-copy bodies are recorded with their placeholders */
+	cobex_capture_data(c->capture, COBEX_CAPTURE_OUT, buf, buflen);
+	if (c->body_fd < 0 || buflen < 3)
+		return send_all(c->sock, buf, buflen, 0) < 0 ? -1 : buflen;
+
+	/* opcode or response code and length, then the headers */
+	for (pos = 3; pos < buflen; pos += hlen) {
+		hi = buf[pos];
+		switch (hi & 0xc0) {
+		case 0x00: /* unicode text */
+		case 0x40: /* byte sequence */
+			hlen = pos + 3 > buflen ? 0 : buf[pos + 1] << 8 | buf[pos + 2];
+			break;
+		case 0x80: /* one byte */
+			hlen = 2;
+			break;
+		default: /* four bytes */
+			hlen = 5;
+			break;
+		}
+		if (hlen < 2 || pos + hlen > buflen)
+			break; /* malformed, send the rest as it is */
+		if ((hi != HDR_BODY && hi != HDR_BODY_END) || hlen <= 3)
+			continue;
+
+		if (send_all(c->sock, buf + start, pos + 3 - start, MSG_MORE) < 0)
+			return -1;
+		if (send_body(c, buf + pos + 3, hlen - 3, pos + hlen < buflen) < 0)
+			return -1;
+		start = pos + hlen;
+	}
+
+	if (start < buflen && send_all(c->sock, buf + start, buflen - start, 0) < 0)
+		return -1;
+	return buflen;
+}
+
+/*
+ * Function tcp_handleinput()
+ *
+ *    Called from OBEX-lib when input is needed. Feeds what the socket
+ *    has, waiting up to timeout seconds for it.
+ *
+ */
+static int tcp_handleinput(obex_t *handle, void *data, int timeout)
+{
+	tcp_conn_t *c = data;
+	struct pollfd pfd;
+	ssize_t actual;
+	int ret;
+
+	pfd.fd = c->sock;
+	pfd.events = POLLIN;
+	ret = poll(&pfd, 1, timeout < 0 ? -1 : timeout * 1000);
+	if (ret <= 0)
+		return ret;
+
+	actual = recv(c->sock, c->recv, sizeof(c->recv), 0);
+	if (actual < 0 && (errno == EINTR || errno == EAGAIN))
+		return 0;
+	if (actual <= 0)
+		return -1; /* closed by the peer */
+
+	cobex_capture_data(c->capture, COBEX_CAPTURE_IN, c->recv, actual);
+	OBEX_CustomDataFeed(handle, c->recv, actual);
+	return 1;
+}
+
+static int tcp_connect(obex_t *UNUSED(handle), void *UNUSED(data))
+{
+	return -1; /* accepted connections only */
+}
+
+static int tcp_disconnect(obex_t *UNUSED(handle), void *data)
+{
+	tcp_conn_t *c = data;
+
+	(void) shutdown(c->sock, SHUT_RDWR);
+	return 1;
+}
+
+/**
+	Accept a connection on a listening socket.
+
+	\param listen_fd a socket from tcp_listen()
+
+	\return a custom transport for OBEX_RegisterCTransport() or NULL
+ */
+obex_ctrans_t *tcp_ctrans(int listen_fd)
+{
+	obex_ctrans_t *ctrans;
+	tcp_conn_t *c;
+	int sock, one = 1;
+
+	sock = accept(listen_fd, NULL, NULL);
+	if (sock < 0)
+		return NULL;
+	(void) fcntl(sock, F_SETFD, FD_CLOEXEC);
+	/* a packet leaves as soon as its body is out */
+	(void) setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	c = calloc(1, sizeof(*c));
+	ctrans = calloc(1, sizeof(*ctrans));
+	if (!c || !ctrans) {
+		free(c);
+		free(ctrans);
+		close(sock);
+		return NULL;
+	}
+	c->sock = sock;
+	c->body_fd = -1;
+	c->capture = cobex_capture_new(COBEX_CAPTURE_SERVER);
+
+	ctrans->connect     = tcp_connect;
+	ctrans->disconnect  = tcp_disconnect;
+	ctrans->write       = tcp_write;
+	ctrans->listen      = NULL;
+	ctrans->handleinput = tcp_handleinput;
+	ctrans->customdata  = c;
+
+	return ctrans;
+}
+
+/**
+	Close a connection and free its transport.
+ */
+void tcp_free(obex_ctrans_t *ctrans)
+{
+	tcp_conn_t *c;
+
+	if (!ctrans)
+		return;
+	c = ctrans->customdata;
+	if (c) {
+		close(c->sock);
+		cobex_capture_free(c->capture);
+		free(c);
+	}
+	free(ctrans);
+}
+
+/**
+	Take the body bytes of the following packets from a file.
+
+	\param fd the file or -1 to send bodies as they are
+	\param offset the file offset of the first body byte
+ */
+void tcp_set_body(obex_ctrans_t *ctrans, int fd, off_t offset)
+{
+	tcp_conn_t *c = ctrans->customdata;
+
+	c->body_fd = fd;
+	c->body_offset = offset;
+}
@@ -0,0 +1,57 @@
+/**
+	\file apps/obexftpd_tcp.h
+	TCP transport with zero-copy bodies for the OBEX file server.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2003-2006 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+#ifndef OBEXFTPD_TCP_H
+#define OBEXFTPD_TCP_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <openobex/obex.h>
+#include <multicobex/cobex_capture.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TCP_RECV_SIZE	(64 * 1024)
+
+/* one accepted connection, the customdata of its obex_ctrans_t */
+typedef struct tcp_conn {
+	int sock;
+	int body_fd;		/* body bytes are sent from this file, -1 to send them as they are */
+	off_t body_offset;	/* file offset of the next body byte */
+	cobex_capture_t *capture;	/* NULL unless capturing */
+	uint8_t recv[TCP_RECV_SIZE];
+} tcp_conn_t;
+
+int tcp_listen(const struct sockaddr *addr, socklen_t addrlen);
+
+obex_ctrans_t *tcp_ctrans(int listen_fd);
+
+void tcp_free(obex_ctrans_t *ctrans);
+
+void tcp_set_body(obex_ctrans_t *ctrans, int fd, off_t offset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OBEXFTPD_TCP_H */
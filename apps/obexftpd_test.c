@@ -0,0 +1,200 @@
+/**
+	\file apps/obexftpd_test.c
+	Unit test for streamed GETs in the OBEX server.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2002-2007 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+/* The server is compiled in, and the OpenOBEX calls a GET makes are
+   replaced here to record what the client would see, so no transport
+   is needed. Files are served from the memory store, whose reads fail
+   on request. */
+
+#define main obexftpd_main
+#include "obexftpd.c"
+#undef main
+
+static int failed = 0;
+
+#define CHECK(expr) do { if (!(expr)) { \
+	fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+	failed++; } } while (0)
+
+#define FILE_SIZE	(3 * IO_CHUNK + 100)
+
+static int dummy;
+#define HANDLE	((obex_t *) &dummy)
+#define OBJECT	((obex_object_t *) &dummy)
+
+/* what the client would see */
+static int last_rsp;
+static int body_len;
+static int ended;
+static int cancelled;
+
+/* the request, a name header */
+static uint8_t req_name[64];
+static uint32_t req_name_len;
+static int headers_left;
+
+int OBEX_ObjectGetNextHeader(obex_t *UNUSED(self), obex_object_t *UNUSED(object),
+			     uint8_t *hi, obex_headerdata_t *hv, uint32_t *hv_size)
+{
+	if (headers_left == 0)
+		return 0;
+	headers_left--;
+	*hi = OBEX_HDR_NAME;
+	hv->bs = req_name;
+	*hv_size = req_name_len;
+	return 1;
+}
+
+int OBEX_ObjectSetRsp(obex_object_t *UNUSED(object), int UNUSED(rsp), int lastrsp)
+{
+	last_rsp = lastrsp;
+	return 0;
+}
+
+int OBEX_ObjectAddHeader(obex_t *UNUSED(self), obex_object_t *UNUSED(object), uint8_t hi,
+			 obex_headerdata_t UNUSED(hv), uint32_t hv_size, unsigned int flags)
+{
+	if (hi == OBEX_HDR_BODY)
+		body_len += hv_size;
+	if (flags & OBEX_FL_STREAM_DATAEND)
+		ended = 1;
+	return 0;
+}
+
+int OBEX_CancelRequest(obex_t *UNUSED(self), int UNUSED(nice))
+{
+	cancelled = 1;
+	return 0;
+}
+
+int OBEX_SuspendRequest(obex_t *UNUSED(self), obex_object_t *UNUSED(object))
+{
+	return 0;
+}
+
+int OBEX_ResumeRequest(obex_t *UNUSED(self))
+{
+	return 0;
+}
+
+int OBEX_Work(obex_t *UNUSED(self))
+{
+	return 0;
+}
+
+/* the memory store, reads from fail_at on give EIO */
+static off_t fail_at = -1;
+static store_ops_t failing_store;
+
+static ssize_t failing_pread(int fd, void *buf, size_t len, off_t offset)
+{
+	if (fail_at >= 0 && offset + (off_t) len > fail_at) {
+		errno = EIO;
+		return -1;
+	}
+	return store_memory.pread(fd, buf, len, offset);
+}
+
+/* a GET of name, with the body pulled out like OBEX_EV_STREAMEMPTY does */
+static void get(session_t *s, const char *name)
+{
+	int i;
+
+	for (i = 0; name[i]; i++) {
+		req_name[2 * i] = 0;
+		req_name[2 * i + 1] = name[i];
+	}
+	req_name[2 * i] = 0;
+	req_name[2 * i + 1] = 0;
+	req_name_len = 2 * i + 2;
+	headers_left = 1;
+	last_rsp = body_len = ended = cancelled = 0;
+
+	get_server(s, HANDLE, OBJECT);
+	for (i = 0; i < 100 && last_rsp == OBEX_RSP_SUCCESS && !ended && !cancelled; i++)
+		(void) fillstream(s, HANDLE, OBJECT);
+}
+
+int main(void)
+{
+	char dir[] = "/tmp/obexftpd_testXXXXXX";
+	char path[64];
+	session_t *s;
+	FILE *f;
+	int i;
+
+	CHECK(mkdtemp(dir) != NULL);
+	snprintf(path, sizeof(path), "%s/t.bin", dir);
+	f = fopen(path, "wb");
+	CHECK(f != NULL);
+	if (!f)
+		return 1;
+	for (i = 0; i < FILE_SIZE; i++)
+		fputc(i, f);
+	fclose(f);
+
+	failing_store = store_memory;
+	failing_store.pread = failing_pread;
+	store = &failing_store;
+	root_fd = store->root(dir);
+	unlink(path);
+	rmdir(dir);
+	CHECK(root_fd >= 0);
+	s = new_session();
+	CHECK(s != NULL);
+	if (!s)
+		return 1;
+
+	/* the whole body, then the end */
+	get(s, "t.bin");
+	CHECK(last_rsp == OBEX_RSP_SUCCESS);
+	CHECK(ended && !cancelled);
+	CHECK(body_len == FILE_SIZE);
+	CHECK(s->get_fd < 0);
+
+	/* no such file */
+	get(s, "none");
+	CHECK(last_rsp == OBEX_RSP_NOT_FOUND);
+	CHECK(body_len == 0);
+
+	/* a read error after the first chunk cancels, the body does not end */
+	fail_at = IO_CHUNK;
+	get(s, "t.bin");
+	CHECK(cancelled);
+	CHECK(!ended);
+	CHECK(body_len == IO_CHUNK);
+	CHECK(s->get_fd < 0);
+
+	/* a read error on the first chunk as well */
+	fail_at = 0;
+	get(s, "t.bin");
+	CHECK(cancelled);
+	CHECK(!ended);
+	CHECK(body_len == 0);
+	fail_at = -1;
+
+	free_session(s);
+	store->close(root_fd);
+
+	if (failed)
+		fprintf(stderr, "%d checks failed\n", failed);
+	return failed ? 1 : 0;
+}
@@ -37,6 +37,7 @@
 #include "bfb.h"
 #include "bfb_io.h"
 #include <common.h>
+#include <probes.h>
 
 /* Provide convenience macros for handling structure
  * fields through their offsets.
@@ -321,6 +322,7 @@ int bfb_write_packets(fd_t fd, uint8_t type, uint8_t *buffer, int length)
 			free(frame);
 			return -1;
 		}
+		PROBE2(bfb, frame__send, type, l);
 	}
 	free(frame);
 	return i / MAX_PACKET_DATA;
@@ -404,6 +406,7 @@ bfb_frame_t *bfb_read_packets(uint8_t *buffer, int *length)
 	memmove(buffer, &buffer[l], *length);
 	
 	DEBUG(3, "%s() Packet 0x%02x (%d bytes)\n", __func__, frame->type, frame->len);
+	PROBE2(bfb, frame__recv, frame->type, frame->len);
 	return frame;
 }
 
@@ -49,15 +49,12 @@
 #include <obexftp/obexftp.h>
 #include <obexftp/client.h>
 #include <obexftp/uuid.h>
+#include <obexftp/log.h>
 
 #define UNUSED(x) x __attribute__((unused))
 
-#define DEBUGOUPUT
-#ifdef DEBUGOUPUT
-#define DEBUG(...) fprintf(stderr, __VA_ARGS__)
-#else
-#define DEBUG(...) do { } while (0)
-#endif
+/* shown with -v, see obexftp_log_set_level() */
+#define DEBUG(...) OBEXFTP_LOG(OBEXFTP_LOG_INFO, __VA_ARGS__)
 
 
 typedef struct connection connection_t;
@@ -251,7 +248,11 @@ static obexftp_client_t *cli_open(int transport, char *addr, int channel)
         for (retry = 0; retry < 3; retry++) {
 
                 /* Connect */
+#ifdef SIEMENS
+                if (obexftp_connect_src (cli, source, addr, channel, UUID_S45, sizeof(UUID_S45)) >= 0)
+#else
                 if (obexftp_connect_src (cli, source, addr, channel, UUID_FBS, sizeof(UUID_FBS)) >= 0)
+#endif
                         return cli;
                 /* Still trying to connect */
 		sleep(1);
@@ -614,11 +615,15 @@ static int ofs_read(const char *path, char *buf, size_t size, off_t offset, stru
 
 		(void) obexftp_get(conn->cli, NULL, filepath);
 		wb->size = conn->cli->buf_size;
-		wb->data = conn->cli->buf_data; /* would be better to memcpy this */
-		//conn->cli->buf_data = NULL; /* now the data is ours -- without copying */
+		wb->data = conn->cli->buf_data;
+		conn->cli->buf_data = NULL; /* now the data is ours -- without copying */
 
 		ofs_disconnect(conn);
 	}
+	if (!wb->data)
+		return -EIO;
+	if (offset >= (off_t)wb->size)
+		return 0;
 	actual = wb->size - offset;
 	if (actual > size)
 		actual = size;
@@ -682,7 +687,8 @@ static int ofs_release(const char *path, struct fuse_file_info *fi)
 		(void) obexftp_put_data(conn->cli, (uint8_t*)wb->data, wb->size, filepath);
 
 		ofs_disconnect(conn);
-
+	}
+	if (wb) {
 		free(wb->data);
 		free(wb);
 	}
@@ -690,30 +696,21 @@ static int ofs_release(const char *path, struct fuse_file_info *fi)
 	return 0;
 }
 
-#ifdef SIEMENS
 /* just sum all clients */
 static int ofs_statfs(const char *UNUSED(label), struct statfs *st)
 {
 	connection_t *conn;
-	int size = 0, free = 0;
+	obexftp_meminfo_t info;
+	uint64_t size = 0, free = 0;
 
         for (conn = connections; conn; conn = conn->next)
 		if (conn->cli && ofs_connect(conn) >= 0) {
 
-			/* for S45 */
-			(void) obexftp_disconnect (conn->cli);
-			(void) obexftp_connect_uuid (conn->cli, conn->addr, conn->channel, UUID_S45, sizeof(UUID_S45));
- 
-			/* Retrieve Infos */
-			(void) obexftp_info(conn->cli, 0x01);
-			size += conn->cli->apparam_info;
-			(void) obexftp_info(conn->cli, 0x02);
-			free += conn->cli->apparam_info;
- 
-			 DEBUG("%s() GOT FS STAT: %d / %d\n", __func__, free, size);
- 
-			(void) obexftp_disconnect (conn->cli);
-			(void) obexftp_connect (conn->cli, conn->addr, conn->channel);
+			if (obexftp_get_meminfo(conn->cli, NULL, &info) >= 0) {
+				size += info.total;
+				free += info.free;
+			}
+			DEBUG("%s() GOT FS STAT: %" PRIu64 " / %" PRIu64 "\n", __func__, free, size);
 
 			ofs_disconnect(conn);
 		}
@@ -730,7 +727,6 @@ static int ofs_statfs(const char *UNUSED(label), struct statfs *st)
 
 	return 0;
 }
-#endif
 
 static void *ofs_init(void) {
 
@@ -783,9 +779,7 @@ static struct fuse_operations ofs_oper = {
 	open:		ofs_open,
 	read:		ofs_read,
 	write:		ofs_write,
-#ifdef SIEMENS
 	statfs:		ofs_statfs,
-#endif
 	release:	ofs_release,
 	flush:		NULL,
 	fsync:		NULL,
@@ -805,12 +799,13 @@ int main(int argc, char *argv[])
 			{"tty",		required_argument, NULL, 't'},
 			{"hci", required_argument, NULL, 'd'},
 			{"nonblock",	no_argument, NULL, 'N'},
+			{"verbose",	no_argument, NULL, 'v'},
 			{"help",	no_argument, NULL, 'h'},
 			{"usage",	no_argument, NULL, 'h'},
 			{0, 0, 0, 0}
 		};
 		
-		c = getopt_long (argc, argv, "+IBUt:d:Nh",
+		c = getopt_long (argc, argv, "+IBUt:d:Nvh",
 				 long_options, &option_index);
 		if (c == -1)
 			break;
@@ -846,9 +841,13 @@ int main(int argc, char *argv[])
 			nonblock = 1;
 			break;
 
+		case 'v':
+			obexftp_log_set_level(obexftp_log_get_level() + 1);
+			break;
+
 		case 'h':
 			/* printf("ObexFS %s\n", VERSION); */
-			printf("Usage: %s [-I] [-B] [-U] [-t <dev>] [-d <hci>] [-N] [-- <fuse options>]\n"
+			printf("Usage: %s [-I] [-B] [-U] [-t <dev>] [-d <hci>] [-N] [-v] [-- <fuse options>]\n"
 				"Transfer files from/to Mobile Equipment.\n"
 				"Copyright (c) 2002-2005 Christian W. Zuckschwerdt\n"
 				"\n"
@@ -858,6 +857,7 @@ int main(int argc, char *argv[])
 				" -t, --tty <device>          search for devices at this tty\n\n"
 				" -d, --hci <no/address>      use only this source device address or number\n"				
 				" -N, --nonblock              nonblocking mode\n\n"
+				" -v, --verbose               log every file system call, more for the library\n"
 				" -h, --help, --usage         this help text\n\n"
 				"Options to fusermount need to be preceeded by two dashes (--).\n"
 				"\n",
@@ -882,8 +882,12 @@ int main(int argc, char *argv[])
 	fprintf(stderr, "IrDA searching not available.\n");
 	fprintf(stderr, "USB searching not available.\n");
 	fprintf(stderr, "TTY searching not available.\n");
+	/* the file system threads never wait for stderr */
+	(void) obexftp_log_start(STDERR_FILENO);
+
 	/* loop */
 	fuse_main(argc-optind+1, &argv[optind-1], &ofs_oper);
 
+	obexftp_log_stop();
 	return 0;
 }
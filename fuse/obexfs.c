@@ -41,20 +41,16 @@
 #include <dirent.h>
 #include <signal.h>
 #include <getopt.h>
-#include <expat.h>
 
 #include <obexftp/obexftp.h>
 #include <obexftp/client.h>
 #include <obexftp/uuid.h>
+#include <obexftp/log.h>
 
 #define UNUSED(x) x __attribute__((unused))
 
-#define DEBUGOUPUT
-#ifdef DEBUGOUPUT
-#define DEBUG(...) fprintf(stderr, __VA_ARGS__)
-#else
-#define DEBUG(...) do { } while (0)
-#endif
+/* shown with -v, see obexftp_log_set_level() */
+#define DEBUG(...) OBEXFTP_LOG(OBEXFTP_LOG_INFO, __VA_ARGS__)
 
 
 typedef struct data_buffer data_buffer_t;
@@ -78,6 +74,10 @@ static bool nonblock = false;
 // Free/total space (in bytes) to report if can't get real info.
 static int report_space = 0;
 
+// Body cache budget and largest body to cache (in bytes), -1 for defaults.
+static int body_cache_size = -1;
+static int body_cache_maxsize = -1;
+
 static char *mknod_dummy = NULL; /* bad coder, no cookies! */
 
 static int nodal = 0;
@@ -104,6 +104,10 @@ static int cli_open()
                 /* Error opening obexftp-client */
                 return -1;
         }
+	if (body_cache_size >= 0)
+		cli->body_cache_size = body_cache_size;
+	if (body_cache_maxsize >= 0)
+		cli->cache_maxsize = body_cache_maxsize;
 
 	if (channel < 0) {
 		channel = obexftp_browse_bt_ftp(device);
@@ -383,11 +387,15 @@ static int ofs_read(const char *path, char *buf, size_t size, off_t offset, stru
 		free(tpath);
 
 		wb->size = cli->buf_size;
-		wb->data = cli->buf_data; /* would be better to memcpy this */
-		//cli->buf_data = NULL; /* now the data is ours -- without copying */
+		wb->data = cli->buf_data;
+		cli->buf_data = NULL; /* now the data is ours -- without copying */
 
 		ofs_disconnect();
 	}
+	if (!wb->data)
+		return -EIO;
+	if (offset >= (off_t)wb->size)
+		return 0;
 	actual = wb->size - offset;
 	if (actual > size)
 		actual = size;
@@ -448,7 +456,8 @@ static int ofs_release(const char *path, struct fuse_file_info *fi)
 		free(tpath);
 
 		ofs_disconnect();
-
+	}
+	if (wb) {
 		free(wb->data);
 		free(wb);
 	}
@@ -456,237 +465,11 @@ static int ofs_release(const char *path, struct fuse_file_info *fi)
 	return 0;
 }
 
-struct parsing_data {
-	/* Input */
-	const char *path;
-
-	/* Intermediate states */
-	enum state_t {
-		PS_ROOT = 0,
-		PS_CAPABILITY,
-		PS_GENERAL,
-		PS_MEMORY,
-		PS_MEM_TYPE,
-		PS_LOCATION,
-		PS_FREE,
-		PS_USED,
-		PS_FILENLEN,
-
-		PS_FINISH,
-		PS_ERROR,
-	} state;               // State based on found XML tags
-	int depth;             // XML tag depth
-	char *mem_location;
-	unsigned long mem_used;
-	unsigned long mem_free;
-	unsigned long mem_namelen;
-
-	int path_match_len;    // Needed to find best-matching entry
-
-	/* Output */
-	const char *error;
-	struct statfs meminfo;
-};
-
-static void xml_element_start(void* user_data, const char* name, const char** UNUSED(attrs))
-{
-	struct parsing_data *data = (struct parsing_data*)user_data;
-
-	switch (data->state) {
-	case PS_ROOT:
-		if (data->depth == 0 && strcmp(name, "Capability") == 0) {
-			data->state = PS_CAPABILITY;
-		} else {
-			data->error = "Root element must be \"Capability\"";
-			data->state = PS_ERROR;
-		}
-		break;
-
-	case PS_CAPABILITY:
-		if (data->depth == 1 && strcmp(name, "General") == 0)
-			data->state = PS_GENERAL;
-		break;
-
-	case PS_GENERAL:
-		if (data->depth == 2 && strcmp(name, "Memory") == 0)
-			data->state = PS_MEMORY;
-		break;
-
-	case PS_MEMORY:
-		if (data->depth == 3) {
-			if (strcmp(name, "MemType") == 0)
-				data->state = PS_MEM_TYPE;
-			else if (strcmp(name, "Location") == 0)
-				data->state = PS_LOCATION;
-			else if (strcmp(name, "Free") == 0)
-				data->state = PS_FREE;
-			else if (strcmp(name, "Used") == 0)
-				data->state = PS_USED;
-			else if (strcmp(name, "FileNLen") == 0)
-				data->state = PS_FILENLEN;
-		}
-		break;
-
-	case PS_MEM_TYPE:
-	case PS_LOCATION:
-	case PS_FREE:
-	case PS_USED:
-	case PS_FILENLEN:
-		// Memory properties must be plain text.
-		data->error = "Memory properties must be plain text, no elements inside are allowed";
-		data->state = PS_ERROR;
-		break;
-
-	case PS_FINISH:
-	case PS_ERROR:
-		break;
-	}
-
-	++(data->depth);
-}
-
-static void xml_element_end(void* user_data, const char* name)
-{
-	struct parsing_data *data = (struct parsing_data*)user_data;
-	(data->depth)--;
-
-	switch (data->state) {
-	case PS_ROOT:
-		break;
-
-	case PS_CAPABILITY:
-		if (data->depth == 0 && strcmp(name, "Capability") == 0) {
-			data->error = "\"General\" section not found";
-			data->state = PS_ERROR;
-		}
-		break;
-
-	case PS_GENERAL:
-		if (data->depth == 1 && strcmp(name, "General") == 0)
-			data->state = PS_FINISH;
-		break;
-
-	case PS_MEMORY:
-		if (data->depth == 2 && strcmp(name, "Memory") == 0)
-		{
-
-			bool use_memory_entry = false;
-			ssize_t len = data->mem_location? strlen(data->mem_location): 0;
-
-			data->state = PS_GENERAL;
-
-			if (len == 0 && data->path_match_len < 0)
-			{
-				/* use memory entry in case that it contains no/empty
-				 * location entry and there was no previous location
-				 */
-				use_memory_entry = true;
-				data->path_match_len = 0;
-			}
-			else
-			{
-				/* Check if this memory entity is a better match */
-				if (data->path_match_len < len &&
-				    len <= (int)strlen(data->path) &&
-				    strncasecmp(data->path, data->mem_location, len) == 0 &&
-				    (data->path[len] == '/' || data->path[len] == 0))
-				{
-					use_memory_entry = true;
-					data->path_match_len = len;
-				}
-			}
-
-			if (use_memory_entry)
-			{
-				data->meminfo.f_bsize = 1;
-				data->meminfo.f_blocks = data->mem_used + data->mem_free;
-				data->meminfo.f_bfree = data->mem_free;
-				data->meminfo.f_bavail = data->mem_free;
-				data->meminfo.f_namelen = data->mem_namelen;
-			}
-
-			if (data->mem_location)
-				free(data->mem_location);
-		}
-		break;
-
-	case PS_MEM_TYPE:
-	case PS_LOCATION:
-	case PS_FREE:
-	case PS_USED:
-	case PS_FILENLEN:
-		data->state = PS_MEMORY;
-		break;
-
-	case PS_FINISH:
-	case PS_ERROR:
-		break;
-	}
-}
-
-static unsigned long parse_ulong(const char* str) {
-	long result;
-	errno = 0;
-	result = strtol(str, NULL, 10);
-	//check invalid string or invalid value
-	if (errno == 0 || result >= 0)
-		return (unsigned long)result;
-	return 0UL;
-}
-
-static void xml_character_data(void* user_data, const char* str, int len)
-{
-	struct parsing_data *data = (struct parsing_data*)user_data;
-	int i;
-	char *tmp = NULL;
-
-	switch (data->state) {
-	case PS_MEM_TYPE:
-		break;
-
-	case PS_LOCATION:
-		if (len > 0)
-		{
-			data->mem_location = strndup(str, len);
-			/* Convert path separators to unix type */
-			for (i = 0; i < len; ++i)
-			{
-				if (data->mem_location[i] == '\\')
-					data->mem_location[i] = '/';
-			}
-			/* Remove trailing directory separator */
-			if (data->mem_location[len-1] == '/')
-			  data->mem_location[len-1] = 0;
-		}
-		break;
-
-	case PS_FREE:
-		tmp = strndup(str, len);
-		data->mem_free = parse_ulong(tmp);
-		break;
-
-	case PS_USED:
-		tmp = strndup(str, len);
-		data->mem_used = parse_ulong(tmp);
-		break;
-
-	case PS_FILENLEN:
-		tmp = strndup(str, len);
-		data->mem_namelen = parse_ulong(tmp);
-		break;
-
-	default:
-		break;
-	}
-
-	if (tmp)
-		free(tmp);
-}
-
 static int ofs_statfs(const char *path, struct statfs *st)
 {
 	int res;
-	char *tpath = translate_path(path);
+	obexftp_meminfo_t info;
+	char *tpath;
 
 	DEBUG("%s() %s\n", __FUNCTION__, path);
 
@@ -700,49 +483,18 @@ static int ofs_statfs(const char *path, struct statfs *st)
 	if(res < 0)
 		return res; /* errno */
 
-#ifdef SIEMENS_S45
-	/* Retrieve Infos */
-	(void) obexftp_info(cli, 0x01);
-	st->f_blocks = cli->apparam_info;
-	(void) obexftp_info(cli, 0x02);
-	st->f_bfree = cli->apparam_info;
-	st->f_bavail = st->f_bfree;
-
-#else
-	(void) obexftp_setpath(cli, tpath, 1);
-	res = obexftp_get_type(cli, XOBEX_CAPABILITY, 0, 0);
-	if (res >= 0) {
-		XML_Parser parser;
-
-		struct parsing_data data;
-		memset(&data, 0, sizeof(data));
-		data.path = tpath + 1;
-		data.path_match_len = -1;
-
-		parser = XML_ParserCreate(NULL);
-		XML_SetUserData(parser, &data);
-		XML_SetElementHandler(parser, xml_element_start, xml_element_end);
-		XML_SetCharacterDataHandler(parser, xml_character_data);
-		if (XML_Parse(parser, cli->buf_data, cli->buf_size, 1)) {
-			if (data.error) {
-				DEBUG("%s(): PARSE ERROR: %s\n", __func__, data.error);
-			} else if (data.path_match_len >= 0) {
-				*st = data.meminfo;
-			}
-		} else {
-			DEBUG("%s(): PARSE ERROR: %s at line %d\n", __func__,
-				XML_ErrorString(XML_GetErrorCode(parser)),
-				XML_GetCurrentLineNumber(parser)
-			);
-		}
-		XML_ParserFree(parser);
+	tpath = translate_path(path);
+	if (obexftp_get_meminfo(cli, tpath, &info) >= 0) {
+		st->f_blocks = info.total;
+		st->f_bfree = info.free;
+		st->f_bavail = info.free;
+		st->f_namelen = info.namelen;
 	}
-#endif
+	free(tpath);
+
 	DEBUG("%s() GOT FS STAT: %" PRId64 " / %" PRId64 "\n", __func__, st->f_bfree, st->f_blocks);
 	ofs_disconnect();
 
-	free(tpath);
-
 	return 0;
 }
 
@@ -819,12 +571,15 @@ int main(int argc, char *argv[])
 			{"root",	required_argument, NULL, 'r'},
 			{"nonblock",	no_argument, NULL, 'N'},
 			{"report-space",required_argument, NULL, 'S'},
+			{"cache",	required_argument, NULL, 'C'},
+			{"cache-file",	required_argument, NULL, 'M'},
+			{"verbose",	no_argument, NULL, 'v'},
 			{"help",	no_argument, NULL, 'h'},
 			{"usage",	no_argument, NULL, 'h'},
 			{0, 0, 0, 0}
 		};
 		
-		c = getopt_long (argc, argv, "+ib:B:d:u:t:n:r:NS:h",
+		c = getopt_long (argc, argv, "+ib:B:d:u:t:n:r:NS:C:M:vh",
 				 long_options, &option_index);
 		if (c == -1)
 			break;
@@ -895,9 +650,21 @@ int main(int argc, char *argv[])
 			report_space = atoi(optarg);
 			break;
 
+		case 'C':
+			body_cache_size = atoi(optarg);
+			break;
+
+		case 'M':
+			body_cache_maxsize = atoi(optarg);
+			break;
+
+		case 'v':
+			obexftp_log_set_level(obexftp_log_get_level() + 1);
+			break;
+
 		case 'h':
 			/* printf("ObexFS %s\n", VERSION); */
-			printf("Usage: %s [-i | -b <dev> [-B <chan>] [-d <hci>] | -u <dev> | -t <dev> | -n <dev>] [-- <fuse options>]\n"
+			printf("Usage: %s [-i | -b <dev> [-B <chan>] [-d <hci>] | -u <dev> | -t <dev> | -n <dev>] [-v] [-- <fuse options>]\n"
 				"Transfer files from/to Mobile Equipment.\n"
 				"Copyright (c) 2002-2005 Christian W. Zuckschwerdt\n"
 				"\n"
@@ -910,7 +677,10 @@ int main(int argc, char *argv[])
 				" -n, --network <device>      connect to this network host\n\n"
 				" -r, --root <path>           path on device to use as root\n\n"
 				" -N, --nonblock              nonblocking mode\n"
-				" -S, --report-space <bytes>  report this number as total/free space\n\n"
+				" -S, --report-space <bytes>  report this number as total/free space\n"
+				" -C, --cache <bytes>         cache up to this many bytes of file bodies\n"
+				" -M, --cache-file <bytes>    only cache file bodies up to this size\n\n"
+				" -v, --verbose               log every file system call, more for the library\n"
 				" -h, --help, --usage         this help text\n\n"
 				"Options to fusermount need to be preceeded by two dashes (--).\n"
 				"\n",
@@ -938,16 +708,22 @@ int main(int argc, char *argv[])
 
 	argv[optind-1] = argv[0];
 
+	/* the file system threads never wait for stderr */
+	(void) obexftp_log_start(STDERR_FILENO);
+
         /* Open connection */
 	res = cli_open();
-	if(res < 0)
+	if(res < 0) {
+		obexftp_log_stop();
 		return res; /* errno */
+	}
 	
 	/* loop */
 	fuse_main(argc-optind+1, &argv[optind-1], &ofs_oper);
 	
         /* Close connection */
 	cli_close();
+	obexftp_log_stop();
 
 	return 0;
 }
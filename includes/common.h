@@ -39,7 +39,14 @@
 #define OBEXFTP_DEBUG 0
 #endif
 
-#if defined (__STDC_VERSION__) && __STDC_VERSION__ >= 199901L
+#ifdef HAVE_OBEXFTP_LOG
+/* built in up to OBEXFTP_DEBUG_MAX, shown up to the runtime level */
+#include <obexftp/log.h>
+#ifndef OBEXFTP_DEBUG_MAX
+#define OBEXFTP_DEBUG_MAX OBEXFTP_LOG_TRACE
+#endif
+#define	DEBUG(n, ...)	do { if (OBEXFTP_DEBUG_MAX >= (n)) OBEXFTP_LOG((n), __VA_ARGS__); } while (0)
+#elif defined (__STDC_VERSION__) && __STDC_VERSION__ >= 199901L
 #define	DEBUG(n, ...)	if (OBEXFTP_DEBUG >= (n)) fprintf(stderr, __VA_ARGS__)
 #elif defined (__GNUC__)
 #define	DEBUG(n, format...)	if (OBEXFTP_DEBUG >= (n)) fprintf (stderr, format)
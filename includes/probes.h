@@ -0,0 +1,34 @@
+/**
+	\file includes/probes.h
+	ObexFTP static tracepoints.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Probes are USDT markers for systemtap and bpftrace. They compile to
+	a single nop unless a tracer is attached, and to nothing at all
+	without ENABLE_USDT. Arguments must be integers or pointers.
+	See examples/bpftrace for scripts and the list of probes.
+ */
+
+#ifndef _OBEXFTP_PROBES_H
+#define _OBEXFTP_PROBES_H
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define PROBE0(provider, name)			DTRACE_PROBE(provider, name)
+#define PROBE1(provider, name, a)		DTRACE_PROBE1(provider, name, a)
+#define PROBE2(provider, name, a, b)		DTRACE_PROBE2(provider, name, a, b)
+#define PROBE3(provider, name, a, b, c)		DTRACE_PROBE3(provider, name, a, b, c)
+#define PROBE4(provider, name, a, b, c, d)	DTRACE_PROBE4(provider, name, a, b, c, d)
+
+#else /* HAVE_SYS_SDT_H */
+
+#define PROBE0(provider, name)			do { } while (0)
+#define PROBE1(provider, name, a)		do { } while (0)
+#define PROBE2(provider, name, a, b)		do { } while (0)
+#define PROBE3(provider, name, a, b, c)		do { } while (0)
+#define PROBE4(provider, name, a, b, c, d)	do { } while (0)
+
+#endif /* HAVE_SYS_SDT_H */
+
+#endif /* _OBEXFTP_PROBES_H */
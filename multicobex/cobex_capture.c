@@ -0,0 +1,209 @@
+/**
+	\file multicobex/cobex_capture.c
+	Capture OBEX packets to a pcap file.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2002-2007 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+/* Transports hand over whatever they send or receive. Reads rarely
+   end on a packet boundary, so each direction of a connection collects
+   bytes until the length in the packet header is complete. A record
+   goes out with a single fwrite(), which keeps records of several
+   threads from interleaving. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include "cobex_capture.h"
+
+#include <common.h>
+
+/* pcap record header, then our pseudo header */
+#define REC_HDRLEN	(16 + COBEX_CAPTURE_HDRLEN)
+/* the packet length is 16 bits */
+#define MAX_PACKET	0xffff
+
+struct capture_dir {
+	int len;		/* bytes of the current packet */
+	uint8_t rec[REC_HDRLEN + MAX_PACKET];
+};
+
+struct cobex_capture {
+	uint32_t id;
+	int role;
+	struct capture_dir dir[2];
+};
+
+static FILE *capture_file = NULL;
+static uint32_t next_id = 1;
+
+/* pcap fields are in host order */
+static void put16(uint8_t *p, uint16_t v)
+{
+	memcpy(p, &v, 2);
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	memcpy(p, &v, 4);
+}
+
+static void put32be(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/**
+	Start capturing. Connections set up from now on are recorded.
+
+	\param path the pcap file, it is truncated
+
+	\return 0 on success or a negative error code
+ */
+int cobex_capture_open(const char *path)
+{
+	uint8_t hdr[24];
+
+	return_val_if_fail (path != NULL, -EINVAL);
+
+	cobex_capture_close();
+	capture_file = fopen(path, "wb");
+	if (!capture_file)
+		return -errno;
+
+	put32(&hdr[0], 0xa1b2c3d4);
+	put16(&hdr[4], 2);	/* version 2.4 */
+	put16(&hdr[6], 4);
+	put32(&hdr[8], 0);	/* thiszone */
+	put32(&hdr[12], 0);	/* sigfigs */
+	put32(&hdr[16], COBEX_CAPTURE_HDRLEN + MAX_PACKET);
+	put32(&hdr[20], COBEX_CAPTURE_DLT);
+	if (fwrite(hdr, sizeof(hdr), 1, capture_file) != 1 || fflush(capture_file) != 0) {
+		fclose(capture_file);
+		capture_file = NULL;
+		return -EIO;
+	}
+	DEBUG(2, "%s() Capturing to %s\n", __func__, path);
+	return 0;
+}
+
+/**
+	Stop capturing.
+ */
+void cobex_capture_close(void)
+{
+	if (capture_file) {
+		fclose(capture_file);
+		capture_file = NULL;
+	}
+}
+
+/**
+	Record a new connection.
+
+	\param role COBEX_CAPTURE_CLIENT or COBEX_CAPTURE_SERVER
+
+	\return NULL if there is no capture, which cobex_capture_data() accepts
+ */
+cobex_capture_t *cobex_capture_new(int role)
+{
+	cobex_capture_t *cap;
+
+	if (!capture_file)
+		return NULL;
+	cap = malloc(sizeof(*cap));
+	if (!cap)
+		return NULL;
+	cap->id = next_id++;
+	cap->role = role;
+	cap->dir[0].len = 0;
+	cap->dir[1].len = 0;
+	return cap;
+}
+
+void cobex_capture_free(cobex_capture_t *cap)
+{
+	free(cap);
+}
+
+static int packet_len(const uint8_t *pkt)
+{
+	int len = pkt[1] << 8 | pkt[2];
+
+	return len < 3 ? 3 : len;	/* malformed, keep the header only */
+}
+
+static void write_record(cobex_capture_t *cap, int dir, struct capture_dir *d)
+{
+	struct timeval tv;
+	uint8_t *r = d->rec;
+
+	gettimeofday(&tv, NULL);
+	put32(&r[0], tv.tv_sec);
+	put32(&r[4], tv.tv_usec);
+	put32(&r[8], COBEX_CAPTURE_HDRLEN + d->len);
+	put32(&r[12], COBEX_CAPTURE_HDRLEN + d->len);
+	r[16] = dir;
+	r[17] = cap->role;
+	r[18] = 0;
+	r[19] = 0;
+	put32be(&r[20], cap->id);
+
+	if (fwrite(r, REC_HDRLEN + d->len, 1, capture_file) != 1 || fflush(capture_file) != 0)
+		DEBUG(1, "%s() Capture write failed\n", __func__);
+}
+
+/**
+	Record bytes of a connection. Whole packets are written out as
+	they complete.
+
+	\param cap from cobex_capture_new(), may be NULL
+	\param dir COBEX_CAPTURE_OUT or COBEX_CAPTURE_IN
+ */
+void cobex_capture_data(cobex_capture_t *cap, int dir, const uint8_t *buf, int len)
+{
+	struct capture_dir *d;
+	uint8_t *pkt;
+	int need, n;
+
+	if (!cap || !capture_file || !buf)
+		return;
+	d = &cap->dir[dir ? 1 : 0];
+	pkt = d->rec + REC_HDRLEN;
+
+	while (len > 0) {
+		need = d->len < 3 ? 3 : packet_len(pkt);
+		n = need - d->len;
+		if (n > len)
+			n = len;
+		memcpy(pkt + d->len, buf, n);
+		d->len += n;
+		buf += n;
+		len -= n;
+
+		if (d->len >= 3 && d->len == packet_len(pkt)) {
+			write_record(cap, dir ? 1 : 0, d);
+			d->len = 0;
+		}
+	}
+}
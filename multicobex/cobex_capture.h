@@ -0,0 +1,65 @@
+/**
+	\file multicobex/cobex_capture.h
+	Capture OBEX packets to a pcap file.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2002-2007 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+#ifndef COBEX_CAPTURE_H
+#define COBEX_CAPTURE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Each record is one whole OBEX packet behind a pseudo header:
+     byte 0	direction, COBEX_CAPTURE_OUT or COBEX_CAPTURE_IN
+     byte 1	role of the capturing side, COBEX_CAPTURE_CLIENT or _SERVER
+     byte 2-3	zero
+     byte 4-7	stream (connection) number, big endian
+   In Wireshark add DLT 147 under Preferences, Protocols, DLT_USER
+   with payload protocol "obex" and header size 8. */
+
+#define COBEX_CAPTURE_DLT	147	/* DLT_USER0 */
+#define COBEX_CAPTURE_HDRLEN	8
+
+#define COBEX_CAPTURE_OUT	0	/* sent by the capturing side */
+#define COBEX_CAPTURE_IN	1	/* received */
+
+#define COBEX_CAPTURE_CLIENT	0
+#define COBEX_CAPTURE_SERVER	1
+
+/** One connection, splits its byte streams into packets. */
+typedef struct cobex_capture cobex_capture_t;
+
+int cobex_capture_open(const char *path);
+
+void cobex_capture_close(void);
+
+cobex_capture_t *cobex_capture_new(int role);
+
+void cobex_capture_free(cobex_capture_t *cap);
+
+void cobex_capture_data(cobex_capture_t *cap, int dir, const uint8_t *buf, int len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COBEX_CAPTURE_H */
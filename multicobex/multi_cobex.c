@@ -43,6 +43,7 @@
 #include "multi_cobex_io.h"
 #include "bfb/bfb.h"
 #include <common.h>
+#include <probes.h>
 
 static void cobex_cleanup(cobex_t *c, int force)
 {
@@ -52,6 +53,8 @@ static void cobex_cleanup(cobex_t *c, int force)
 	cobex_io_close(c->fd, c->type, force);
 
 	c->fd = INVALID_HANDLE_VALUE;
+	cobex_capture_free(c->capture);
+	c->capture = NULL;
 }
 
 /**
@@ -72,6 +75,7 @@ int cobex_connect(obex_t *self, void *data)
 	if(c->fd == INVALID_HANDLE_VALUE)
 		return -1;
 
+	c->capture = cobex_capture_new(COBEX_CAPTURE_CLIENT);
 	return 1;
 }
 
@@ -103,6 +107,7 @@ int cobex_write(obex_t *self, void *data, uint8_t *buffer, int length)
 
 	DEBUG(3, "%s() \n", __func__);
 	DEBUG(3, "%s() Data %d bytes\n", __func__, length);
+	cobex_capture_data(c->capture, COBEX_CAPTURE_OUT, buffer, length);
 
 	if (c->type == CT_BFB) {
 		if (c->seq == 0){
@@ -125,6 +130,7 @@ int cobex_write(obex_t *self, void *data, uint8_t *buffer, int length)
 				if ( ++fails >= 10 ) { // to avoid infinite looping if something is really wrong
 					DEBUG(1, "%s() Error writing to port (written %d bytes out of %d, in %d retries)\n",
 					      __func__, written, length, retries);
+					PROBE3(multicobex, write, c, length, written);
 					return written;
 				}
 				usleep(1); // This mysteriously avoids a resource not available error on write()
@@ -138,6 +144,7 @@ int cobex_write(obex_t *self, void *data, uint8_t *buffer, int length)
 			DEBUG(2, "%s() Wrote %d bytes in %d retries\n", __func__, written, retries);
 	}
 
+	PROBE3(multicobex, write, c, length, written);
 	return written;
 }
 
@@ -156,6 +163,7 @@ int cobex_handleinput(obex_t *self, void *data, int timeout)
 	/* Check if this is a timeout (0) or error (-1) */
 	if(actual <= 0)
 		return actual;
+	PROBE2(multicobex, read, c, actual);
 	DEBUG(2, "%s() Read %d bytes (%d bytes already buffered)\n", __func__, actual, c->recv_len);
 
 	if (c->type == CT_BFB) {
@@ -183,6 +191,7 @@ int cobex_handleinput(obex_t *self, void *data, int timeout)
 					actual = bfb_send_ack(c->fd);
 					DEBUG(2, "%s() Wrote ack packet (%d)\n", __func__, actual);
 
+					cobex_capture_data(c->capture, COBEX_CAPTURE_IN, c->data_buf->data, c->data_len-7);
 					OBEX_CustomDataFeed(self, c->data_buf->data, c->data_len-7);
 					c->data_len = 0;
 
@@ -198,6 +207,7 @@ int cobex_handleinput(obex_t *self, void *data, int timeout)
 
 	} else {
 		if (actual > 0) {
+			cobex_capture_data(c->capture, COBEX_CAPTURE_IN, c->recv, actual);
 			OBEX_CustomDataFeed(self, c->recv, actual);
 			return 1;
 		}
@@ -247,6 +257,7 @@ void cobex_free (obex_ctrans_t *ctrans)
 
 	free(cobex->tty);
 	cobex->tty = 0;
+	cobex_capture_free(cobex->capture);
 
 	free(cobex);
 	cobex = 0;
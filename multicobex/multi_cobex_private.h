@@ -24,6 +24,7 @@
 #define MULTICOBEX_PRIVATE_H
 
 #include <bfb/bfb.h>
+#include "cobex_capture.h"
 
 #define SERPORT "/dev/ttyS0"
 
@@ -52,6 +53,7 @@ typedef struct {
 	bfb_data_t *data_buf;	/* assembled obex frames */
 	int data_size;		/* max buffer size */
 	int data_len;		/* filled buffer length */
+	cobex_capture_t *capture;	/* NULL unless capturing */
 } cobex_t;
 
 #endif /* MULTICOBEX_PRIVATE_H */
@@ -28,6 +28,9 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fnmatch.h>
 #include <sys/stat.h> /* __S_IFDIR, __S_IFREG */
 #ifndef S_IFDIR
 #define S_IFDIR	__S_IFDIR
@@ -43,6 +46,7 @@
 #include "object.h"
 #include "unicode.h"
 #include "cache.h"
+#include "pathtab.h"
 
 #include <common.h>
 
@@ -58,7 +62,7 @@ static /*@only@*/ char *normalize_dir_path(int quirks, const char *name)
 
 	if (!name) name = "";
 
-	p = copy = malloc(strlen(name) + 2); /* at most add two slashes */
+	p = copy = malloc(strlen(name) + 3); /* at most add two slashes */
 
 	if (OBEXFTP_USE_LEADING_SLASH(quirks))
 		*p++ = '/';
@@ -84,21 +88,6 @@ static /*@only@*/ char *normalize_dir_path(int quirks, const char *name)
 }
 
 
-/**
-	Purge all cache object at/below a given path.
-	Methods that need to invalidate cache lines:
-	- setpath (when create is on)
-	- put
-	- put_file
-	- del
-	- rename
- */
-void cache_purge(cache_object_t **root, const char *path)
-{
-	cache_object_t *cache, *tmp;
-	char *name;
-	char *pathonly;
-
 #define FREE_NODE(node) do { \
                         if (node->name) \
 				free(node->name); \
@@ -109,39 +98,145 @@ void cache_purge(cache_object_t **root, const char *path)
 			free(node); \
 			} while(0)
 
-        if (!path || *path == '\0' || *path != '/') {
-		/* purge all */
-		while (*root) {
-			cache = *root;
-			*root = cache->next;
-                        FREE_NODE(cache);
-		}
+
+/**
+	Find the newest cache object for a path id.
+ */
+static cache_object_t *find_cache_object(const obexftp_client_t *cli, int id)
+{
+	cache_object_t *cache;
+
+	for (cache = cli->cache; cache && cache->path_id != id; cache = cache->next);
+	return cache;
+}
+
+/**
+	Remove a cache object.
+	If a directory stream still uses it, it is just marked stale.
+ */
+static void unlink_cache_object(cache_object_t **link)
+{
+	cache_object_t *cache = *link;
+
+	if (cache->refcnt > 0) {
+		cache->timestamp = 0;
 		return;
 	}
-	
-	pathonly = strdup(path);
-	name = strrchr(pathonly, '/');
-	*name++ = '\0';
-
-        /* removing far too much, the siblings could stay cached... */
-       	while (*root && !strncmp((*root)->name, pathonly, strlen(pathonly))) {
-       		cache = *root;
-       		*root = cache->next;
-		FREE_NODE(cache);
-       	}
-	for (cache = *root; cache->next; cache = cache->next) {
-		if (!strncmp(cache->next->name, pathonly, strlen(pathonly))) {
-			tmp = cache->next;
-			cache->next = cache->next->next;
-			FREE_NODE(tmp);
+	*link = cache->next;
+	FREE_NODE(cache);
+}
+
+/**
+	Drop a reference taken by a directory stream or a find walk.
+	A listing that was replaced meanwhile is removed now.
+ */
+static void cache_release(obexftp_client_t *cli, cache_object_t *cache)
+{
+	cache_object_t **link;
+
+	if (--cache->refcnt > 0 || cache->timestamp)
+		return;
+	for (link = &cli->cache; *link && *link != cache; link = &(*link)->next);
+	if (*link)
+		unlink_cache_object(link);
+}
+
+/**
+	Remove the listing of a path id from the cache.
+ */
+static void drop_cache_object(obexftp_client_t *cli, int id)
+{
+	cache_object_t **link;
+
+	for (link = &cli->cache; *link && (*link)->path_id != id; link = &(*link)->next);
+	if (*link)
+		unlink_cache_object(link);
+}
+
+/**
+	Purge the listing holding a path and all listings at/below that path.
+	Purges all listings if \a id is PATH_UNKNOWN.
+	Methods that need to invalidate cache lines:
+	- put
+	- put_file
+	- del
+	- rename
+ */
+void cache_purge(obexftp_client_t *cli, int id)
+{
+	cache_object_t **link, *cache;
+	int parent;
+
+	return_if_fail(cli != NULL);
+
+	parent = id >= 0 ? path_parent(cli->paths, id) : PATH_UNKNOWN;
+	for (link = &cli->cache; *link; ) {
+		cache = *link;
+		if (id < 0 || cache->path_id == parent ||
+		    path_is_below(cli->paths, cache->path_id, id)) {
+			unlink_cache_object(link);
+			if (*link != cache)
+				continue;
 		}
+		link = &cache->next;
 	}
+}
+
+/**
+	Forget the interned paths, the table only grows otherwise. This is
+	forced on a full purge and done anyway once more than PATH_TABLE_MAX
+	paths are held. All listings and bodies go too, they refer to path
+	ids. Nothing happens while a directory stream or a find walk still
+	holds a listing.
+ */
+void cache_trim_paths(obexftp_client_t *cli, int force)
+{
+	cache_object_t *cache;
+	char *cwd = NULL;
+
+	return_if_fail(cli != NULL);
+
+	if (!force && path_table_count(cli->paths) <= PATH_TABLE_MAX)
+		return;
+	for (cache = cli->cache; cache; cache = cache->next)
+		if (cache->refcnt > 0)
+			return;
+
+	cache_purge(cli, PATH_UNKNOWN);
+	body_cache_purge(cli, PATH_UNKNOWN);
+	if (cli->cwd_id >= 0)
+		cwd = strdup(path_name(cli->paths, cli->cwd_id));
+	path_table_clear(cli->paths);
+	cli->cwd_id = cwd ? path_intern(cli->paths, cwd) : PATH_UNKNOWN;
+	free(cwd);
+	DEBUG(2, "%s() path table cleared\n", __func__);
+}
+
+/**
+	Purge the listings of a path and all its parents.
+	Needed by setpath when create is on.
+ */
+void cache_purge_parents(obexftp_client_t *cli, int id)
+{
+	return_if_fail(cli != NULL);
 
-	free(pathonly);
+	for (; id >= 0; id = path_parent(cli->paths, id))
+		drop_cache_object(cli, id);
+}
+
+/**
+	Check if a cached object is still fresh.
+ */
+static int cache_is_fresh(const obexftp_client_t *cli, const cache_object_t *cache)
+{
+	if (!cache->timestamp)
+		return FALSE; /* replaced while in use */
+	return cli->cache_timeout <= 0 || time(NULL) - cache->timestamp <= cli->cache_timeout;
 }
 
 /**
 	Retrieve an object from the cache.
+	Objects older than cache_timeout seconds are not returned.
  */
 int get_cache_object(const obexftp_client_t *cli, const char *name, char **object, int *size)
 {
@@ -149,7 +244,11 @@ int get_cache_object(const obexftp_client_t *cli, const char *name, char **objec
 	return_val_if_fail(cli != NULL, -1);
 
 	/* search the cache */
-	for (cache = cli->cache; cache && strcmp(cache->name, name); cache = cache->next);
+	cache = find_cache_object(cli, path_intern(cli->paths, name));
+	if (cache && !cache_is_fresh(cli, cache)) {
+		DEBUG(2, "%s() Listing %s is stale\n", __func__, cache->name);
+		return -1;
+	}
 	if (cache) {
 		DEBUG(2, "%s() Listing %s from cache\n", __func__, cache->name);
 		if (object)
@@ -177,6 +276,7 @@ int put_cache_object(obexftp_client_t *cli, /*@only@*/ char *name, /*@only@*/ ch
 	cli->cache->timestamp = time(NULL);
 	cli->cache->size = size;
 	cli->cache->name = name;
+	cli->cache->path_id = path_intern(cli->paths, name);
 	cli->cache->content = object;
 
 	return 0;
@@ -184,38 +284,48 @@ int put_cache_object(obexftp_client_t *cli, /*@only@*/ char *name, /*@only@*/ ch
 
 /**
 	List a directory from cache, optionally loading it first.
+	\return the cached listing or NULL on error
  */
-static char *obexftp_cache_list(obexftp_client_t *cli, const char *name)
+static cache_object_t *obexftp_cache_list(obexftp_client_t *cli, const char *name)
 {
+	cache_object_t *cache;
 	char *path, *listing;
+	int id;
 
 	return_val_if_fail(cli != NULL, NULL);
 
 	cli->infocb(OBEXFTP_EV_RECEIVING, name, 0, cli->infocb_data);
 
-	path = normalize_dir_path(cli->quirks, name);
-	DEBUG(2, "%s() Listing %s (%s)\n", __func__, name, path);
-
 	/* search the cache */
-	if (!get_cache_object(cli, path, &listing, NULL)) {
-		DEBUG(2, "%s() Listing %s from cache\n", __func__, path);
-		if (path)
-			free(path);
-		return listing;
+	id = path_intern(cli->paths, name ? name : "");
+	cache = find_cache_object(cli, id);
+	if (cache && cache_is_fresh(cli, cache)) {
+		DEBUG(2, "%s() Listing %s from cache\n", __func__, cache->name);
+		return cache;
 	}
 
+	/* there might be a stale one */
+	if (cache)
+		drop_cache_object(cli, id);
+
+	path = normalize_dir_path(cli->quirks, name);
+	DEBUG(2, "%s() Listing %s (%s)\n", __func__, name, path);
+
 	if (path && !strcmp(path, "/telecom/")) {
 		listing = strdup("<file name=\"devinfo.txt\">");
 		put_cache_object(cli, path, listing, strlen(listing));
+		return cli->cache;
 	}
 
-	if (obexftp_list(cli, NULL, path) < 0)
+	if (obexftp_list(cli, NULL, path) < 0) {
+		free(path);
 		return NULL;
+	}
 	listing = strdup(cli->buf_data);
 
 	put_cache_object(cli, path, listing, strlen(listing));
 
-	return listing;
+	return cli->cache;
 }
 
 
@@ -314,7 +424,8 @@ static stat_entry_t *parse_directory(char *xml)
 	xml_conv = malloc(n);
 	if (xml_conv) {
 		ret = Utf8ToChar(xml_conv, (uint8_t *)xml, n);
-		if (ret > 0) {
+		if (ret > 0 && ret < n) {
+			xml_conv[ret] = '\0'; /* iconv won't terminate */
 			xml = (char *)xml_conv;
 		} else {
 			DEBUG(1, "UTF-8 conversion error\n");
@@ -415,11 +526,23 @@ static stat_entry_t *parse_directory(char *xml)
 }
 
 
+/**
+	Get the parsed entries of a cached listing.
+ */
+static stat_entry_t *cache_stats(cache_object_t *cache)
+{
+	if (!cache->stats)
+		cache->stats = parse_directory(cache->content);
+	return cache->stats;
+}
+
+
 /* directory handling */
 
 typedef struct {
+	obexftp_client_t *cli;
 	stat_entry_t *cur;
-	/* stat_entry_t *head; -- so we can free this? */
+	cache_object_t *cache; /* referenced while open */
 } dir_stream_t;
 
 /**
@@ -429,36 +552,35 @@ void *obexftp_opendir(obexftp_client_t *cli, const char *name)
 {
 	cache_object_t *cache;
 	dir_stream_t *stream;
-	char *abs;
 
 	/* fetch dir if needed */
-	(void) obexftp_cache_list(cli, name);
-
-	/* search the cache */
-	abs = normalize_dir_path(cli->quirks, name);
-	for (cache = cli->cache; cache && strcmp(cache->name, abs); cache = cache->next);
-	free(abs);
+	cache = obexftp_cache_list(cli, name);
 	if (!cache)
 		return NULL;
 	DEBUG(2, "%s() dir prepared (%s)\n", __func__, cache->name);
 		 
 	/* read dir */
-	if (!cache->stats)
-		cache->stats = parse_directory(cache->content);
-	DEBUG(2, "%s() got stats\n", __func__);
 	stream = malloc(sizeof(dir_stream_t));
-	stream->cur = cache->stats;
+	stream->cli = cli;
+	stream->cur = cache_stats(cache);
+	stream->cache = cache;
+	cache->refcnt++;
+	DEBUG(2, "%s() got stats\n", __func__);
 
 	return (void *)stream;
 }
 
 /**
 	Close a directory after reading.
-	The stat entry is a cache object so we do nothing.
+	The stat entry is a cache object so we just release it.
  */
 int obexftp_closedir(void *dir) {
+	dir_stream_t *stream;
+
 	if (!dir)
 		return -1;
+	stream = (dir_stream_t *)dir;
+	cache_release(stream->cli, stream->cache);
 	free (dir);
 	return 0;
 }
@@ -480,54 +602,71 @@ stat_entry_t *obexftp_readdir(void *dir) {
 }
 	 
 /**
-	Stat a directory entry.
+	Lookup a directory entry in the parent's listing.
+	The listing is only fetched if \a fetch is set, otherwise only a
+	fresh cached listing is used.
  */
-stat_entry_t *obexftp_stat(obexftp_client_t *cli, const char *name)
+static stat_entry_t *find_stat(obexftp_client_t *cli, int id, int fetch)
 {
 	cache_object_t *cache;
 	stat_entry_t *entry;
-	char *path, *abs, *p;
 	const char *basename;
+	int parent;
 
-	return_val_if_fail(name != NULL, NULL);
-
-	path = strdup(name);
-	p = strrchr(path, '/');
-	if (p) {
-		*p++ = '\0';
-		basename = p;
-	} else {
-		*path = '\0';
-		basename = name;
-	}
-	DEBUG(2, "%s() stating '%s' / '%s'\n", __func__, path, basename);
+	parent = path_parent(cli->paths, id);
+	if (parent < 0)
+		return NULL; /* the root has no entry */
+	basename = path_basename(cli->paths, id);
+	DEBUG(2, "%s() stating '%s'\n", __func__, path_name(cli->paths, id));
 
 	/* fetch dir if needed */
-	(void) obexftp_cache_list(cli, path);
-
-	/* search the cache for the path */
-	abs = normalize_dir_path(cli->quirks, path);
-	for (cache = cli->cache; cache && strcmp(cache->name, abs); cache = cache->next);
-	free(abs);
-	if (!cache) {
-		free(path);
+	if (fetch)
+		cache = obexftp_cache_list(cli, path_name(cli->paths, parent));
+	else
+		cache = find_cache_object(cli, parent);
+	if (!cache || (!fetch && !cache_is_fresh(cli, cache)))
 		return NULL;
-	}
 	DEBUG(2, "%s() found '%s'\n", __func__, cache->name);
 		 
-	/* read dir */
-	if (!cache->stats)
-		cache->stats = parse_directory(cache->content);
-	DEBUG(2, "%s() got dir '%s'\n", __func__, path);
-	
 	/* then lookup the basename */
-	for (entry = cache->stats; entry && *entry->name && strcmp(entry->name, basename); entry++);
-	free(path);
+	for (entry = cache_stats(cache); entry && *entry->name && strcmp(entry->name, basename); entry++);
 	if (!entry || !(*entry->name))
 		return NULL;
 
 	DEBUG(2, "%s() got stats\n", __func__);
 	return entry;
+}
+
+/**
+	Re-read a directory from the device, replacing the cached listing.
+	\return the parsed entries, owned by the cache. NULL on error.
+ */
+stat_entry_t *reload_cache_dir(obexftp_client_t *cli, const char *name)
+{
+	cache_object_t *cache;
+
+	return_val_if_fail(cli != NULL, NULL);
+
+	/* drop just this listing, keep the subfolders */
+	drop_cache_object(cli, path_intern(cli->paths, name ? name : ""));
+
+	cache = obexftp_cache_list(cli, name);
+	if (!cache)
+		return NULL;
+
+	return cache_stats(cache);
+}
+
+/**
+	Stat a directory entry.
+ */
+stat_entry_t *obexftp_stat(obexftp_client_t *cli, const char *name)
+{
+	return_val_if_fail(cli != NULL, NULL);
+	return_val_if_fail(name != NULL, NULL);
+
+	cache_trim_paths(cli, FALSE);
+	return find_stat(cli, path_intern(cli->paths, name), TRUE);
 
 	/*
 	dev_t         st_dev;      / * device * /
@@ -547,3 +686,426 @@ stat_entry_t *obexftp_stat(obexftp_client_t *cli, const char *name)
 
 }
 
+
+/* searching */
+
+typedef struct {
+	const char *pattern;
+	int min_size;
+	int max_size;
+	time_t newer_than;
+	obexftp_tree_cb_t cb;
+	void *data;
+} find_filter_t;
+
+/**
+	Recursively match the entries below a directory.
+	\return the number of matches or a negative error code if \a path could not be listed
+ */
+static int find_entries(obexftp_client_t *cli, const char *path, const find_filter_t *filter)
+{
+	cache_object_t *cache;
+	stat_entry_t *entry;
+	char *subpath;
+	int n = 0, ret;
+
+	/* fetch dir if needed */
+	cache = obexftp_cache_list(cli, path);
+	if (!cache)
+		return -ENOENT;
+
+	cache->refcnt++; /* keep it while we descend */
+	for (entry = cache_stats(cache); entry && *entry->name; entry++) {
+		subpath = malloc(strlen(path) + strlen(entry->name) + 2);
+		if (!subpath)
+			break;
+		strcpy(subpath, path);
+		if (*path == '\0' || path[strlen(path) - 1] != '/')
+			strcat(subpath, "/");
+		strcat(subpath, entry->name);
+
+		if (S_ISDIR(entry->mode)) {
+			ret = find_entries(cli, subpath, filter);
+			if (ret > 0)
+				n += ret;
+		} else if ((!filter->pattern || !fnmatch(filter->pattern, entry->name, FNM_PERIOD)) &&
+			   entry->size >= filter->min_size &&
+			   (filter->max_size < 0 || entry->size <= filter->max_size) &&
+			   (!filter->newer_than || entry->mtime > filter->newer_than)) {
+			DEBUG(3, "%s() found '%s'\n", __func__, subpath);
+			if (filter->cb)
+				filter->cb(subpath, entry, filter->data);
+			n++;
+		}
+		free(subpath);
+	}
+	cache_release(cli, cache);
+
+	return n;
+}
+
+/**
+	Find files below a directory.
+
+	\param cli an obexftp_client_t created by obexftp_open().
+	\param root the directory to search, the device root if NULL
+	\param pattern shell wildcard pattern for the file name, any if NULL
+	\param min_size smallest file size to report
+	\param max_size largest file size to report, no limit if negative
+	\param newer_than only report files modified after this time, 0 for any
+	\param cb called with the absolute path and stat entry of each match
+	\param data passed to \a cb
+
+	\return the number of matches or a negative error code if \a root could not be listed
+
+	\note Only files are reported. Cached listings are used as long as they
+	are younger than cache_timeout seconds.
+ */
+int obexftp_find(obexftp_client_t *cli, const char *root, const char *pattern,
+		 int min_size, int max_size, time_t newer_than,
+		 obexftp_tree_cb_t cb, void *data)
+{
+	find_filter_t filter;
+
+	return_val_if_fail(cli != NULL, -EINVAL);
+
+	filter.pattern = pattern;
+	filter.min_size = min_size;
+	filter.max_size = max_size;
+	filter.newer_than = newer_than;
+	filter.cb = cb;
+	filter.data = data;
+
+	if (!root || *root == '\0')
+		root = "/";
+	cache_trim_paths(cli, FALSE);
+	return find_entries(cli, root, &filter);
+}
+
+
+/* file body handling */
+
+/**
+	Purge the cached file bodies at/below a path, or all bodies if \a id
+	is PATH_UNKNOWN.
+	Methods that need to invalidate body cache lines:
+	- put
+	- put_file
+	- del
+	- rename
+ */
+void body_cache_purge(obexftp_client_t *cli, int id)
+{
+	cache_object_t *cache, **prev;
+
+	return_if_fail(cli != NULL);
+
+	for (prev = &cli->body_cache; *prev; ) {
+		if (id < 0 || path_is_below(cli->paths, (*prev)->path_id, id)) {
+			cache = *prev;
+			*prev = cache->next;
+			cli->body_cache_used -= cache->size;
+			FREE_NODE(cache);
+			continue;
+		}
+		prev = &(*prev)->next;
+	}
+}
+
+/**
+	Retrieve a file body from the cache.
+	The entry is only used if size and modification time still match
+	a fresh cached listing of the parent folder, otherwise it is dropped.
+	\return 0 on a hit with a new allocated copy in \a body, -1 otherwise
+ */
+int get_cache_body(obexftp_client_t *cli, int id, char **body, int *size)
+{
+	cache_object_t *cache, **prev;
+	stat_entry_t *st;
+	char *p;
+
+	return_val_if_fail(cli != NULL, -1);
+
+	for (prev = &cli->body_cache; *prev && (*prev)->path_id != id; prev = &(*prev)->next);
+	if (!*prev)
+		return -1;
+	cache = *prev;
+
+	st = find_stat(cli, id, FALSE);
+	if (!st || st->size != cache->size || st->mtime != cache->mtime) {
+		DEBUG(2, "%s() Body %s is stale\n", __func__, path_name(cli->paths, id));
+		*prev = cache->next;
+		cli->body_cache_used -= cache->size;
+		FREE_NODE(cache);
+		return -1;
+	}
+
+	p = malloc(cache->size + 1);
+	if (!p)
+		return -1;
+	memcpy(p, cache->content, cache->size);
+	p[cache->size] = '\0';
+
+	/* keep most recently used first */
+	*prev = cache->next;
+	cache->next = cli->body_cache;
+	cli->body_cache = cache;
+
+	DEBUG(2, "%s() Body %s from cache\n", __func__, path_name(cli->paths, id));
+	*body = p;
+	if (size)
+		*size = cache->size;
+	return 0;
+}
+
+/**
+	Store a copy of a file body in the cache.
+	Only bodies up to cache_maxsize with a matching entry in a fresh
+	cached parent listing are kept. Least recently used bodies are evicted to
+	stay within body_cache_size.
+ */
+int put_cache_body(obexftp_client_t *cli, int id, const char *body, int size)
+{
+	cache_object_t *cache, **prev;
+	stat_entry_t *st;
+
+	return_val_if_fail(cli != NULL, -1);
+	return_val_if_fail(id >= 0, -1);
+	return_val_if_fail(body != NULL, -1);
+
+	if (size > cli->cache_maxsize || size > cli->body_cache_size)
+		return -1;
+
+	/* we need a listing entry to validate against later */
+	st = find_stat(cli, id, FALSE);
+	if (!st || st->size != size)
+		return -1;
+
+	body_cache_purge(cli, id);
+
+	cache = calloc(1, sizeof(cache_object_t));
+	if (!cache)
+		return -1;
+	cache->content = malloc(size + 1);
+	if (!cache->content) {
+		free(cache);
+		return -1;
+	}
+	memcpy(cache->content, body, size);
+	cache->path_id = id;
+	cache->timestamp = time(NULL);
+	cache->size = size;
+	cache->mtime = st->mtime;
+
+	cache->next = cli->body_cache;
+	cli->body_cache = cache;
+	cli->body_cache_used += size;
+
+	/* evict from the tail */
+	while (cli->body_cache_used > cli->body_cache_size) {
+		for (prev = &cli->body_cache; (*prev)->next; prev = &(*prev)->next);
+		cache = *prev;
+		*prev = NULL;
+		cli->body_cache_used -= cache->size;
+		DEBUG(2, "%s() Evicting body %s\n", __func__, path_name(cli->paths, cache->path_id));
+		FREE_NODE(cache);
+	}
+
+	return 0;
+}
+
+
+/* memory info handling */
+
+/**
+	Find the start of the next \a tag element between \a p and \a end.
+ */
+static const char *find_element(const char *p, const char *end, const char *tag)
+{
+	int len = strlen(tag);
+
+	for (; (p = strchr(p, '<')) && p < end; p++) {
+		if (strncmp(p + 1, tag, len))
+			continue;
+		if (p[len + 1] == '>' || p[len + 1] == '/' || isspace((unsigned char)p[len + 1]))
+			return p;
+	}
+	return NULL;
+}
+
+/**
+	Copy the text of the first \a tag element between \a p and \a end.
+	\return the length of the text, -1 if there is no such element
+ */
+static int get_element_text(const char *p, const char *end, const char *tag, char *buf, int size)
+{
+	const char *q;
+	int len;
+
+	p = find_element(p, end, tag);
+	if (!p)
+		return -1;
+	p = strchr(p, '>');
+	if (!p || p >= end)
+		return -1;
+	if (*(p - 1) == '/') {
+		*buf = '\0'; /* empty element */
+		return 0;
+	}
+	p++;
+	q = strchr(p, '<');
+	if (!q || q > end)
+		return -1;
+
+	len = q - p;
+	if (len >= size)
+		len = size - 1;
+	memcpy(buf, p, len);
+	buf[len] = '\0';
+	return len;
+}
+
+/**
+	Parse the Memory sections of a capability object.
+	Very limited - just enough for the general memory info.
+	\return a new allocated array of obexftp_meminfo_t's.
+ */
+static obexftp_meminfo_t *parse_capability(const char *xml, int *count)
+{
+	obexftp_meminfo_t *info = NULL, *tmp;
+	const char *p, *end, *general_end;
+	char buf[64];
+	uint64_t used;
+	int n = 0;
+	char *c;
+
+	*count = 0;
+	if (!xml)
+		return NULL;
+
+	/* only the Memory sections of General describe the file system */
+	p = find_element(xml, xml + strlen(xml), "General");
+	if (!p)
+		return NULL;
+	general_end = strstr(p, "</General>");
+	if (!general_end)
+		general_end = p + strlen(p);
+
+	while ((p = find_element(p, general_end, "Memory")) != NULL) {
+		end = strstr(p, "</Memory>");
+		if (!end || end > general_end)
+			break;
+
+		tmp = realloc(info, (n + 1) * sizeof(obexftp_meminfo_t));
+		if (!tmp)
+			break;
+		info = tmp;
+		memset(&info[n], 0, sizeof(obexftp_meminfo_t));
+
+		if (get_element_text(p, end, "Location", info[n].location, sizeof(info[n].location)) > 0) {
+			/* convert path separators, remove trailing separator */
+			for (c = info[n].location; *c; c++)
+				if (*c == '\\')
+					*c = '/';
+			if (*(c - 1) == '/')
+				*(c - 1) = '\0';
+		}
+		used = 0;
+		if (get_element_text(p, end, "Used", buf, sizeof(buf)) > 0)
+			used = strtoull(buf, NULL, 10);
+		if (get_element_text(p, end, "Free", buf, sizeof(buf)) > 0)
+			info[n].free = strtoull(buf, NULL, 10);
+		info[n].total = used + info[n].free;
+		if (get_element_text(p, end, "FileNLen", buf, sizeof(buf)) > 0)
+			info[n].namelen = atoi(buf);
+
+		DEBUG(2, "%s() Memory '%s': %llu / %llu\n", __func__, info[n].location,
+		      (unsigned long long)info[n].free, (unsigned long long)info[n].total);
+		n++;
+		p = end;
+	}
+
+	*count = n;
+	return info;
+}
+
+/**
+	Fetch and parse the memory info, falling back to Siemens info requests.
+	A failed lookup is cached as well.
+ */
+static void load_meminfo(obexftp_client_t *cli)
+{
+	obexftp_meminfo_t *info = NULL;
+	int count = 0;
+	uint32_t total;
+
+	if (obexftp_get_capability(cli, NULL, NULL) >= 0)
+		info = parse_capability(cli->buf_data, &count);
+
+	if (count == 0) {
+		/* Siemens: inquire installed and free memory */
+		cli->apparam_info = 0;
+		if (obexftp_info(cli, 0x01) >= 0 && cli->apparam_info > 0) {
+			total = cli->apparam_info;
+			if (obexftp_info(cli, 0x02) >= 0 && (info = calloc(1, sizeof(obexftp_meminfo_t)))) {
+				info->total = total;
+				info->free = cli->apparam_info;
+				count = 1;
+			}
+		}
+	}
+
+	free(cli->meminfo);
+	cli->meminfo = info;
+	cli->meminfo_count = count;
+	cli->meminfo_timestamp = time(NULL);
+}
+
+/**
+	Get the memory info for a path.
+
+	\param cli an obexftp_client_t created by obexftp_open().
+	\param path the path on the device, any location if NULL
+	\param info the memory info to fill
+
+	\return 0 on success, -ENOENT if the device reported nothing for this path
+
+	\note The capability object (or Siemens info) is only requested again
+	after meminfo_timeout seconds. The memory entry whose location is the
+	longest prefix of \a path is used, an entry without location matches
+	any path.
+ */
+int obexftp_get_meminfo(obexftp_client_t *cli, const char *path, obexftp_meminfo_t *info)
+{
+	const obexftp_meminfo_t *entry, *best = NULL;
+	int i, len, best_len = -1;
+
+	return_val_if_fail(cli != NULL, -EINVAL);
+	return_val_if_fail(info != NULL, -EINVAL);
+
+	if (!cli->meminfo_timestamp ||
+	    time(NULL) - cli->meminfo_timestamp > cli->meminfo_timeout)
+		load_meminfo(cli);
+
+	if (!path) {
+		best = cli->meminfo; /* NULL if there is none */
+	} else {
+		while (*path == '/') path++;
+		for (i = 0; i < cli->meminfo_count; i++) {
+			entry = &cli->meminfo[i];
+			len = strlen(entry->location);
+			if (len <= best_len)
+				continue;
+			if (len == 0 || (!strncasecmp(path, entry->location, len) &&
+					 (path[len] == '/' || path[len] == '\0'))) {
+				best = entry;
+				best_len = len;
+			}
+		}
+	}
+	if (!best)
+		return -ENOENT;
+
+	*info = *best;
+	return 0;
+}
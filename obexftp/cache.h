@@ -26,13 +26,28 @@
 extern "C" {
 #endif
 
-void cache_purge(cache_object_t **root, const char *path);
+/* interned paths held before the table is cleared */
+#define PATH_TABLE_MAX	4096
+
+void cache_purge(obexftp_client_t *cli, int id);
+
+void cache_trim_paths(obexftp_client_t *cli, int force);
+
+void cache_purge_parents(obexftp_client_t *cli, int id);
 
 void xfer_purge(obexftp_client_t *cli);
 
 int put_cache_object(obexftp_client_t *cli, /*@only@*/ char *name, /*@only@*/ char *object, int size);
 
 int get_cache_object(const obexftp_client_t *cli, const char *name, char **object, int *size);
+
+stat_entry_t *reload_cache_dir(obexftp_client_t *cli, const char *name);
+
+void body_cache_purge(obexftp_client_t *cli, int id);
+
+int put_cache_body(obexftp_client_t *cli, int id, const char *body, int size);
+
+int get_cache_body(obexftp_client_t *cli, int id, char **body, int *size);
 	
 #ifdef __cplusplus
 }
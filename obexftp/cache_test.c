@@ -0,0 +1,201 @@
+/**
+	\file obexftp/cache_test.c
+	Unit test for the listing cache, find and the tree index.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2002-2007 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+/* gcc -Wall -I. -I.. -I../includes -DHAVE_ICONV -o cache_test cache.c pathtab.c tree.c unicode.c cache_test.c */
+
+/* The device is faked by replacing the GET requests the cache makes,
+   so no transport is needed. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openobex/obex.h>
+
+#include "obexftp.h"
+#include "client.h"
+#include "cache.h"
+#include "pathtab.h"
+
+#include <common.h>
+
+static int failed = 0;
+
+#define CHECK(expr) do { if (!(expr)) { \
+	fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+	failed++; } } while (0)
+
+/* folder listings served, and the modification time of /Images */
+static int listings = 0;
+static const char *images_mtime = "20200101T000000Z";
+
+/* the fake device:
+   /a.txt 5, /Empty/, /Images/x.jpg 100, /Images/y.jpg 20, /Images/.h.jpg 7,
+   /Images/Sub/z.jpg 1 */
+int obexftp_get_type(obexftp_client_t *cli, const char *UNUSED(type), const char *UNUSED(localname), const char *remotename)
+{
+	char buf[512];
+
+	listings++;
+	if (!strcmp(remotename, "/"))
+		snprintf(buf, sizeof(buf), "<folder-listing>"
+			 "<folder name=\"Images\" modified=\"%s\"/>"
+			 "<folder name=\"Empty\"/>"
+			 "<file name=\"a.txt\" size=\"5\"/>"
+			 "</folder-listing>", images_mtime);
+	else if (!strcmp(remotename, "/Images/"))
+		snprintf(buf, sizeof(buf), "<folder-listing>"
+			 "<file name=\"x.jpg\" size=\"100\"/>"
+			 "<file name=\"y.jpg\" size=\"20\"/>"
+			 "<file name=\".h.jpg\" size=\"7\"/>"
+			 "<folder name=\"Sub\" modified=\"20200101T000000Z\"/>"
+			 "</folder-listing>");
+	else if (!strcmp(remotename, "/Images/Sub/"))
+		snprintf(buf, sizeof(buf), "<folder-listing>"
+			 "<file name=\"z.jpg\" size=\"1\"/>"
+			 "</folder-listing>");
+	else
+		snprintf(buf, sizeof(buf), "<folder-listing></folder-listing>");
+
+	free(cli->buf_data);
+	cli->buf_data = strdup(buf);
+	cli->buf_size = strlen(buf);
+	return 1;
+}
+
+int obexftp_info(obexftp_client_t *UNUSED(cli), uint8_t UNUSED(opcode))
+{
+	return -1;
+}
+
+static void info_cb(int UNUSED(event), const char *UNUSED(buf), int UNUSED(len), void *UNUSED(data))
+{
+}
+
+/* sums up the sizes of the matches */
+static void sum_cb(const char *UNUSED(path), const stat_entry_t *st, void *data)
+{
+	*(int *)data += st->size;
+}
+
+static void test_find(obexftp_client_t *cli)
+{
+	int sum;
+
+	sum = 0;
+	CHECK(obexftp_find(cli, NULL, NULL, 0, -1, 0, sum_cb, &sum) == 5);
+	CHECK(sum == 133);
+	/* a leading dot is not matched by a wildcard */
+	sum = 0;
+	CHECK(obexftp_find(cli, "/", "*.jpg", 0, -1, 0, sum_cb, &sum) == 3);
+	CHECK(sum == 121);
+	CHECK(obexftp_find(cli, "/", ".*", 0, -1, 0, NULL, NULL) == 1);
+	/* the size limits are inclusive */
+	sum = 0;
+	CHECK(obexftp_find(cli, "/", "*.jpg", 20, 100, 0, sum_cb, &sum) == 2);
+	CHECK(sum == 120);
+	CHECK(obexftp_find(cli, "/", NULL, 6, 99, 0, NULL, NULL) == 2);
+	CHECK(obexftp_find(cli, "/", NULL, 101, -1, 0, NULL, NULL) == 0);
+	CHECK(obexftp_find(cli, "/Images/Sub", "z*", 0, -1, 0, NULL, NULL) == 1);
+}
+
+static void test_tree(obexftp_client_t *cli)
+{
+	obexftp_tree_t *tree;
+
+	tree = obexftp_tree_open(cli, NULL);
+	CHECK(tree != NULL);
+	if (!tree)
+		return;
+	CHECK(tree->listings == 4);
+	CHECK(obexftp_tree_lookup(tree, "/Images/Sub/z.jpg") != NULL);
+
+	/* folders without a time are always listed again */
+	CHECK(obexftp_tree_refresh(tree, FALSE) == 2);
+	CHECK(obexftp_tree_lookup(tree, "/Images/Sub/z.jpg") != NULL);
+
+	/* a changed time lists that folder, its unchanged subfolder is kept */
+	images_mtime = "20210101T000000Z";
+	CHECK(obexftp_tree_refresh(tree, FALSE) == 3);
+	CHECK(obexftp_tree_lookup(tree, "/Images/Sub/z.jpg") != NULL);
+
+	CHECK(obexftp_tree_refresh(tree, TRUE) == 4);
+	obexftp_tree_close(tree);
+}
+
+static void test_trim(obexftp_client_t *cli)
+{
+	void *dir;
+	char name[32];
+	int i;
+
+	cli->cwd_id = path_intern(cli->paths, "/Images");
+
+	/* nothing is forgotten while a listing is in use */
+	dir = obexftp_opendir(cli, "/");
+	CHECK(dir != NULL);
+	for (i = 0; i <= PATH_TABLE_MAX; i++) {
+		sprintf(name, "/missing%d", i);
+		CHECK(obexftp_stat(cli, name) == NULL);
+	}
+	CHECK(path_table_count(cli->paths) > PATH_TABLE_MAX);
+	obexftp_closedir(dir);
+
+	/* the next call that interns forgets all but the current folder */
+	listings = 0;
+	CHECK(obexftp_stat(cli, "/a.txt") != NULL);
+	CHECK(listings == 1);
+	CHECK(path_table_count(cli->paths) < 10);
+	CHECK(!strcmp(path_name(cli->paths, cli->cwd_id), "Images"));
+
+	/* a full purge forgets the paths too */
+	cache_purge(cli, PATH_UNKNOWN);
+	cache_trim_paths(cli, TRUE);
+	CHECK(path_table_count(cli->paths) == 2);
+}
+
+int main(void)
+{
+	obexftp_client_t cli;
+
+	memset(&cli, 0, sizeof(cli));
+	cli.infocb = info_cb;
+	cli.quirks = DEFAULT_OBEXFTP_QUIRKS;
+	cli.cache_timeout = DEFAULT_CACHE_TIMEOUT;
+	cli.cwd_id = PATH_UNKNOWN;
+	cli.paths = path_table_new();
+	CHECK(cli.paths != NULL);
+	if (!cli.paths)
+		return 1;
+
+	test_find(&cli);
+	test_tree(&cli);
+	test_trim(&cli);
+
+	cache_purge(&cli, PATH_UNKNOWN);
+	body_cache_purge(&cli, PATH_UNKNOWN);
+	path_table_free(cli.paths);
+	free(cli.buf_data);
+
+	if (failed)
+		fprintf(stderr, "%d checks failed\n", failed);
+	return failed ? 1 : 0;
+}
@@ -55,8 +55,10 @@
 #include "obexftp_io.h"
 #include "uuid.h"
 #include "cache.h"
+#include "pathtab.h"
 
 #include <common.h>
+#include <probes.h>
 
 
 #pragma pack(1)
@@ -171,6 +173,19 @@ static void split_file_path(const char *name, /*@only@*/ char **basepath, /*@onl
 }
 
 
+/**
+	Invalidate the cached listings and bodies for a changed path.
+	Purges everything and clears the path table if the path is unknown.
+ */
+static void purge_path(obexftp_client_t *cli, int id)
+{
+	cache_purge(cli, id);
+	body_cache_purge(cli, id);
+	if (id < 0)
+		cache_trim_paths(cli, TRUE);
+}
+
+
 /**
 	Add more data from memory to stream.
  */
@@ -370,6 +385,7 @@ static void cli_obex_event(obex_t *handle, obex_object_t *object, int UNUSED(mod
 
 	switch (event)	{
 	case OBEX_EV_PROGRESS:
+		PROBE1(obexftp, progress, cli);
 		cli->infocb(OBEXFTP_EV_PROGRESS, "", 0, cli->infocb_data);
 		break;
 	case OBEX_EV_REQDONE:
@@ -386,12 +402,14 @@ static void cli_obex_event(obex_t *handle, obex_object_t *object, int UNUSED(mod
 		break;
 	
 	case OBEX_EV_LINKERR:
+		PROBE1(obexftp, link__error, cli);
 		cli->finished = TRUE;
 		cli->success = FALSE;
 		DEBUG(2, "%s() OBEX_EV_LINKERR\n", __func__);
 		break;
 	
 	case OBEX_EV_STREAMEMPTY:
+		PROBE1(obexftp, stream__empty, cli);
 		if (cli->out_data)
 			(void) cli_fillstream_from_memory(cli, object);
 		else
@@ -439,14 +457,19 @@ static int obexftp_sync(obexftp_client_t *cli)
  */
 static int cli_sync_request(obexftp_client_t *cli, obex_object_t *object)
 {
+	int ret;
+
 	DEBUG(3, "%s()\n", __func__);
 
 	if (cli->finished == FALSE)
 		return -EBUSY;
 	cli->finished = FALSE;
+	PROBE2(obexftp, request__start, cli, OBEX_ObjectGetCommand(cli->obexhandle, object));
 	(void) OBEX_Request(cli->obexhandle, object);
 
-	return obexftp_sync (cli);
+	ret = obexftp_sync (cli);
+	PROBE2(obexftp, request__done, cli, ret);
+	return ret;
 }
 
 
@@ -481,8 +504,11 @@ obexftp_client_t *obexftp_open(int transport, /*const*/ obex_ctrans_t *ctrans, o
 	cli->quirks = DEFAULT_OBEXFTP_QUIRKS;
 	cli->cache_timeout = DEFAULT_CACHE_TIMEOUT;
 	cli->cache_maxsize = DEFAULT_CACHE_MAXSIZE;
+	cli->body_cache_size = DEFAULT_BODY_CACHE_SIZE;
+	cli->meminfo_timeout = DEFAULT_MEMINFO_TIMEOUT;
 
 	cli->fd = -1;
+	cli->cwd_id = PATH_UNKNOWN;
 
        	cli->obexhandle = OBEX_Init(transport, cli_obex_event, 0);
 
@@ -510,6 +536,13 @@ obexftp_client_t *obexftp_open(int transport, /*const*/ obex_ctrans_t *ctrans, o
 		return NULL;
 	}
 
+	cli->paths = path_table_new();
+	if(cli->paths == NULL) {
+		free(cli->stream_chunk);
+		free(cli);
+		return NULL;
+	}
+
 	return cli;
 }
 
@@ -534,7 +567,9 @@ void obexftp_close(obexftp_client_t *cli)
 		DEBUG(1, "%s: Warning: purging left-over buffer.\n", __func__);
 		free(cli->buf_data);
 	}
-	cache_purge(&cli->cache, NULL);
+	purge_path(cli, PATH_UNKNOWN);
+	path_table_free(cli->paths);
+	free(cli->meminfo);
 	free(cli->stream_chunk);
 	free(cli);
 }
@@ -763,6 +798,9 @@ int obexftp_connect_src(obexftp_client_t *cli, const char *src, const char *devi
 	else
 		cli->infocb(OBEXFTP_EV_OK, "", 0, cli->infocb_data);
 
+	/* a new session starts at the root folder */
+	cli->cwd_id = ret < 0 ? PATH_UNKNOWN : PATH_ROOT;
+
 	return ret;
 }
 
@@ -792,6 +830,8 @@ int obexftp_disconnect(obexftp_client_t *cli)
 				    hv, sizeof(uint32_t), OBEX_FL_FIT_ONE_PACKET);
 	}
 	ret = cli_sync_request(cli, object);
+	cli->cwd_id = PATH_UNKNOWN;
+	cache_trim_paths(cli, FALSE);
 
 	if(ret < 0)
 		cli->infocb(OBEXFTP_EV_ERR, "disconnect", 0, cli->infocb_data);
@@ -842,6 +882,9 @@ int obexftp_info(obexftp_client_t *cli, uint8_t opcode)
 /**
 	Send an OBEX GET with optional TYPE.
 	Directories will be changed into first if split path quirk is set.
+	Small file bodies received into the buffer are served from the
+	body cache while the cached listing still shows the same size and
+	modification time.
 
 	\param cli an obexftp_client_t created by obexftp_open().
 	\param type OBEX TYPE of the request
@@ -856,6 +899,8 @@ int obexftp_get_type(obexftp_client_t *cli, const char *type, const char *localn
 {
 	obex_object_t *object = NULL;
 	int ret;
+	int size;
+	int id = PATH_UNKNOWN;
 
 	return_val_if_fail(cli != NULL, -EINVAL);
 	return_val_if_fail(remotename != NULL || type != NULL, -EINVAL);
@@ -873,6 +918,18 @@ int obexftp_get_type(obexftp_client_t *cli, const char *type, const char *localn
 	else
 		cli->target_fn = NULL;
 
+	/* resolve before any setpath */
+	if (!type && remotename)
+		id = path_resolve(cli->paths, cli->cwd_id, remotename);
+
+	if (!type && !cli->target_fn && id >= 0 &&
+	    !get_cache_body(cli, id, &cli->buf_data, &size)) {
+		cli->buf_size = size;
+		cli->infocb(OBEXFTP_EV_BODY, cli->buf_data, cli->buf_size, cli->infocb_data);
+		cli->infocb(OBEXFTP_EV_OK, remotename, 0, cli->infocb_data);
+		return 1;
+	}
+
 	if (OBEXFTP_USE_SPLIT_SETPATH(cli->quirks) && remotename && strchr(remotename, '/')) {
 		char *basepath, *basename;
 		split_file_path(remotename, &basepath, &basename);
@@ -901,23 +958,139 @@ int obexftp_get_type(obexftp_client_t *cli, const char *type, const char *localn
 	else
 		cli->infocb(OBEXFTP_EV_OK, remotename, 0, cli->infocb_data);
 
+	if (ret >= 0 && id >= 0 && cli->buf_data)
+		(void) put_cache_body(cli, id, cli->buf_data, cli->buf_size);
+
+	return ret;
+}
+
+
+/**
+	Send an OBEX ACTION request, the cached entries it changes are dropped.
+ */
+static int cli_action(obexftp_client_t *cli, uint8_t action, const char *name, const char *destname, uint32_t perms)
+{
+	obex_object_t *object;
+
+	object = obexftp_build_action (cli->obexhandle, cli->connection_id, action, name, destname, perms);
+	if(object == NULL)
+		return -1;
+
+	if (action != OBEXFTP_ACTION_COPY)
+		purge_path(cli, path_resolve(cli->paths, cli->cwd_id, name));
+	if (destname)
+		purge_path(cli, path_resolve(cli->paths, cli->cwd_id, destname));
+	return cli_sync_request(cli, object);
+}
+
+
+/**
+	Copy a file on the device with an OBEX ACTION request.
+	No data is transferred, the device makes the copy.
+
+	\param cli an obexftp_client_t created by obexftp_open().
+	\param sourcename remote filename to be copied
+	\param targetname remote target filename
+
+	\return the result of the OBEX ACTION request
+ */
+int obexftp_copy(obexftp_client_t *cli, const char *sourcename, const char *targetname)
+{
+	int ret;
+
+	return_val_if_fail(cli != NULL, -EINVAL);
+
+	cli->infocb(OBEXFTP_EV_SENDING, sourcename, 0, cli->infocb_data);
+
+	DEBUG(2, "%s() Copying %s -> %s\n", __func__, sourcename, targetname);
+	ret = cli_action(cli, OBEXFTP_ACTION_COPY, sourcename, targetname, 0);
+
+	if(ret < 0)
+		cli->infocb(OBEXFTP_EV_ERR, sourcename, 0, cli->infocb_data);
+	else
+		cli->infocb(OBEXFTP_EV_OK, sourcename, 0, cli->infocb_data);
+
+	return ret;
+}
+
+
+/**
+	Move or rename a file or folder on the device with an OBEX ACTION request.
+
+	\param cli an obexftp_client_t created by obexftp_open().
+	\param sourcename remote filename to be moved
+	\param targetname remote target filename
+
+	\return the result of the OBEX ACTION request
+
+	\note obexftp_rename() falls back to the Siemens request.
+ */
+int obexftp_move(obexftp_client_t *cli, const char *sourcename, const char *targetname)
+{
+	int ret;
+
+	return_val_if_fail(cli != NULL, -EINVAL);
+
+	cli->infocb(OBEXFTP_EV_SENDING, sourcename, 0, cli->infocb_data);
+
+	DEBUG(2, "%s() Moving %s -> %s\n", __func__, sourcename, targetname);
+	ret = cli_action(cli, OBEXFTP_ACTION_MOVE, sourcename, targetname, 0);
+
+	if(ret < 0)
+		cli->infocb(OBEXFTP_EV_ERR, sourcename, 0, cli->infocb_data);
+	else
+		cli->infocb(OBEXFTP_EV_OK, sourcename, 0, cli->infocb_data);
+
 	return ret;
 }
 
 
 /**
-	Send an custom Siemens OBEX rename request.
+	Set the permissions of a file or folder on the device with an OBEX ACTION request.
+
+	\param cli an obexftp_client_t created by obexftp_open().
+	\param name remote filename
+	\param perms OBEXFTP_PERM_ bits, e.g. OBEXFTP_PERM_READ << OBEXFTP_PERM_OTHER
+
+	\return the result of the OBEX ACTION request
+ */
+int obexftp_set_permissions(obexftp_client_t *cli, const char *name, uint32_t perms)
+{
+	int ret;
+
+	return_val_if_fail(cli != NULL, -EINVAL);
+
+	cli->infocb(OBEXFTP_EV_SENDING, name, 0, cli->infocb_data);
+
+	DEBUG(2, "%s() Setting permissions of %s to %06x\n", __func__, name, perms);
+	ret = cli_action(cli, OBEXFTP_ACTION_SETPERM, name, NULL, perms);
+
+	if(ret < 0)
+		cli->infocb(OBEXFTP_EV_ERR, name, 0, cli->infocb_data);
+	else
+		cli->infocb(OBEXFTP_EV_OK, name, 0, cli->infocb_data);
+
+	return ret;
+}
+
+
+/**
+	Rename a file or folder on the device. The standard OBEX ACTION
+	request is tried first, then the custom Siemens rename request if
+	the device answered the ACTION with any error. Devices differ in
+	how they refuse an unknown ACTION.
 
 	\param cli an obexftp_client_t created by obexftp_open().
 	\param sourcename remote filename to be renamed
 	\param targetname remote target filename
 
-	\return the result of Siemens rename request
+	\return the result of the rename request
  */
 int obexftp_rename(obexftp_client_t *cli, const char *sourcename, const char *targetname)
 {
 	obex_object_t *object = NULL;
 	int ret;
+	int source_id, target_id;
 
 	return_val_if_fail(cli != NULL, -EINVAL);
 
@@ -925,13 +1098,22 @@ int obexftp_rename(obexftp_client_t *cli, const char *sourcename, const char *ta
 
 	DEBUG(2, "%s() Moving %s -> %s\n", __func__, sourcename, targetname);
 
-        object = obexftp_build_rename (cli->obexhandle, cli->connection_id, sourcename, targetname);
-        if(object == NULL)
-                return -1;
-	
-	cache_purge(&cli->cache, NULL);
-	ret = cli_sync_request(cli, object);
-		
+	ret = cli_action(cli, OBEXFTP_ACTION_MOVE, sourcename, targetname, 0);
+	/* not on a link error, -1, the device did not answer at all */
+	if (ret <= -OBEX_RSP_BAD_REQUEST) {
+		DEBUG(2, "%s() ACTION failed (%02x), trying the Siemens rename\n", __func__, -ret);
+		object = obexftp_build_rename (cli->obexhandle, cli->connection_id, sourcename, targetname);
+		if(object == NULL)
+			return -1;
+
+		source_id = path_resolve(cli->paths, cli->cwd_id, sourcename);
+		target_id = path_resolve(cli->paths, cli->cwd_id, targetname);
+		purge_path(cli, source_id);
+		if (source_id >= 0)
+			purge_path(cli, target_id);
+		ret = cli_sync_request(cli, object);
+	}
+
 	if(ret < 0)
 		cli->infocb(OBEXFTP_EV_ERR, sourcename, 0, cli->infocb_data);
 	else
@@ -953,11 +1135,15 @@ int obexftp_del(obexftp_client_t *cli, const char *name)
 {
 	obex_object_t *object;
 	int ret;
+	int id;
 
 	return_val_if_fail(cli != NULL, -EINVAL);
 
 	cli->infocb(OBEXFTP_EV_SENDING, name, 0, cli->infocb_data);
 
+	/* resolve before any setpath */
+	id = path_resolve(cli->paths, cli->cwd_id, name);
+
 	/* split path and go there first */
 	if (OBEXFTP_USE_SPLIT_SETPATH(cli->quirks) && name && strchr(name, '/')) {
 		char *basepath, *basename;
@@ -980,7 +1166,7 @@ int obexftp_del(obexftp_client_t *cli, const char *name)
 	if(object == NULL)
 		return -1;
 	
-	cache_purge(&cli->cache, NULL);
+	purge_path(cli, id);
 	ret = cli_sync_request(cli, object);
 	
 	if(ret < 0)
@@ -1008,11 +1194,29 @@ int obexftp_setpath(obexftp_client_t *cli, const char *name, int create)
 	obex_object_t *object;
 	int ret = 0;
 	char *copy, *tail, *p;
+	int target;
 
 	return_val_if_fail(cli != NULL, -EINVAL);
 
 	DEBUG(2, "%s() Changing to %s\n", __func__, name);
 
+	/* where we will end up, if we know where we are */
+	if (!name)
+		target = cli->cwd_id < 0 ? PATH_UNKNOWN : path_parent(cli->paths, cli->cwd_id);
+	else if (*name == '\0')
+		target = PATH_ROOT;
+	else if (OBEXFTP_USE_SPLIT_SETPATH(cli->quirks) || !strchr(name, '/'))
+		target = path_resolve(cli->paths, cli->cwd_id, name);
+	else
+		target = PATH_UNKNOWN; /* up to the device */
+
+	/* absolute paths often lead to where we are */
+	if (name && target >= 0 && target == cli->cwd_id) {
+		DEBUG(2, "%s() Already in %s\n", __func__, name);
+		cli->infocb(OBEXFTP_EV_OK, name, 0, cli->infocb_data);
+		return 0;
+	}
+
 	if (OBEXFTP_USE_SPLIT_SETPATH(cli->quirks) && name && *name && strchr(name, '/')) {
 		tail = copy = strdup(name);
 
@@ -1024,6 +1228,7 @@ int obexftp_setpath(obexftp_client_t *cli, const char *name, int create)
 	
 			cli->infocb(OBEXFTP_EV_SENDING, tail, 0, cli->infocb_data);
 			DEBUG(2, "%s() Setpath \"%s\" (create:%d)\n", __func__, tail, create);
+			PROBE3(obexftp, setpath, cli, tail, create);
 			/* try without the create flag */
 			object = obexftp_build_setpath (cli->obexhandle, cli->connection_id, tail, 0);
 			ret = cli_sync_request(cli, object);
@@ -1045,11 +1250,20 @@ int obexftp_setpath(obexftp_client_t *cli, const char *name, int create)
 	} else {
 		cli->infocb(OBEXFTP_EV_SENDING, name, 0, cli->infocb_data);
 		DEBUG(2, "%s() Setpath \"%s\"\n", __func__, name);
+		PROBE3(obexftp, setpath, cli, name, create);
 		object = obexftp_build_setpath (cli->obexhandle, cli->connection_id, name, create);
 		ret = cli_sync_request(cli, object);
 	}
-	if (create)
-		cache_purge(&cli->cache, NULL); /* no way to know where we started */
+	/* a failed split setpath may have stopped anywhere */
+	cli->cwd_id = ret < 0 ? PATH_UNKNOWN : target;
+
+	if (create) {
+		/* new folders are somewhere on the way */
+		if (target >= 0)
+			cache_purge_parents(cli, target);
+		else
+			purge_path(cli, PATH_UNKNOWN); /* no way to know where we started */
+	}
 
 	if(ret < 0)
 		cli->infocb(OBEXFTP_EV_ERR, name, 0, cli->infocb_data);
@@ -1075,6 +1289,7 @@ int obexftp_put_file(obexftp_client_t *cli, const char *filename, const char *re
 {
 	obex_object_t *object;
 	int ret;
+	int id;
 
 	return_val_if_fail(cli != NULL, -EINVAL);
 	return_val_if_fail(filename != NULL, -EINVAL);
@@ -1095,6 +1310,9 @@ int obexftp_put_file(obexftp_client_t *cli, const char *filename, const char *re
 			remotename = filename;
 	}
 
+	/* resolve before any setpath */
+	id = path_resolve(cli->paths, cli->cwd_id, remotename);
+
 	if (OBEXFTP_USE_SPLIT_SETPATH(cli->quirks) && remotename && strchr(remotename, '/')) {
 		char *basepath, *basename;
 		split_file_path(remotename, &basepath, &basename);
@@ -1118,7 +1336,7 @@ int obexftp_put_file(obexftp_client_t *cli, const char *filename, const char *re
 		ret = -1;
 	else {
 		cli->out_data = NULL; /* dont free, isnt ours */
-		cache_purge(&cli->cache, NULL);
+		purge_path(cli, id);
 		ret = cli_sync_request(cli, object);
 	}
 	
@@ -1150,6 +1368,7 @@ int obexftp_put_data(obexftp_client_t *cli, const uint8_t *data, int size,
 {
 	obex_object_t *object;
 	int ret;
+	int id;
 
 	return_val_if_fail(cli != NULL, -EINVAL);
 	return_val_if_fail(remotename != NULL, -EINVAL);
@@ -1162,6 +1381,9 @@ int obexftp_put_data(obexftp_client_t *cli, const uint8_t *data, int size,
 
 	cli->infocb(OBEXFTP_EV_SENDING, remotename, 0, cli->infocb_data);
 
+	/* resolve before any setpath */
+	id = path_resolve(cli->paths, cli->cwd_id, remotename);
+
 	if (OBEXFTP_USE_SPLIT_SETPATH(cli->quirks) && remotename && strchr(remotename, '/')) {
 		char *basepath, *basename;
 		split_file_path(remotename, &basepath, &basename);
@@ -1185,7 +1407,7 @@ int obexftp_put_data(obexftp_client_t *cli, const uint8_t *data, int size,
 	cli->out_pos = 0;
 	cli->fd = -1;
 	
-	cache_purge(&cli->cache, NULL);
+	purge_path(cli, id);
 	ret = cli_sync_request(cli, object);
 
 	if(ret < 0)
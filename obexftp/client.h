@@ -54,7 +54,9 @@ extern "C" {
 #define DEFAULT_OBEXFTP_QUIRKS	\
 	(OBEXFTP_LEADING_SLASH | OBEXFTP_TRAILING_SLASH | OBEXFTP_SPLIT_SETPATH | OBEXFTP_CONN_HEADER)
 #define DEFAULT_CACHE_TIMEOUT 180	/* 3 minutes */
-#define DEFAULT_CACHE_MAXSIZE 10240	/* 10k */
+#define DEFAULT_CACHE_MAXSIZE 10240	/* 10k, largest file body to cache */
+#define DEFAULT_BODY_CACHE_SIZE 262144	/* 256k, byte budget for file bodies */
+#define DEFAULT_MEMINFO_TIMEOUT 10	/* 10 seconds */
 
 /* types */
 
@@ -67,6 +69,13 @@ typedef struct {
 	time_t ctime;
 } stat_entry_t;
 
+typedef struct {
+	char location[256];	/* as reported, with '/' separators */
+	uint64_t total;
+	uint64_t free;
+	int namelen;	/* max. filename length, 0 if unknown */
+} obexftp_meminfo_t;
+
 typedef struct cache_object cache_object_t;
 struct cache_object
 {
@@ -77,6 +86,8 @@ struct cache_object
 	char *name;
 	char *content;	/* or uint8_t */
 	stat_entry_t *stats;	/* only if its a parsed directory */
+	time_t mtime;	/* only if its a file body */
+	int path_id;	/* interned name */
 };
 
 typedef struct {
@@ -109,8 +120,36 @@ typedef struct {
 	int cache_timeout;
 	int cache_maxsize;
 	int accept_timeout; /* accept/reject timeout in seconds */
+	/* more persistence, appended to keep the offsets above */
+	cache_object_t *body_cache; /* small file bodies, most recent first */
+	int body_cache_size; /* byte budget for body_cache */
+	int body_cache_used;
+	obexftp_meminfo_t *meminfo; /* one entry per memory location */
+	int meminfo_count;
+	time_t meminfo_timestamp;
+	int meminfo_timeout;
+	struct path_table *paths; /* interned paths */
+	int cwd_id; /* interned current folder, -1 if unknown */
 } obexftp_client_t;
 
+typedef struct obexftp_tree_node obexftp_tree_node_t;
+struct obexftp_tree_node
+{
+	obexftp_tree_node_t *next;	/* next entry in the same folder */
+	obexftp_tree_node_t *children;	/* only if its a folder */
+	int listed;	/* children are known */
+	stat_entry_t st;
+};
+
+typedef struct {
+	obexftp_client_t *cli;
+	char *root;	/* path of the indexed folder */
+	obexftp_tree_node_t top;	/* the indexed folder itself */
+	int listings;	/* folders listed by the last open/refresh */
+} obexftp_tree_t;
+
+typedef void (*obexftp_tree_cb_t) (const char *path, const stat_entry_t *st, void *data);
+
 
 /* session */
 
@@ -191,11 +230,23 @@ int obexftp_put_data(obexftp_client_t *cli, const uint8_t *data, int size,
 
 int obexftp_del(obexftp_client_t *cli, const char *name);
 
+int obexftp_copy(obexftp_client_t *cli,
+		 const char *sourcename,
+		 const char *targetname);
+
+int obexftp_move(obexftp_client_t *cli,
+		 const char *sourcename,
+		 const char *targetname);
+
+int obexftp_set_permissions(obexftp_client_t *cli, const char *name,
+			    uint32_t perms);
+
 
 /* Siemens only */
 
 int obexftp_info(obexftp_client_t *cli, uint8_t opcode);
 
+/* OBEX ACTION move, the Siemens request if that is not implemented */
 int obexftp_rename(obexftp_client_t *cli,
 		   const char *sourcename,
 		   const char *targetname);
@@ -211,6 +262,34 @@ stat_entry_t *obexftp_readdir(void *dir);
 
 stat_entry_t *obexftp_stat(obexftp_client_t *cli, const char *name);
 
+int obexftp_find(obexftp_client_t *cli, /*@null@*/ const char *root,
+		 /*@null@*/ const char *pattern,
+		 int min_size, int max_size, time_t newer_than,
+		 /*@null@*/ obexftp_tree_cb_t cb, /*@null@*/ void *data);
+
+
+/* device tree index */
+
+/*@null@*/ obexftp_tree_t *obexftp_tree_open(obexftp_client_t *cli, /*@null@*/ const char *root);
+
+int obexftp_tree_refresh(obexftp_tree_t *tree, int full);
+
+void obexftp_tree_close(/*@only@*/ /*@null@*/ obexftp_tree_t *tree);
+
+/*@null@*/ const stat_entry_t *obexftp_tree_lookup(obexftp_tree_t *tree, const char *path);
+
+int obexftp_tree_glob(obexftp_tree_t *tree, const char *pattern,
+		      /*@null@*/ obexftp_tree_cb_t cb, /*@null@*/ void *data);
+
+int obexftp_tree_du(obexftp_tree_t *tree, /*@null@*/ const char *path,
+		    uint64_t *bytes, /*@null@*/ int *files, /*@null@*/ int *folders);
+
+
+/* memory info */
+
+int obexftp_get_meminfo(obexftp_client_t *cli, /*@null@*/ const char *path,
+			obexftp_meminfo_t *info);
+
 
 #ifdef __cplusplus
 }
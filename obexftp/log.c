@@ -0,0 +1,400 @@
+/**
+	\file obexftp/log.c
+	ObexFTP leveled logging.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2002-2007 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+/* Messages go straight to stderr until obexftp_log_start() is called.
+   From then on each thread formats into a ring buffer of its own and
+   a flusher thread writes the rings out. A thread never waits for the
+   flusher or for another thread; if its ring is full the message is
+   dropped and counted. Messages of one thread stay in order, messages
+   of different threads may interleave by up to one flush interval. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "log.h"
+
+#include <common.h>
+
+/* per thread, a power of two */
+#define LOG_RING_SIZE	(64 * 1024)
+/* longer messages are cut */
+#define LOG_LINE_MAX	1024
+/* ms between flushes, a ring half full flushes at once */
+#define LOG_FLUSH_MS	50
+
+/* with DEBUG() built in the level starts at the build time level */
+int obexftp_log_level = OBEXFTP_DEBUG;
+
+/**
+	Set the level of messages to show.
+
+	\param level one of OBEXFTP_LOG_ERROR to OBEXFTP_LOG_TRACE
+ */
+void obexftp_log_set_level(int level)
+{
+	obexftp_log_level = level < 0 ? 0 : level;
+}
+
+int obexftp_log_get_level(void)
+{
+	return obexftp_log_level;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+#if defined(HAVE_PTHREAD) && defined(__GNUC__)
+
+/* one per thread, written by its thread and read by the flusher */
+typedef struct log_ring {
+	struct log_ring *next;
+	unsigned long head;	/* bytes written, by the owner */
+	unsigned long tail;	/* bytes flushed, by the flusher */
+	unsigned long dropped;	/* messages that did not fit, by the owner */
+	unsigned long reported;	/* dropped count already reported, by the flusher */
+	int dead;		/* the thread is gone, free once flushed */
+	char buf[LOG_RING_SIZE];
+} log_ring_t;
+
+static __thread log_ring_t *my_ring = NULL;
+
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER; /* rings list and flushing */
+static pthread_mutex_t wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+static pthread_key_t ring_key;
+static pthread_t flusher;
+static log_ring_t *rings = NULL;
+static int log_fd = -1;		/* buffered when not -1 */
+static int flusher_up = 0;	/* the flusher thread runs */
+static int stopping = 0;
+static int wake_pending = 0;
+
+/* write out what the rings hold, called with ring_lock held */
+static void drain_rings(void)
+{
+	log_ring_t **link, *r;
+	unsigned long head, tail, dropped, off, n;
+	char note[64];
+
+	for (link = &rings; (r = *link); ) {
+		head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		tail = r->tail;
+		while (tail != head) {
+			off = tail & (LOG_RING_SIZE - 1);
+			n = head - tail;
+			if (n > LOG_RING_SIZE - off)
+				n = LOG_RING_SIZE - off;
+			(void) write_all(log_fd, r->buf + off, n);
+			tail += n;
+		}
+		__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+
+		dropped = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+		if (dropped != r->reported) {
+			n = snprintf(note, sizeof(note), "(%lu log messages dropped)\n", dropped - r->reported);
+			(void) write_all(log_fd, note, n);
+			r->reported = dropped;
+		}
+
+		if (__atomic_load_n(&r->dead, __ATOMIC_ACQUIRE) &&
+		    __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail) {
+			*link = r->next;
+			free(r);
+			continue;
+		}
+		link = &r->next;
+	}
+}
+
+static void wake_flusher(void)
+{
+	pthread_mutex_lock(&wake_lock);
+	wake_pending = 1;
+	pthread_cond_signal(&wake_cond);
+	pthread_mutex_unlock(&wake_lock);
+}
+
+static void *flush_thread(void *UNUSED(arg))
+{
+	struct timespec ts;
+
+	pthread_mutex_lock(&wake_lock);
+	while (!stopping) {
+		if (!wake_pending) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += LOG_FLUSH_MS * 1000000L;
+			if (ts.tv_nsec >= 1000000000L) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000L;
+			}
+			(void) pthread_cond_timedwait(&wake_cond, &wake_lock, &ts);
+		}
+		wake_pending = 0;
+		pthread_mutex_unlock(&wake_lock);
+
+		pthread_mutex_lock(&ring_lock);
+		drain_rings();
+		pthread_mutex_unlock(&ring_lock);
+
+		pthread_mutex_lock(&wake_lock);
+	}
+	pthread_mutex_unlock(&wake_lock);
+	return NULL;
+}
+
+/* started lazily, so that a daemon may fork after obexftp_log_start() */
+static void start_flusher(void)
+{
+	pthread_mutex_lock(&ring_lock);
+	if (!flusher_up && log_fd != -1 && !stopping)
+		__atomic_store_n(&flusher_up, pthread_create(&flusher, NULL, flush_thread, NULL) == 0,
+				 __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&ring_lock);
+}
+
+/* a thread exits, its ring goes once flushed */
+static void ring_release(void *data)
+{
+	log_ring_t *r = data;
+
+	__atomic_store_n(&r->dead, 1, __ATOMIC_RELEASE);
+}
+
+static log_ring_t *ring_new(void)
+{
+	log_ring_t *r;
+
+	r = calloc(1, sizeof(log_ring_t));
+	if (!r)
+		return NULL;
+	pthread_mutex_lock(&ring_lock);
+	r->next = rings;
+	rings = r;
+	pthread_mutex_unlock(&ring_lock);
+	(void) pthread_setspecific(ring_key, r);
+	my_ring = r;
+	return r;
+}
+
+/* the child only has the forking thread, it needs a flusher of its own */
+static void fork_prepare(void)
+{
+	pthread_mutex_lock(&ring_lock);
+	pthread_mutex_lock(&wake_lock);
+}
+
+static void fork_parent(void)
+{
+	pthread_mutex_unlock(&wake_lock);
+	pthread_mutex_unlock(&ring_lock);
+}
+
+static void fork_child(void)
+{
+	log_ring_t *r;
+
+	/* the parent writes what is pending, the other threads are gone */
+	for (r = rings; r; r = r->next) {
+		r->tail = r->head;
+		r->reported = r->dropped;
+		if (r != my_ring)
+			r->dead = 1;
+	}
+	flusher_up = 0;
+	wake_pending = 0;
+	pthread_mutex_unlock(&wake_lock);
+	pthread_mutex_unlock(&ring_lock);
+}
+
+static int log_ring_write(const char *line, unsigned long len)
+{
+	log_ring_t *r = my_ring;
+	unsigned long head, tail, off, n;
+
+	if (__builtin_expect(!__atomic_load_n(&flusher_up, __ATOMIC_ACQUIRE), 0))
+		start_flusher();
+	if (!r && !(r = ring_new()))
+		return -1;
+
+	head = r->head;
+	tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	if (len > LOG_RING_SIZE - (head - tail)) {
+		__atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	off = head & (LOG_RING_SIZE - 1);
+	n = len < LOG_RING_SIZE - off ? len : LOG_RING_SIZE - off;
+	memcpy(r->buf + off, line, n);
+	memcpy(r->buf, line + n, len - n);
+	__atomic_store_n(&r->head, head + len, __ATOMIC_RELEASE);
+
+	/* half full, don't wait for the timer */
+	if (head + len - tail > LOG_RING_SIZE / 2)
+		wake_flusher();
+	return 0;
+}
+
+/**
+	Buffer the messages of each thread and write them from a
+	background thread. Logging threads never block on the output.
+
+	\param fd where to write, e.g. STDERR_FILENO
+
+	\return 0 on success or a negative error code
+ */
+int obexftp_log_start(int fd)
+{
+	static int once = 0;
+
+	if (!once) {
+		if (pthread_key_create(&ring_key, ring_release) != 0)
+			return -ENOMEM;
+		(void) pthread_atfork(fork_prepare, fork_parent, fork_child);
+		/* for the exit() paths */
+		(void) atexit(obexftp_log_flush);
+		once = 1;
+	}
+	pthread_mutex_lock(&ring_lock);
+	log_fd = fd;
+	stopping = 0;
+	pthread_mutex_unlock(&ring_lock);
+	return 0;
+}
+
+/**
+	Write out all buffered messages now.
+ */
+void obexftp_log_flush(void)
+{
+	pthread_mutex_lock(&ring_lock);
+	if (log_fd != -1)
+		drain_rings();
+	pthread_mutex_unlock(&ring_lock);
+}
+
+/**
+	Flush and stop the background thread. Messages go straight to
+	stderr again.
+ */
+void obexftp_log_stop(void)
+{
+	int up;
+
+	pthread_mutex_lock(&wake_lock);
+	stopping = 1;
+	pthread_cond_signal(&wake_cond);
+	pthread_mutex_unlock(&wake_lock);
+
+	pthread_mutex_lock(&ring_lock);
+	up = flusher_up;
+	__atomic_store_n(&flusher_up, 0, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&ring_lock);
+	if (up)
+		(void) pthread_join(flusher, NULL);
+
+	obexftp_log_flush();
+	pthread_mutex_lock(&ring_lock);
+	log_fd = -1;
+	pthread_mutex_unlock(&ring_lock);
+}
+
+#else /* HAVE_PTHREAD && __GNUC__ */
+
+static int log_fd = -1;
+
+static int log_ring_write(const char *line, unsigned long len)
+{
+	return write_all(log_fd, line, len);
+}
+
+int obexftp_log_start(int fd)
+{
+	log_fd = fd;
+	return 0;
+}
+
+void obexftp_log_flush(void)
+{
+}
+
+void obexftp_log_stop(void)
+{
+	log_fd = -1;
+}
+
+#endif /* HAVE_PTHREAD && __GNUC__ */
+
+/**
+	Log a message of the given level, see OBEXFTP_LOG().
+ */
+void obexftp_vlog(int level, const char *format, va_list args)
+{
+	char line[LOG_LINE_MAX];
+	int len;
+
+	if (level > obexftp_log_level)
+		return;
+	if (log_fd == -1) {
+		vfprintf(stderr, format, args);
+		return;
+	}
+
+	len = vsnprintf(line, sizeof(line), format, args);
+	if (len < 0)
+		return;
+	if (len >= (int)sizeof(line)) {
+		len = sizeof(line) - 1;
+		line[len - 1] = '\n';
+	}
+	if (log_ring_write(line, len) < 0)
+		(void) write_all(log_fd, line, len);
+}
+
+void obexftp_log(int level, const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	obexftp_vlog(level, format, args);
+	va_end(args);
+}
@@ -0,0 +1,72 @@
+/**
+	\file obexftp/log.h
+	ObexFTP leveled logging.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2002-2007 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+#ifndef OBEXFTP_LOG_H
+#define OBEXFTP_LOG_H
+
+#include <stdarg.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* log levels, a message is shown if its level is at most the current one */
+#define OBEXFTP_LOG_ERROR	0	/* always shown */
+#define OBEXFTP_LOG_INFO	1	/* sessions and notable events */
+#define OBEXFTP_LOG_VERBOSE	2	/* every request */
+#define OBEXFTP_LOG_DEBUG	3	/* headers and internals */
+#define OBEXFTP_LOG_TRACE	4	/* every packet */
+
+/** The current level. Read it through OBEXFTP_LOG(), set it with obexftp_log_set_level(). */
+extern int obexftp_log_level;
+
+#ifdef __GNUC__
+#define OBEXFTP_LOG_ENABLED(n)	__builtin_expect((n) <= obexftp_log_level, 0)
+#else
+#define OBEXFTP_LOG_ENABLED(n)	((n) <= obexftp_log_level)
+#endif
+
+/** Log a message. The arguments are not evaluated if the level is off. */
+#define OBEXFTP_LOG(n, ...)	do { if (OBEXFTP_LOG_ENABLED(n)) obexftp_log((n), __VA_ARGS__); } while (0)
+
+void obexftp_log_set_level(int level);
+
+int obexftp_log_get_level(void);
+
+void obexftp_log(int level, const char *format, ...)
+#ifdef __GNUC__
+	__attribute__ ((format (printf, 2, 3)))
+#endif
+	;
+
+void obexftp_vlog(int level, const char *format, va_list args);
+
+int obexftp_log_start(int fd);
+
+void obexftp_log_flush(void);
+
+void obexftp_log_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OBEXFTP_LOG_H */
@@ -0,0 +1,94 @@
+/**
+	\file obexftp/log_test.c
+	Unit test for the buffered log.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2002-2007 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+/* gcc -Wall -I. -I.. -I../includes -DHAVE_PTHREAD -o log_test log.c log_test.c -lpthread */
+
+/* Writes several times the ring size in lines of odd lengths, so
+   that lines are split at the end of the ring, and checks that all
+   come out whole and in order. The log is flushed often enough that
+   nothing is dropped. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#include <common.h>
+
+#define LINES		3000
+#define FLUSH_EVERY	64	/* lines, well below the ring size */
+
+static int failed = 0;
+
+#define CHECK(expr) do { if (!(expr)) { \
+	fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+	failed++; } } while (0)
+
+/* a filler of a length that varies from line to line */
+static const char *filler(int i, char *buf)
+{
+	int len = (i * 37) % 251;
+
+	memset(buf, 'a' + i % 26, len);
+	buf[len] = '\0';
+	return buf;
+}
+
+int main(void)
+{
+	FILE *out;
+	char fill[256], expect[512], line[512];
+	long total = 0;
+	int i;
+
+	out = tmpfile();
+	CHECK(out != NULL);
+	if (!out)
+		return 1;
+
+	obexftp_log_set_level(OBEXFTP_LOG_INFO);
+	CHECK(obexftp_log_start(fileno(out)) == 0);
+	for (i = 0; i < LINES; i++) {
+		OBEXFTP_LOG(OBEXFTP_LOG_INFO, "%d %s\n", i, filler(i, fill));
+		OBEXFTP_LOG(OBEXFTP_LOG_DEBUG, "not shown %d\n", i);
+		if (i % FLUSH_EVERY == FLUSH_EVERY - 1)
+			obexftp_log_flush();
+	}
+	obexftp_log_stop();
+
+	rewind(out);
+	for (i = 0; i < LINES && fgets(line, sizeof(line), out); i++) {
+		snprintf(expect, sizeof(expect), "%d %s\n", i, filler(i, fill));
+		CHECK(!strcmp(line, expect));
+		total += strlen(line);
+	}
+	CHECK(i == LINES);
+	CHECK(fgets(line, sizeof(line), out) == NULL);
+	/* the ring is 64k, this went around it a few times */
+	CHECK(total > 4 * 64 * 1024);
+	fclose(out);
+
+	if (failed)
+		fprintf(stderr, "%d checks failed\n", failed);
+	return failed ? 1 : 0;
+}
@@ -176,6 +176,68 @@ obex_object_t *obexftp_build_rename (obex_t *obex, uint32_t conn, const char *fr
 }
 
 
+/**
+	Build an ACTION request object.
+
+	\param obex reference to an OpenOBEX instance.
+	\param conn optional connection id number
+	\param action OBEXFTP_ACTION_COPY, OBEXFTP_ACTION_MOVE or OBEXFTP_ACTION_SETPERM
+	\param from name of the object to act on
+	\param to destination name, for copy and move
+	\param perms permission bits, for set permissions
+	\return a new obex object if successful, NULL otherwise
+
+	\note \a from may not be NULL, nor \a to for copy and move
+ */
+obex_object_t *obexftp_build_action (obex_t *obex, uint32_t conn, uint8_t action, const char *from, const char *to, uint32_t perms)
+{
+	obex_object_t *object;
+	obex_headerdata_t hv;
+        uint8_t *ucname;
+        int ucname_len;
+
+        if(from == NULL || (to == NULL && action != OBEXFTP_ACTION_SETPERM))
+                return NULL;
+
+        object = OBEX_ObjectNew(obex, OBEX_CMD_ACTION);
+        if(object == NULL)
+                return NULL;
+
+        if(conn != 0xffffffff) {
+		hv.bq4 = conn;
+		(void) OBEX_ObjectAddHeader(obex, object, OBEX_HDR_CONNECTION, hv, sizeof(uint32_t), OBEX_FL_FIT_ONE_PACKET);
+	}
+
+	hv.bq1 = action;
+	(void) OBEX_ObjectAddHeader(obex, object, OBEX_HDR_ACTION_ID, hv, 1, OBEX_FL_FIT_ONE_PACKET);
+
+	ucname = malloc(strlen(from)*2 + 2 > (to ? strlen(to)*2 + 2 : 0) ?
+			strlen(from)*2 + 2 : strlen(to)*2 + 2);
+	if(ucname == NULL) {
+                (void) OBEX_ObjectDelete(obex, object);
+	        return NULL;
+	}
+
+	ucname_len = CharToUnicode(ucname, (uint8_t*)from, strlen(from)*2 + 2);
+	hv.bs = (const uint8_t *) ucname;
+	(void) OBEX_ObjectAddHeader(obex, object, OBEX_HDR_NAME, hv, ucname_len, OBEX_FL_FIT_ONE_PACKET);
+
+	if (to != NULL && action != OBEXFTP_ACTION_SETPERM) {
+		ucname_len = CharToUnicode(ucname, (uint8_t*)to, strlen(to)*2 + 2);
+		hv.bs = (const uint8_t *) ucname;
+		(void) OBEX_ObjectAddHeader(obex, object, OBEX_HDR_DESTNAME, hv, ucname_len, OBEX_FL_FIT_ONE_PACKET);
+	}
+	free(ucname);
+
+	if (action == OBEXFTP_ACTION_SETPERM) {
+		hv.bq4 = perms;
+		(void) OBEX_ObjectAddHeader(obex, object, OBEX_HDR_PERMISSIONS, hv, sizeof(uint32_t), OBEX_FL_FIT_ONE_PACKET);
+	}
+
+	return object;
+}
+
+
 /**
 	Build a DELETE request object.
 
@@ -43,10 +43,27 @@ extern "C" {
  * parameter 0x01: mem installed, 0x02: free mem */
 #define APPARAM_INFO_CODE '2'
 
+/** OBEX ACTION: copy an object to the destination name. */
+#define OBEXFTP_ACTION_COPY	0x00
+/** OBEX ACTION: move or rename an object to the destination name. */
+#define OBEXFTP_ACTION_MOVE	0x01
+/** OBEX ACTION: set the permissions of an object. */
+#define OBEXFTP_ACTION_SETPERM	0x02
+
+/** OBEX ACTION permission bits, shift by OBEXFTP_PERM_USER, _GROUP or _OTHER. */
+#define OBEXFTP_PERM_READ	0x01
+#define OBEXFTP_PERM_WRITE	0x02
+#define OBEXFTP_PERM_DELETE	0x04
+#define OBEXFTP_PERM_MODIFY	0x80
+#define OBEXFTP_PERM_USER	0
+#define OBEXFTP_PERM_GROUP	8
+#define OBEXFTP_PERM_OTHER	16
+
 
 /*@null@*/ obex_object_t *obexftp_build_info (obex_t *obex, uint32_t conn, uint8_t opcode);
 /*@null@*/ obex_object_t *obexftp_build_get (obex_t *obex, uint32_t conn, const char *name, const char *type);
 /*@null@*/ obex_object_t *obexftp_build_rename (obex_t *obex, uint32_t conn, const char *from, const char *to);
+/*@null@*/ obex_object_t *obexftp_build_action (obex_t *obex, uint32_t conn, uint8_t action, const char *from, /*@null@*/ const char *to, uint32_t perms);
 /*@null@*/ obex_object_t *obexftp_build_del (obex_t *obex, uint32_t conn, const char *name);
 /*@null@*/ obex_object_t *obexftp_build_setpath (obex_t *obex, uint32_t conn, const char *name, int create);
 /*@null@*/ obex_object_t *obexftp_build_put (obex_t *obex, uint32_t conn, const char *name, int size);
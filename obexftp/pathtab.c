@@ -0,0 +1,325 @@
+/**
+	\file obexftp/pathtab.c
+	ObexFTP client API path interning.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2002-2007 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pathtab.h"
+
+#include <common.h>
+
+/*
+	Every normalized path gets a small integer id. The id of a path never
+	changes while the table lives, so ids can be compared instead of
+	strings. Each entry links to its parent, the root "" is PATH_ROOT.
+	Paths are stored without leading and trailing slashes.
+ */
+
+typedef struct {
+	char *name;
+	int parent;
+	unsigned int hash;
+	int next;	/* next entry in the same hash bucket */
+} path_entry_t;
+
+struct path_table {
+	path_entry_t *entries;
+	int count;
+	int alloc;
+	int *buckets;
+	int nbuckets;
+};
+
+
+static unsigned int hash_path(const char *name, int len)
+{
+	unsigned int h = 5381;
+
+	while (len-- > 0)
+		h = h * 33 + (unsigned char)*name++;
+	return h;
+}
+
+/**
+	Grow the hash buckets, rehashing all entries.
+ */
+static int grow_buckets(path_table_t *tab)
+{
+	int *buckets;
+	int i, n;
+
+	n = tab->nbuckets ? tab->nbuckets * 2 : 64;
+	buckets = malloc(n * sizeof(int));
+	if (!buckets)
+		return -1;
+	for (i = 0; i < n; i++)
+		buckets[i] = PATH_UNKNOWN;
+	for (i = 0; i < tab->count; i++) {
+		tab->entries[i].next = buckets[tab->entries[i].hash % n];
+		buckets[tab->entries[i].hash % n] = i;
+	}
+	free(tab->buckets);
+	tab->buckets = buckets;
+	tab->nbuckets = n;
+	return 0;
+}
+
+/**
+	Intern a normalized path of \a len chars, and all its parents.
+ */
+static int intern_normalized(path_table_t *tab, const char *name, int len)
+{
+	path_entry_t *entry, *entries;
+	unsigned int hash;
+	int i, parent;
+
+	hash = hash_path(name, len);
+	for (i = tab->buckets[hash % tab->nbuckets]; i >= 0; i = tab->entries[i].next) {
+		entry = &tab->entries[i];
+		if (entry->hash == hash && !strncmp(entry->name, name, len) && entry->name[len] == '\0')
+			return i;
+	}
+
+	/* the parent first, the root has none */
+	if (len > 0) {
+		for (i = len - 1; i > 0 && name[i] != '/'; i--);
+		parent = intern_normalized(tab, name, i);
+		if (parent < 0)
+			return PATH_UNKNOWN;
+	} else
+		parent = PATH_UNKNOWN;
+
+	if (tab->count >= tab->alloc) {
+		entries = realloc(tab->entries, (tab->alloc * 2) * sizeof(path_entry_t));
+		if (!entries)
+			return PATH_UNKNOWN;
+		tab->entries = entries;
+		tab->alloc *= 2;
+	}
+	entry = &tab->entries[tab->count];
+	entry->name = malloc(len + 1);
+	if (!entry->name)
+		return PATH_UNKNOWN;
+	memcpy(entry->name, name, len);
+	entry->name[len] = '\0';
+	entry->parent = parent;
+	entry->hash = hash;
+	entry->next = tab->buckets[hash % tab->nbuckets];
+	tab->buckets[hash % tab->nbuckets] = tab->count;
+	tab->count++;
+
+	if (tab->count > tab->nbuckets)
+		(void) grow_buckets(tab);
+
+	return tab->count - 1;
+}
+
+/**
+	Create an empty path table, holding just the root.
+ */
+path_table_t *path_table_new(void)
+{
+	path_table_t *tab;
+
+	tab = calloc(1, sizeof(path_table_t));
+	if (!tab)
+		return NULL;
+	tab->alloc = 64;
+	tab->entries = malloc(tab->alloc * sizeof(path_entry_t));
+	if (!tab->entries || grow_buckets(tab) < 0 ||
+	    intern_normalized(tab, "", 0) != PATH_ROOT) {
+		path_table_free(tab);
+		return NULL;
+	}
+	return tab;
+}
+
+/**
+	Free a path table and all names.
+ */
+void path_table_free(path_table_t *tab)
+{
+	int i;
+
+	if (!tab)
+		return;
+	for (i = 0; i < tab->count; i++)
+		free(tab->entries[i].name);
+	free(tab->entries);
+	free(tab->buckets);
+	free(tab);
+}
+
+/**
+	Forget all paths but the root. Ids handed out before are invalid
+	afterwards and may be reused.
+ */
+void path_table_clear(path_table_t *tab)
+{
+	int i;
+
+	return_if_fail(tab != NULL);
+
+	for (i = 1; i < tab->count; i++)
+		free(tab->entries[i].name);
+	tab->count = 1;
+	for (i = 0; i < tab->nbuckets; i++)
+		tab->buckets[i] = PATH_UNKNOWN;
+	tab->entries[PATH_ROOT].next = PATH_UNKNOWN;
+	tab->buckets[tab->entries[PATH_ROOT].hash % tab->nbuckets] = PATH_ROOT;
+}
+
+/**
+	Get the number of paths held, including the root.
+ */
+int path_table_count(const path_table_t *tab)
+{
+	return_val_if_fail(tab != NULL, 0);
+
+	return tab->count;
+}
+
+/**
+	Get the id of a path, relative paths are taken as absolute.
+	Repeated slashes and leading or trailing slashes are ignored,
+	"." is dropped and ".." removes the component before it, but
+	never goes above the root.
+
+	\return the id or PATH_UNKNOWN if out of memory
+ */
+int path_intern(path_table_t *tab, const char *path)
+{
+	char *copy, *p;
+	int id, len;
+
+	return_val_if_fail(tab != NULL, PATH_UNKNOWN);
+	return_val_if_fail(path != NULL, PATH_UNKNOWN);
+
+	p = copy = malloc(strlen(path) + 1);
+	if (!copy)
+		return PATH_UNKNOWN;
+	while (*path) {
+		while (*path == '/') path++;
+		len = strcspn(path, "/");
+		if (len == 0 || (len == 1 && path[0] == '.')) {
+			/* nothing or the same folder */
+		} else if (len == 2 && path[0] == '.' && path[1] == '.') {
+			while (p > copy && *--p != '/');
+		} else {
+			if (p > copy)
+				*p++ = '/';
+			memcpy(p, path, len);
+			p += len;
+		}
+		path += len;
+	}
+	*p = '\0';
+
+	id = intern_normalized(tab, copy, p - copy);
+	free(copy);
+	return id;
+}
+
+/**
+	Get the id of a path as seen from folder \a cwd.
+
+	\return the id, PATH_UNKNOWN for a relative path if \a cwd is unknown
+ */
+int path_resolve(path_table_t *tab, int cwd, const char *name)
+{
+	const char *base;
+	char *path;
+	int id;
+
+	return_val_if_fail(tab != NULL, PATH_UNKNOWN);
+
+	if (!name)
+		return cwd;
+	if (*name == '/')
+		return path_intern(tab, name);
+	if (cwd < 0 || cwd >= tab->count)
+		return PATH_UNKNOWN;
+
+	base = tab->entries[cwd].name;
+	path = malloc(strlen(base) + strlen(name) + 2);
+	if (!path)
+		return PATH_UNKNOWN;
+	strcpy(path, base);
+	strcat(path, "/");
+	strcat(path, name);
+	id = path_intern(tab, path);
+	free(path);
+	return id;
+}
+
+/**
+	Get the normalized path for an id, "" for the root.
+ */
+const char *path_name(const path_table_t *tab, int id)
+{
+	return_val_if_fail(tab != NULL, NULL);
+	return_val_if_fail(id >= 0 && id < tab->count, NULL);
+
+	return tab->entries[id].name;
+}
+
+/**
+	Get the last component of the path for an id.
+ */
+const char *path_basename(const path_table_t *tab, int id)
+{
+	const char *name, *p;
+
+	name = path_name(tab, id);
+	if (!name)
+		return NULL;
+	p = strrchr(name, '/');
+	return p ? p + 1 : name;
+}
+
+/**
+	Get the parent id, PATH_UNKNOWN for the root.
+ */
+int path_parent(const path_table_t *tab, int id)
+{
+	return_val_if_fail(tab != NULL, PATH_UNKNOWN);
+	return_val_if_fail(id >= 0 && id < tab->count, PATH_UNKNOWN);
+
+	return tab->entries[id].parent;
+}
+
+/**
+	Check if a path is \a ancestor itself or below it.
+ */
+int path_is_below(const path_table_t *tab, int id, int ancestor)
+{
+	return_val_if_fail(tab != NULL, FALSE);
+
+	if (ancestor < 0)
+		return FALSE;
+	while (id >= 0 && id < tab->count) {
+		if (id == ancestor)
+			return TRUE;
+		id = tab->entries[id].parent;
+	}
+	return FALSE;
+}
@@ -0,0 +1,60 @@
+/**
+	\file obexftp/pathtab.h
+	ObexFTP client API path interning.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2002-2007 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+#ifndef OBEXFTP_PATHTAB_H
+#define OBEXFTP_PATHTAB_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the device root always has this id */
+#define PATH_ROOT	0
+/* an id for an unknown path */
+#define PATH_UNKNOWN	-1
+
+typedef struct path_table path_table_t;
+
+/*@null@*/ path_table_t *path_table_new(void);
+
+void path_table_free(/*@only@*/ /*@null@*/ path_table_t *tab);
+
+void path_table_clear(path_table_t *tab);
+
+int path_table_count(const path_table_t *tab);
+
+int path_intern(path_table_t *tab, const char *path);
+
+int path_resolve(path_table_t *tab, int cwd, /*@null@*/ const char *name);
+
+const char *path_name(const path_table_t *tab, int id);
+
+const char *path_basename(const path_table_t *tab, int id);
+
+int path_parent(const path_table_t *tab, int id);
+
+int path_is_below(const path_table_t *tab, int id, int ancestor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OBEXFTP_PATHTAB_H */
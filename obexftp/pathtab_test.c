@@ -0,0 +1,116 @@
+/**
+	\file obexftp/pathtab_test.c
+	Unit test for the path table.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2002-2007 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+/* gcc -Wall -I. -I../includes -o pathtab_test pathtab.c pathtab_test.c */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pathtab.h"
+
+#include <common.h>
+
+static int failed = 0;
+
+#define CHECK(expr) do { if (!(expr)) { \
+	fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+	failed++; } } while (0)
+
+int main(void)
+{
+	path_table_t *tab;
+	char name[32];
+	int a, ab, abc, x, i;
+
+	tab = path_table_new();
+	CHECK(tab != NULL);
+	if (!tab)
+		return 1;
+	CHECK(path_table_count(tab) == 1);
+	CHECK(!strcmp(path_name(tab, PATH_ROOT), ""));
+	CHECK(path_parent(tab, PATH_ROOT) == PATH_UNKNOWN);
+
+	/* interning normalizes slashes and adds the parents */
+	abc = path_intern(tab, "//a/b//c/");
+	CHECK(abc > PATH_ROOT);
+	CHECK(!strcmp(path_name(tab, abc), "a/b/c"));
+	CHECK(!strcmp(path_basename(tab, abc), "c"));
+	CHECK(path_table_count(tab) == 4);
+	ab = path_parent(tab, abc);
+	a = path_intern(tab, "a");
+	CHECK(!strcmp(path_name(tab, ab), "a/b"));
+	CHECK(path_parent(tab, ab) == a);
+	CHECK(path_parent(tab, a) == PATH_ROOT);
+	CHECK(path_intern(tab, "/a/b/c") == abc);
+
+	/* relative names need a known folder */
+	CHECK(path_resolve(tab, ab, "c") == abc);
+	CHECK(path_resolve(tab, a, "b/c") == abc);
+	CHECK(path_resolve(tab, PATH_UNKNOWN, "c") == PATH_UNKNOWN);
+	CHECK(path_resolve(tab, PATH_UNKNOWN, "/a/b") == ab);
+	CHECK(path_resolve(tab, ab, NULL) == ab);
+	CHECK(path_resolve(tab, PATH_ROOT, "a") == a);
+
+	/* a path is below itself and its parents only */
+	x = path_intern(tab, "/a/bx");
+	CHECK(path_is_below(tab, abc, abc));
+	CHECK(path_is_below(tab, abc, a));
+	CHECK(path_is_below(tab, abc, PATH_ROOT));
+	CHECK(!path_is_below(tab, a, abc));
+	CHECK(!path_is_below(tab, x, ab));
+	CHECK(!path_is_below(tab, abc, PATH_UNKNOWN));
+	CHECK(!path_is_below(tab, PATH_UNKNOWN, PATH_ROOT));
+
+	/* dot components are folded, ".." stops at the root */
+	CHECK(path_intern(tab, "/a/./b/c") == abc);
+	CHECK(path_intern(tab, "x/../a/b/c/d/..") == abc);
+	CHECK(path_intern(tab, "../../a") == a);
+	CHECK(path_intern(tab, "a/..") == PATH_ROOT);
+	CHECK(path_resolve(tab, abc, "../../b/./c") == abc);
+	CHECK(path_resolve(tab, ab, "..") == a);
+	CHECK(path_parent(tab, path_intern(tab, "a/x/../b/f")) == ab);
+	CHECK(path_table_count(tab) == 6);
+
+	/* enough paths to grow the entries and the buckets */
+	for (i = 0; i < 1000; i++) {
+		sprintf(name, "/d%d/f%d", i % 10, i);
+		CHECK(path_intern(tab, name) >= 0);
+	}
+	CHECK(path_table_count(tab) == 6 + 10 + 1000);
+	CHECK(path_intern(tab, "/d3/f503") == path_resolve(tab, path_intern(tab, "d3"), "f503"));
+
+	/* clearing keeps the root, ids are handed out anew */
+	path_table_clear(tab);
+	CHECK(path_table_count(tab) == 1);
+	CHECK(path_intern(tab, "") == PATH_ROOT);
+	CHECK(path_intern(tab, "/z") == 1);
+	CHECK(!strcmp(path_name(tab, 1), "z"));
+	CHECK(path_name(tab, 2) == NULL);
+	CHECK(path_intern(tab, "/a/b/c") == 4);
+	CHECK(path_is_below(tab, 4, 2));
+
+	path_table_free(tab);
+
+	if (failed)
+		fprintf(stderr, "%d checks failed\n", failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,387 @@
+/**
+	\file obexftp/tree.c
+	ObexFTP client API device tree index.
+	ObexFTP library - language bindings for OBEX file transfer.
+
+	Copyright (c) 2002-2007 Christian W. Zuckschwerdt <zany@triq.net>
+
+	ObexFTP is free software; you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation; either version 2 of
+	the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with ObexFTP. If not, see <http://www.gnu.org/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+
+#include <openobex/obex.h>
+
+#include "obexftp.h"
+#include "client.h"
+#include "cache.h"
+
+#include <common.h>
+
+
+/**
+	Free a list of nodes and all their children.
+ */
+static void free_nodes(obexftp_tree_node_t *node)
+{
+	obexftp_tree_node_t *next;
+
+	for (; node; node = next) {
+		next = node->next;
+		free_nodes(node->children);
+		free(node);
+	}
+}
+
+/**
+	Join a folder path and an entry name.
+ */
+static char *join_path(const char *path, const char *name)
+{
+	char *p;
+
+	p = malloc(strlen(path) + strlen(name) + 2);
+	if (!p)
+		return NULL;
+	strcpy(p, path);
+	if (*path && path[strlen(path) - 1] != '/')
+		strcat(p, "/");
+	strcat(p, name);
+	return p;
+}
+
+/**
+	List a folder and rebuild its children.
+	Subfolders are only listed again if \a full is set or if the parent
+	listing reports a different modification time than last time. The
+	folder listing has no child count, so the time is all there is to
+	compare. An unchanged subfolder keeps its old subtree and is not
+	descended into, changes further down go unnoticed until its own
+	time changes or a full refresh.
+
+	\return 0 on success or a negative error code if the folder could not be listed
+ */
+static int list_folder(obexftp_tree_t *tree, const char *path, obexftp_tree_node_t *folder, int full)
+{
+	obexftp_tree_node_t *old, **link, *node, *prev, *tail = NULL;
+	stat_entry_t *stats, *entry;
+	char *subpath;
+
+	DEBUG(2, "%s() listing '%s'\n", __func__, path);
+	folder->listed = 0; /* until the listing succeeds */
+	stats = reload_cache_dir(tree->cli, path);
+	if (!stats)
+		return -ENOENT;
+	tree->listings++;
+
+	old = folder->children;
+	folder->children = NULL;
+
+	for (entry = stats; *entry->name; entry++) {
+		node = calloc(1, sizeof(obexftp_tree_node_t));
+		if (!node)
+			break;
+		node->st = *entry;
+
+		/* append in listing order */
+		if (tail)
+			tail->next = node;
+		else
+			folder->children = node;
+		tail = node;
+
+		if (!S_ISDIR(node->st.mode))
+			continue;
+
+		/* find the previous node of this folder */
+		for (link = &old, prev = NULL; *link && strcmp((*link)->st.name, node->st.name); link = &(*link)->next);
+		if (*link) {
+			prev = *link;
+			*link = prev->next;
+			prev->next = NULL;
+		}
+
+		if (prev && S_ISDIR(prev->st.mode) && prev->listed && !full &&
+		    node->st.mtime != 0 &&
+		    node->st.mtime == prev->st.mtime) {
+			DEBUG(3, "%s() '%s' unchanged\n", __func__, node->st.name);
+			node->children = prev->children;
+			node->listed = 1;
+			prev->children = NULL;
+		} else {
+			if (prev && S_ISDIR(prev->st.mode)) {
+				/* keep the old subtree for comparison */
+				node->children = prev->children;
+				node->listed = prev->listed;
+				prev->children = NULL;
+			}
+			subpath = join_path(path, node->st.name);
+			if (subpath) {
+				if (list_folder(tree, subpath, node, full) < 0)
+					DEBUG(1, "%s() could not list '%s'\n", __func__, subpath);
+				free(subpath);
+			}
+		}
+		free_nodes(prev);
+	}
+
+	free_nodes(old);
+	folder->listed = 1;
+	return 0;
+}
+
+/**
+	Index all entries below a folder.
+
+	\param cli an obexftp_client_t created by obexftp_open().
+	\param root the folder to start at, the device root if NULL
+
+	\return a new allocated tree or NULL if \a root could not be listed
+
+	\note Every folder is listed once. Use obexftp_tree_refresh() to
+	pick up changes on the device.
+ */
+obexftp_tree_t *obexftp_tree_open(obexftp_client_t *cli, const char *root)
+{
+	obexftp_tree_t *tree;
+
+	return_val_if_fail(cli != NULL, NULL);
+
+	tree = calloc(1, sizeof(obexftp_tree_t));
+	if (!tree)
+		return NULL;
+	tree->cli = cli;
+	tree->root = strdup(root ? root : "");
+	tree->top.st.mode = S_IFDIR;
+
+	cache_trim_paths(cli, FALSE);
+	if (!tree->root || list_folder(tree, tree->root, &tree->top, TRUE) < 0) {
+		obexftp_tree_close(tree);
+		return NULL;
+	}
+	DEBUG(2, "%s() indexed '%s' with %d listings\n", __func__, tree->root, tree->listings);
+
+	return tree;
+}
+
+/**
+	Update an index with the changes on the device.
+
+	\param tree an obexftp_tree_t created by obexftp_tree_open().
+	\param full list every folder again if set
+
+	\return the number of folders listed or a negative error code
+
+	\note Without \a full a folder is skipped, with its whole subtree,
+	if the parent listing still reports the same modification time.
+	Devices that do not update folder times need a full refresh.
+ */
+int obexftp_tree_refresh(obexftp_tree_t *tree, int full)
+{
+	int ret;
+
+	return_val_if_fail(tree != NULL, -EINVAL);
+
+	tree->listings = 0;
+	cache_trim_paths(tree->cli, FALSE);
+	ret = list_folder(tree, tree->root, &tree->top, full);
+	if (ret < 0)
+		return ret;
+	DEBUG(2, "%s() refreshed '%s' with %d listings\n", __func__, tree->root, tree->listings);
+
+	return tree->listings;
+}
+
+/**
+	Free an index.
+ */
+void obexftp_tree_close(obexftp_tree_t *tree)
+{
+	if (!tree)
+		return;
+	free_nodes(tree->top.children);
+	free(tree->root);
+	free(tree);
+}
+
+/**
+	Find the node for a path.
+ */
+static obexftp_tree_node_t *find_node(obexftp_tree_t *tree, const char *path)
+{
+	obexftp_tree_node_t *node = &tree->top;
+	const char *root = tree->root;
+	const char *start = path;
+	const char *p;
+	int len;
+
+	/* strip the root path, ignoring separators */
+	while (*root || *path == '/') {
+		if (*root == '/') {
+			root++;
+			continue;
+		}
+		if (*path == '/') {
+			path++;
+			continue;
+		}
+		if (*root != *path)
+			return NULL;
+		root++;
+		path++;
+	}
+	if (path > start && *path && *(path - 1) != '/')
+		return NULL; /* only a prefix of the last root component */
+
+	while (*path) {
+		p = strchr(path, '/');
+		len = p ? p - path : (int)strlen(path);
+		for (node = node->children; node; node = node->next)
+			if (!strncmp(node->st.name, path, len) && node->st.name[len] == '\0')
+				break;
+		if (!node)
+			return NULL;
+		path += len;
+		while (*path == '/') path++;
+	}
+
+	return node;
+}
+
+/**
+	Stat an entry in the index.
+
+	\param tree an obexftp_tree_t created by obexftp_tree_open().
+	\param path the absolute path on the device
+
+	\return the entry or NULL if there is no such entry in the index
+ */
+const stat_entry_t *obexftp_tree_lookup(obexftp_tree_t *tree, const char *path)
+{
+	obexftp_tree_node_t *node;
+
+	return_val_if_fail(tree != NULL, NULL);
+	return_val_if_fail(path != NULL, NULL);
+
+	node = find_node(tree, path);
+	if (!node)
+		return NULL;
+	return &node->st;
+}
+
+static int glob_nodes(obexftp_tree_node_t *node, const char *path, const char *pattern,
+		      obexftp_tree_cb_t cb, void *data)
+{
+	char *subpath;
+	int n = 0;
+
+	for (; node; node = node->next) {
+		subpath = join_path(path, node->st.name);
+		if (!subpath)
+			break;
+		if (!fnmatch(pattern, subpath, FNM_PATHNAME | FNM_PERIOD)) {
+			if (cb)
+				cb(subpath, &node->st, data);
+			n++;
+		}
+		n += glob_nodes(node->children, subpath, pattern, cb, data);
+		free(subpath);
+	}
+
+	return n;
+}
+
+/**
+	Find all entries in the index matching a shell wildcard pattern.
+
+	\param tree an obexftp_tree_t created by obexftp_tree_open().
+	\param pattern a pattern for the absolute path, e.g. "/Images/\*.jpg"
+	\param cb called with the path and stat entry of each match
+	\param data passed to \a cb
+
+	\return the number of matches
+ */
+int obexftp_tree_glob(obexftp_tree_t *tree, const char *pattern, obexftp_tree_cb_t cb, void *data)
+{
+	char *root;
+	int n;
+
+	return_val_if_fail(tree != NULL, -EINVAL);
+	return_val_if_fail(pattern != NULL, -EINVAL);
+
+	root = join_path("/", tree->root[0] == '/' ? tree->root + 1 : tree->root);
+	if (!root)
+		return -ENOMEM;
+	n = glob_nodes(tree->top.children, root, pattern, cb, data);
+	free(root);
+
+	return n;
+}
+
+static void du_nodes(obexftp_tree_node_t *node, uint64_t *bytes, int *files, int *folders)
+{
+	for (; node; node = node->next) {
+		if (S_ISDIR(node->st.mode)) {
+			(*folders)++;
+			du_nodes(node->children, bytes, files, folders);
+		} else {
+			(*files)++;
+			*bytes += node->st.size;
+		}
+	}
+}
+
+/**
+	Sum up the sizes below a path in the index.
+
+	\param tree an obexftp_tree_t created by obexftp_tree_open().
+	\param path the absolute path on the device, the tree root if NULL
+	\param bytes total size of all files
+	\param files number of files, may be NULL
+	\param folders number of folders, may be NULL
+
+	\return 0 on success or -ENOENT if there is no such entry in the index
+ */
+int obexftp_tree_du(obexftp_tree_t *tree, const char *path,
+		    uint64_t *bytes, int *files, int *folders)
+{
+	obexftp_tree_node_t *node;
+	int nfiles = 0, nfolders = 0;
+
+	return_val_if_fail(tree != NULL, -EINVAL);
+	return_val_if_fail(bytes != NULL, -EINVAL);
+
+	node = path ? find_node(tree, path) : &tree->top;
+	if (!node)
+		return -ENOENT;
+
+	*bytes = 0;
+	if (S_ISDIR(node->st.mode)) {
+		du_nodes(node->children, bytes, &nfiles, &nfolders);
+	} else {
+		*bytes = node->st.size;
+		nfiles = 1;
+	}
+	if (files)
+		*files = nfiles;
+	if (folders)
+		*folders = nfolders;
+
+	return 0;
+}
@@ -96,3 +96,11 @@
 #warning "no char *, size_t in-typemap for this language"
 #endif
 };
+
+/* free arrays of strings from %newobject functions */
+%typemap(newfree) char ** {
+  char **p;
+  for (p = $1; p && *p; p++)
+    free(*p);
+  free($1);
+};
@@ -24,6 +24,22 @@
 %{
 #include <obexftp/obexftp.h>
 #include <obexftp/client.h>
+
+/* collect find results into a NULL terminated array */
+typedef struct {
+	char **paths;
+	int count;
+} path_list_t;
+
+static void collect_path(const char *path, const stat_entry_t *st, void *data) {
+	path_list_t *list = (path_list_t *)data;
+	char **paths = realloc(list->paths, (list->count + 2) * sizeof(char *));
+	if (!paths)
+		return;
+	list->paths = paths;
+	list->paths[list->count++] = strdup(path);
+	list->paths[list->count] = NULL;
+}
 %}
 
 %include "charmap.i"
@@ -166,5 +182,20 @@ int delete(char *name) {
 	return obexftp_del(self, name);
 }
 
+int copy(char *sourcename, char *targetname) {
+	return obexftp_copy(self, sourcename, targetname);
+}
+
+int move(char *sourcename, char *targetname) {
+	return obexftp_rename(self, sourcename, targetname);
+}
+
+%newobject find;
+char **find(char *root=NULL, char *pattern=NULL, int min_size=0, int max_size=-1, long newer_than=0) {
+	path_list_t list = { NULL, 0 };
+	(void) obexftp_find(self, root, pattern, min_size, max_size, newer_than, collect_path, &list);
+	return list.paths;
+}
+
 }
 